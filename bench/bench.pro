@@ -0,0 +1,14 @@
+# Headless benchmarks for desktop Linux, built separately from the
+# Sailfish application:
+#
+#   cd bench && qmake && make
+#   ./storage/skruuvi-bench-storage -o storage.xml,xml
+#   ./loadgen/skruuvi-loadgen --devices 200 --interval 1000 --duration 60
+#   ./plot/skruuvi-bench-plot --series 10 --points 2000
+#
+# QtTest writes machine-readable results with -o <file>,xml or -o <file>,csv
+TEMPLATE = subdirs
+
+SUBDIRS += storage \
+    loadgen \
+    plot
@@ -0,0 +1,45 @@
+# Headless advertisement load generator, needs no Bluetooth adapter
+TARGET = skruuvi-loadgen
+
+TEMPLATE = app
+CONFIG += console c++11
+CONFIG -= app_bundle
+CONFIG += link_pkgconfig
+PKGCONFIG += sqlite3
+
+QT += sql dbus
+QT -= gui
+
+INCLUDEPATH += ../../src
+
+HEADERS += \
+    ../../src/database.h \
+    ../../src/worker.h \
+    ../../src/latencystats.h \
+    ../../src/queryprofiler.h \
+    ../../src/rangesummary.h \
+    ../../src/plotcache.h \
+    ../../src/tilepyramid.h \
+    ../../src/csvimporter.h \
+    ../../src/sqlitebackup.h \
+    ../../src/derivedseries.h \
+    ../../src/advertisementsource.h \
+    ../../src/replayscanner.h \
+    ../../src/backgroundscanner.h \
+    ../../src/scanscheduler.h
+
+SOURCES += main.cpp \
+    ../../src/database.cpp \
+    ../../src/worker.cpp \
+    ../../src/latencystats.cpp \
+    ../../src/queryprofiler.cpp \
+    ../../src/rangesummary.cpp \
+    ../../src/plotcache.cpp \
+    ../../src/tilepyramid.cpp \
+    ../../src/csvimporter.cpp \
+    ../../src/sqlitebackup.cpp \
+    ../../src/derivedseries.cpp \
+    ../../src/advertisementsource.cpp \
+    ../../src/replayscanner.cpp \
+    ../../src/backgroundscanner.cpp \
+    ../../src/scanscheduler.cpp
@@ -0,0 +1,120 @@
+/*
+    Skruuvi - Reader for Ruuvi sensors
+    Copyright (C) 2025  Miika Malin
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see [http://www.gnu.org/licenses/].
+*/
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QEventLoop>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QStandardPaths>
+#include <QTimer>
+#include <QTextStream>
+#include <QScopedPointer>
+#include "database.h"
+#include "replayscanner.h"
+#include "backgroundscanner.h"
+#include "scanscheduler.h"
+
+// Feeds synthetic or recorded advertisements through the ingest path and
+// prints one JSON line of statistics per second, and a final summary.
+// With --bluez the BlueZ scanner is used instead, normally against
+// bench/mockbluez on a private bus (SKRUUVI_BLUEZ_BUS=session).
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    QCoreApplication::setApplicationName("skruuvi-loadgen");
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Skruuvi advertisement load generator");
+    parser.addHelpOption();
+    QCommandLineOption devicesOption("devices", "Number of virtual devices.", "n", "10");
+    QCommandLineOption intervalOption("interval", "Advertising interval of each device in ms.", "ms", "1000");
+    QCommandLineOption formatOption("format", "Data format 5 or 6, 0 mixes both.", "df", "5");
+    QCommandLineOption durationOption("duration", "Run time in seconds.", "s", "30");
+    QCommandLineOption replayOption("replay", "Play back a recorded advertisement file instead.", "file");
+    QCommandLineOption speedOption("speed", "Playback speed of the recording.", "factor", "1");
+    QCommandLineOption loopOption("loop", "Restart the recording when it ends.");
+    QCommandLineOption bluezOption("bluez", "Scan with BlueZ instead of generating advertisements.");
+    QCommandLineOption freshnessOption("freshness", "Duty cycle the scanning with this freshness target.", "s");
+    parser.addOptions({devicesOption, intervalOption, formatOption, durationOption, replayOption, speedOption, loopOption,
+                       bluezOption, freshnessOption});
+    parser.process(app);
+
+    // Use a throwaway database next to the test data, never the real one
+    QStandardPaths::setTestModeEnabled(true);
+    QFile::remove(QStandardPaths::writableLocation(QStandardPaths::AppDataLocation) + "/ruuviData.sqlite");
+    database db;
+    // The schema is created in the background, advertisements before that are dropped
+    if (!db.isReady()) {
+        QEventLoop readyLoop;
+        QObject::connect(&db, &database::readyChanged, &readyLoop, &QEventLoop::quit);
+        readyLoop.exec();
+    }
+    QScopedPointer<advertisementsource> source;
+
+    if (parser.isSet(bluezOption)) {
+        // Starts scanning right away
+        source.reset(new backgroundscanner(nullptr, &db));
+    } else {
+        replayscanner* replay = new replayscanner(nullptr, &db);
+        source.reset(replay);
+        if (parser.isSet(replayOption)) {
+            if (!replay->loadRecording(parser.value(replayOption), parser.value(speedOption).toDouble(), parser.isSet(loopOption))) {
+                return 1;
+            }
+        } else {
+            replay->setSyntheticLoad(parser.value(devicesOption).toInt(), parser.value(intervalOption).toInt(),
+                                     parser.value(formatOption).toInt());
+        }
+    }
+
+    scanscheduler scheduler(source.data(), &db);
+    // Stands in for a QML handler, so ui_handler_calls counts like in the app
+    QObject::connect(&db, &database::devicesUpdated, [](const QVariantList &) {});
+
+    QTextStream out(stdout);
+    auto printStats = [&source, &scheduler, &out]() {
+        QVariantMap stats = source->getStats();
+        if (scheduler.isEnabled()) {
+            stats["scheduler"] = scheduler.getStats();
+        }
+        out << QJsonDocument(QJsonObject::fromVariantMap(stats)).toJson(QJsonDocument::Compact) << "\n";
+        out.flush();
+    };
+
+    QTimer reportTimer;
+    QObject::connect(&reportTimer, &QTimer::timeout, printStats);
+    reportTimer.start(1000);
+
+    QTimer::singleShot(parser.value(durationOption).toInt() * 1000, &app, [&]() {
+        source->stopScan();
+        db.flushDeviceUpdates();
+        printStats();
+        // Per-stage ingest latencies of the whole run
+        out << QJsonDocument(QJsonObject::fromVariantMap(db.getLatencyStats())).toJson(QJsonDocument::Compact) << "\n";
+        app.quit();
+    });
+
+    if (!source->isScanning()) {
+        source->startScan();
+    }
+    if (parser.isSet(freshnessOption)) {
+        scheduler.setDefaultFreshnessTarget(parser.value(freshnessOption).toInt());
+        scheduler.setEnabled(true);
+    }
+    return app.exec();
+}
@@ -0,0 +1,193 @@
+#!/usr/bin/env python3
+#
+#   Skruuvi - Reader for Ruuvi sensors
+#   Copyright (C) 2025  Miika Malin
+#
+#   This program is free software: you can redistribute it and/or modify
+#   it under the terms of the GNU General Public License as published by
+#   the Free Software Foundation, either version 3 of the License, or
+#   (at your option) any later version.
+#
+#   This program is distributed in the hope that it will be useful,
+#   but WITHOUT ANY WARRANTY; without even the implied warranty of
+#   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+#   GNU General Public License for more details.
+#
+#   You should have received a copy of the GNU General Public License
+#   along with this program.  If not, see [http://www.gnu.org/licenses/].
+#
+# Minimal BlueZ mock for testing backgroundscanner without radios. It owns
+# org.bluez on the session bus and exports a number of adapters which all
+# hear the same Ruuvi tags, so every advertisement arrives once per adapter.
+# Other BLE devices can be added to see the effect of the discovery filter.
+#
+# Needs dbus-fast (pip install dbus-fast). Run it on a private bus together
+# with the app or the load generator:
+#
+#   dbus-run-session -- sh -c 'python3 mock_bluez.py --adapters 3 --devices 20 & \
+#       sleep 1; SKRUUVI_BLUEZ_BUS=session harbour-skruuvi'
+
+import argparse
+import asyncio
+import struct
+
+from dbus_fast import BusType, Variant
+from dbus_fast.aio import MessageBus
+from dbus_fast.service import PropertyAccess, ServiceInterface, dbus_property, method, signal
+
+RUUVI_MANUFACTURER_ID = 0x0499
+OTHER_MANUFACTURER_ID = 0x004C
+
+
+def device_mac(index):
+    return "C0:FF:EE:00:%02X:%02X" % ((index >> 8) & 0xFF, index & 0xFF)
+
+
+def df5_payload(index, sequence):
+    mac = bytes(int(part, 16) for part in device_mac(index).split(":"))
+    temperature = int((21.0 + (sequence % 40) / 10.0) / 0.005)
+    humidity = int(45.0 / 0.0025)
+    pressure = int(101300 - 50000)
+    battery_and_tx = ((3000 - 1600) << 5) | ((4 + 40) // 2)
+    return struct.pack(">BhHHhhhHBH", 5, temperature, humidity, pressure, 0, 0, 1000,
+                       battery_and_tx, 0, sequence & 0xFFFF) + mac
+
+
+class ObjectManager(ServiceInterface):
+    def __init__(self):
+        super().__init__("org.freedesktop.DBus.ObjectManager")
+        self.objects = {}
+
+    @method()
+    def GetManagedObjects(self) -> "a{oa{sa{sv}}}":
+        return self.objects
+
+    @signal()
+    def InterfacesAdded(self, path, interfaces) -> "oa{sa{sv}}":
+        return [path, interfaces]
+
+
+class Adapter(ServiceInterface):
+    def __init__(self, mock, path):
+        super().__init__("org.bluez.Adapter1")
+        self.mock = mock
+        self.path = path
+        self.discovering = False
+        self.pattern = ""
+
+    @method()
+    def SetDiscoveryFilter(self, discovery_filter: "a{sv}"):
+        pattern = discovery_filter.get("Pattern")
+        self.pattern = pattern.value if pattern else ""
+
+    @method()
+    def StartDiscovery(self):
+        self.discovering = True
+        self.mock.announce_devices(self)
+
+    @method()
+    def StopDiscovery(self):
+        self.discovering = False
+
+    @dbus_property(access=PropertyAccess.READ)
+    def Powered(self) -> "b":
+        return True
+
+    @dbus_property(access=PropertyAccess.READ)
+    def Discovering(self) -> "b":
+        return self.discovering
+
+
+class Device(ServiceInterface):
+    def __init__(self, index, ruuvi=True):
+        super().__init__("org.bluez.Device1")
+        self.index = index
+        self.ruuvi = ruuvi
+        self.payload = self.make_payload(0)
+
+    def make_payload(self, sequence):
+        if self.ruuvi:
+            return df5_payload(self.index, sequence)
+        return bytes([0x10, 0x05, sequence & 0xFF]) + bytes(17)
+
+    @dbus_property(access=PropertyAccess.READ)
+    def Address(self) -> "s":
+        return device_mac(self.index)
+
+    @dbus_property(access=PropertyAccess.READ)
+    def Name(self) -> "s":
+        prefix = "Ruuvi" if self.ruuvi else "Phone"
+        return "%s %02X%02X" % (prefix, (self.index >> 8) & 0xFF, self.index & 0xFF)
+
+    @dbus_property(access=PropertyAccess.READ)
+    def ManufacturerData(self) -> "a{qv}":
+        manufacturer = RUUVI_MANUFACTURER_ID if self.ruuvi else OTHER_MANUFACTURER_ID
+        return {manufacturer: Variant("ay", self.payload)}
+
+    def advertise(self, sequence):
+        self.payload = self.make_payload(sequence)
+        self.emit_properties_changed({"ManufacturerData": self.ManufacturerData})
+
+
+class MockBluez:
+    def __init__(self, bus, adapters, devices, others):
+        self.bus = bus
+        self.manager = ObjectManager()
+        self.adapters = []
+        self.devices = {}
+        bus.export("/", self.manager)
+        for a in range(adapters):
+            path = "/org/bluez/hci%d" % a
+            adapter = Adapter(self, path)
+            bus.export(path, adapter)
+            self.manager.objects[path] = {"org.bluez.Adapter1": {"Powered": Variant("b", True)}}
+            self.adapters.append(adapter)
+            self.devices[path] = [Device(i) for i in range(devices)] + \
+                [Device(devices + i, ruuvi=False) for i in range(others)]
+
+    def device_path(self, adapter, device):
+        return "%s/dev_%s" % (adapter.path, device_mac(device.index).replace(":", "_"))
+
+    def visible(self, adapter, device):
+        return device.Name.startswith(adapter.pattern)
+
+    def announce_devices(self, adapter):
+        for device in self.devices[adapter.path]:
+            path = self.device_path(adapter, device)
+            if path in self.manager.objects or not self.visible(adapter, device):
+                continue
+            self.bus.export(path, device)
+            interfaces = {"org.bluez.Device1": {"Address": Variant("s", device.Address)}}
+            self.manager.objects[path] = interfaces
+            self.manager.InterfacesAdded(path, interfaces)
+
+    async def advertise(self, interval):
+        sequence = 0
+        while True:
+            await asyncio.sleep(interval)
+            sequence += 1
+            for adapter in self.adapters:
+                if not adapter.discovering:
+                    continue
+                for device in self.devices[adapter.path]:
+                    if self.device_path(adapter, device) in self.manager.objects and self.visible(adapter, device):
+                        device.advertise(sequence)
+
+
+async def main():
+    parser = argparse.ArgumentParser(description="Mock BlueZ service for Skruuvi")
+    parser.add_argument("--adapters", type=int, default=2)
+    parser.add_argument("--devices", type=int, default=10, help="Ruuvi tags per adapter")
+    parser.add_argument("--others", type=int, default=0, help="other BLE devices per adapter")
+    parser.add_argument("--interval", type=float, default=1.0, help="seconds between advertisements")
+    args = parser.parse_args()
+
+    bus = await MessageBus(bus_type=BusType.SESSION).connect()
+    mock = MockBluez(bus, args.adapters, args.devices, args.others)
+    await bus.request_name("org.bluez")
+    print("Mock BlueZ: %d adapters, %d tags, %d other devices" % (args.adapters, args.devices, args.others), flush=True)
+    await mock.advertise(args.interval)
+
+
+if __name__ == "__main__":
+    asyncio.run(main())
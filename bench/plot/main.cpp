@@ -0,0 +1,214 @@
+/*
+    Skruuvi - Reader for Ruuvi sensors
+    Copyright (C) 2025  Miika Malin
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see [http://www.gnu.org/licenses/].
+*/
+#include <QGuiApplication>
+#include <QCommandLineParser>
+#include <QDebug>
+#include <QElapsedTimer>
+#include <QEventLoop>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QQmlComponent>
+#include <QQmlEngine>
+#include <QtQml>
+#include <QQuickItem>
+#include <QQuickView>
+#include <QSurfaceFormat>
+#include <QTextStream>
+#include <algorithm>
+#include <cmath>
+#include "plotitem.h"
+
+// The drawing code of the old GraphData Canvas, for several series
+static const char* CANVAS_QML =
+    "import QtQuick 2.0\n"
+    "Item {\n"
+    "    property var series: []\n"
+    "    property real minX: 0\n"
+    "    property real maxX: 1\n"
+    "    property real minY: 0\n"
+    "    property real maxY: 1\n"
+    "    property real shift: 0\n"
+    "    function step(frame) {\n"
+    "        shift = (frame % 120) * (maxX - minX) / 240;\n"
+    "        canvas.requestPaint();\n"
+    "    }\n"
+    "    Canvas {\n"
+    "        id: canvas\n"
+    "        anchors.fill: parent\n"
+    "        onPaint: {\n"
+    "            var ctx = getContext('2d');\n"
+    "            ctx.clearRect(0, 0, width, height);\n"
+    "            ctx.lineWidth = 3;\n"
+    "            var xFactor = width / (maxX - minX);\n"
+    "            for (var s = 0; s < series.length; s++) {\n"
+    "                var points = series[s];\n"
+    "                ctx.strokeStyle = Qt.hsla(s / series.length, 0.8, 0.5, 1);\n"
+    "                ctx.beginPath();\n"
+    "                for (var i = 0; i < points.length; i++) {\n"
+    "                    var x = (points[i].x - minX - shift) * xFactor;\n"
+    "                    var y = height - ((points[i].y - minY) / (maxY - minY)) * height;\n"
+    "                    if (i === 0) ctx.moveTo(x, y); else ctx.lineTo(x, y);\n"
+    "                }\n"
+    "                ctx.stroke();\n"
+    "            }\n"
+    "        }\n"
+    "    }\n"
+    "}\n";
+
+static const char* ITEM_QML =
+    "import QtQuick 2.0\n"
+    "import harbour.skruuvi 1.0\n"
+    "PlotItem {\n"
+    "    property real baseMinX: 0\n"
+    "    property real baseMaxX: 1\n"
+    "    lineWidth: 3\n"
+    "    clip: true\n"
+    "    function step(frame) {\n"
+    "        var shift = (frame % 120) * (baseMaxX - baseMinX) / 240;\n"
+    "        viewMinX = baseMinX + shift;\n"
+    "        viewMaxX = baseMaxX + shift;\n"
+    "    }\n"
+    "}\n";
+
+static QVector<QPointF> makeSeries(int index, int points)
+{
+    QVector<QPointF> series;
+    series.reserve(points);
+    for (int i = 0; i < points; ++i) {
+        series.append(QPointF(1700000000.0 + i * 300.0, 20.0 + 5.0 * std::sin(i / 50.0 + index) + index));
+    }
+    return series;
+}
+
+// Pans the plot on every frame and reports the frame intervals. The swap
+// interval is 0, so an interval is the cost of the frame, not the vsync.
+static QVariantMap run(const QString &renderer, int seriesCount, int points, int frames)
+{
+    QQuickView view;
+    view.resize(960, 540);
+    QQmlComponent component(view.engine());
+    component.setData(renderer == "canvas" ? CANVAS_QML : ITEM_QML, QUrl());
+    QQuickItem* item = qobject_cast<QQuickItem*>(component.create());
+    if (!item) {
+        qWarning() << component.errorString();
+        return QVariantMap();
+    }
+    item->setParentItem(view.contentItem());
+    item->setSize(QSizeF(view.width(), view.height()));
+
+    if (renderer == "canvas") {
+        QVariantList series;
+        for (int s = 0; s < seriesCount; ++s) {
+            QVariantList list;
+            for (const QPointF &point : makeSeries(s, points)) {
+                QVariantMap map;
+                map["x"] = point.x();
+                map["y"] = point.y();
+                list.append(map);
+            }
+            series.append(QVariant(list));
+        }
+        item->setProperty("series", series);
+        item->setProperty("minX", 1700000000.0);
+        item->setProperty("maxX", 1700000000.0 + (points - 1) * 300.0);
+        item->setProperty("minY", 14.0);
+        item->setProperty("maxY", 26.0 + seriesCount);
+    } else {
+        plotitem* plot = static_cast<plotitem*>(item);
+        for (int s = 0; s < seriesCount; ++s) {
+            plot->setSeries(s, QVariant::fromValue(makeSeries(s, points)), QColor::fromHslF(double(s) / seriesCount, 0.8, 0.5));
+        }
+        plot->fitView();
+        item->setProperty("baseMinX", plot->dataMinX());
+        item->setProperty("baseMaxX", plot->dataMaxX());
+    }
+
+    QVector<double> intervalsMs;
+    QElapsedTimer clock;
+    int frame = 0;
+    QEventLoop loop;
+    QObject::connect(&view, &QQuickWindow::frameSwapped, &view, [&]() {
+        // The first frames upload the data
+        if (frame >= 10) {
+            intervalsMs.append(clock.nsecsElapsed() / 1e6);
+        }
+        clock.start();
+        if (++frame >= frames + 10) {
+            loop.quit();
+            return;
+        }
+        QMetaObject::invokeMethod(item, "step", Q_ARG(QVariant, frame));
+    });
+    view.show();
+    loop.exec();
+    delete item;
+
+    std::sort(intervalsMs.begin(), intervalsMs.end());
+    double sum = 0.0;
+    for (double ms : intervalsMs) {
+        sum += ms;
+    }
+    QVariantMap result;
+    result["renderer"] = renderer;
+    result["series"] = seriesCount;
+    result["points"] = points;
+    result["frames"] = intervalsMs.size();
+    result["meanMs"] = intervalsMs.isEmpty() ? 0.0 : sum / intervalsMs.size();
+    result["p50Ms"] = intervalsMs.isEmpty() ? 0.0 : intervalsMs[intervalsMs.size() / 2];
+    result["p99Ms"] = intervalsMs.isEmpty() ? 0.0 : intervalsMs[qMin(intervalsMs.size() - 1, int(intervalsMs.size() * 0.99))];
+    result["maxMs"] = intervalsMs.isEmpty() ? 0.0 : intervalsMs.last();
+    return result;
+}
+
+// Frame times of the old Canvas renderer and the scene graph plot item while panning
+int main(int argc, char *argv[])
+{
+    QSurfaceFormat format = QSurfaceFormat::defaultFormat();
+    format.setSwapInterval(0);
+    QSurfaceFormat::setDefaultFormat(format);
+
+    QGuiApplication app(argc, argv);
+    qmlRegisterType<plotitem>("harbour.skruuvi", 1, 0, "PlotItem");
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Skruuvi plot renderer benchmark");
+    parser.addHelpOption();
+    QCommandLineOption seriesOption("series", "Number of series.", "n", "10");
+    QCommandLineOption pointsOption("points", "Points per series.", "n", "2000");
+    QCommandLineOption framesOption("frames", "Measured frames per renderer.", "n", "300");
+    QCommandLineOption rendererOption("renderer", "canvas, item or both.", "name", "both");
+    parser.addOptions({seriesOption, pointsOption, framesOption, rendererOption});
+    parser.process(app);
+
+    QStringList renderers;
+    const QString renderer = parser.value(rendererOption);
+    if (renderer == "both") {
+        renderers << "canvas" << "item";
+    } else {
+        renderers << renderer;
+    }
+
+    QTextStream out(stdout);
+    for (const QString &name : renderers) {
+        const QVariantMap result = run(name, parser.value(seriesOption).toInt(), parser.value(pointsOption).toInt(),
+                                       parser.value(framesOption).toInt());
+        out << QJsonDocument(QJsonObject::fromVariantMap(result)).toJson(QJsonDocument::Compact) << "\n";
+        out.flush();
+    }
+    return 0;
+}
@@ -0,0 +1,16 @@
+# Frame times of the Canvas and the scene graph plot renderers, needs a display
+TARGET = skruuvi-bench-plot
+
+TEMPLATE = app
+CONFIG += c++11
+CONFIG -= app_bundle
+
+QT += quick
+
+INCLUDEPATH += ../../src
+
+HEADERS += \
+    ../../src/plotitem.h
+
+SOURCES += main.cpp \
+    ../../src/plotitem.cpp
@@ -0,0 +1,759 @@
+/*
+    Skruuvi - Reader for Ruuvi sensors
+    Copyright (C) 2025  Miika Malin
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see [http://www.gnu.org/licenses/].
+*/
+#include <QtTest>
+#include <QStandardPaths>
+#include <QFileInfo>
+#include <QTemporaryDir>
+#include <cmath>
+#include <thread>
+#include "database.h"
+#include "worker.h"
+#include "derivedseries.h"
+
+// Synthetic data starts from this timestamp and has one reading every 10 s, so
+// the largest dataset still fits into the int timestamps
+static const int BENCH_START_TIME = 1600000000;
+static const int BENCH_INTERVAL = 10;
+
+// The min/max downsampling the plot did on the whole range before the tile
+// pyramid, kept as the reference the tiles are measured against
+struct dsPoint { double x; double y; };
+
+static QVariant pointVariant(const dsPoint &p) {
+    QVariantMap m;
+    m["x"] = p.x;
+    m["y"] = p.y;
+    return m;
+}
+
+static void appendMinMax(const dsPoint &minP, const dsPoint &maxP, QVariantList &out) {
+    if (minP.x == maxP.x && minP.y == maxP.y) {
+        out.append(pointVariant(minP));
+    } else if (minP.x < maxP.x) {
+        out.append(pointVariant(minP));
+        out.append(pointVariant(maxP));
+    } else {
+        out.append(pointVariant(maxP));
+        out.append(pointVariant(minP));
+    }
+}
+
+static QVariantList referenceColumns(const qint32 *timestamps, const double *values, int count, int maxPoints) {
+    if (count <= 2 * maxPoints || maxPoints <= 0) {
+        return QVariantList();
+    }
+    const double startX = timestamps[0];
+    const double range = timestamps[count - 1] - startX;
+    if (range <= 0.0) {
+        return QVariantList();
+    }
+    const double bucketDuration = range / double(maxPoints);
+    QVariantList out;
+    out.reserve(2 * maxPoints);
+    double bucketEnd = startX + bucketDuration;
+    int minIndex = 0;
+    int maxIndex = 0;
+    for (int i = 1; i <= count; ++i) {
+        if (i < count && timestamps[i] <= bucketEnd) {
+            if (values[i] < values[minIndex]) minIndex = i;
+            if (values[i] > values[maxIndex]) maxIndex = i;
+            continue;
+        }
+        appendMinMax({double(timestamps[minIndex]), values[minIndex]},
+                     {double(timestamps[maxIndex]), values[maxIndex]}, out);
+        minIndex = i;
+        maxIndex = i;
+        bucketEnd += bucketDuration;
+    }
+    return out;
+}
+
+static QVariantList referenceMinMax(const QVariantList &pointsIn, int maxPoints) {
+    // Same buckets as referenceColumns, after parsing the QML point maps
+    QVector<qint32> timestamps;
+    QVector<double> values;
+    timestamps.reserve(pointsIn.size());
+    values.reserve(pointsIn.size());
+    for (const QVariant &v : pointsIn) {
+        const QVariantMap m = v.toMap();
+        if (m.contains("x") && m.contains("y")) {
+            timestamps.append(m.value("x").toInt());
+            values.append(m.value("y").toDouble());
+        }
+    }
+    return referenceColumns(timestamps.constData(), values.constData(), timestamps.size(), maxPoints);
+}
+
+class benchstorage : public QObject {
+    Q_OBJECT
+
+private:
+    database* db = nullptr;
+    // Home folder of the benchmark, so the CSV exports stay out of the real Documents
+    QTemporaryDir home;
+    // The largest datasets take minutes and gigabytes, set SKRUUVI_BENCH_MAX_ROWS=10000000 to include them
+    int maxRows = 1000000;
+    int deviceCounter = 0;
+    QHash<int, QString> populatedDevices;
+
+    QString nextDevice();
+    QString populatedDevice(int rows);
+    void addRowCounts();
+    void skipIfTooLarge(int rows);
+    static QList<QPair<int, double>> syntheticSeries(int rows, double base);
+    static QVariantList syntheticPoints(int rows, double base);
+
+private slots:
+    void initTestCase();
+    void cleanupTestCase();
+    void insertSensorData_data();
+    void insertSensorData();
+    void inputRawData_data();
+    void inputRawData();
+    void reimportOverlap_data();
+    void reimportOverlap();
+    void getSensorData_data();
+    void getSensorData();
+    void downsampleMinMax_data();
+    void downsampleMinMax();
+    void plotRange_data();
+    void plotRange();
+    void panSeries_data();
+    void panSeries();
+    void calculateIAQSList_data();
+    void calculateIAQSList();
+    void getComparisonData_data();
+    void getComparisonData();
+    void getRangeStats_data();
+    void getRangeStats();
+    void getDevices_data();
+    void getDevices();
+    void exportCSV_data();
+    void exportCSV();
+    void exportNewCSV_data();
+    void exportNewCSV();
+    void statementOverhead_data();
+    void statementOverhead();
+    void frameStall_data();
+    void frameStall();
+    void readDuringImport_data();
+    void readDuringImport();
+    void importCSV_data();
+    void importCSV();
+    void ingestDuringBackup_data();
+    void ingestDuringBackup();
+    void derivedKernels_data();
+    void derivedKernels();
+};
+
+QString benchstorage::nextDevice() {
+    // Each dataset gets its own device so inserts never hit existing rows
+    const int n = ++deviceCounter;
+    QString mac = QString("BE:0C:%1:%2:%3:%4")
+        .arg((n >> 24) & 0xFF, 2, 16, QChar('0'))
+        .arg((n >> 16) & 0xFF, 2, 16, QChar('0'))
+        .arg((n >> 8) & 0xFF, 2, 16, QChar('0'))
+        .arg(n & 0xFF, 2, 16, QChar('0'))
+        .toUpper();
+    db->addDevice(mac, "Bench " + QString::number(n));
+    return mac;
+}
+
+QString benchstorage::populatedDevice(int rows) {
+    // Read benchmarks share one device per dataset size
+    if (populatedDevices.contains(rows)) {
+        return populatedDevices.value(rows);
+    }
+    const QString mac = nextDevice();
+    db->insertSensorData(mac, "temperature", syntheticSeries(rows, 21.0));
+    db->insertSensorData(mac, "humidity", syntheticSeries(rows, 45.0));
+    populatedDevices.insert(rows, mac);
+    return mac;
+}
+
+void benchstorage::addRowCounts() {
+    QTest::addColumn<int>("rows");
+    QTest::newRow("1e3") << 1000;
+    QTest::newRow("1e4") << 10000;
+    QTest::newRow("1e5") << 100000;
+    QTest::newRow("1e6") << 1000000;
+    QTest::newRow("1e7") << 10000000;
+}
+
+void benchstorage::skipIfTooLarge(int rows) {
+    if (rows > maxRows) {
+        QSKIP("Dataset larger than SKRUUVI_BENCH_MAX_ROWS");
+    }
+}
+
+QList<QPair<int, double>> benchstorage::syntheticSeries(int rows, double base) {
+    QList<QPair<int, double>> series;
+    series.reserve(rows);
+    for (int i = 0; i < rows; ++i) {
+        series.append(qMakePair(BENCH_START_TIME + i * BENCH_INTERVAL, base + std::sin(i / 100.0) * 5.0));
+    }
+    return series;
+}
+
+QVariantList benchstorage::syntheticPoints(int rows, double base) {
+    QVariantList points;
+    points.reserve(rows);
+    for (int i = 0; i < rows; ++i) {
+        QVariantMap point;
+        point["x"] = BENCH_START_TIME + i * BENCH_INTERVAL;
+        point["y"] = base + std::sin(i / 100.0) * 5.0;
+        points.append(point);
+    }
+    return points;
+}
+
+void benchstorage::initTestCase() {
+    // Keep the benchmark database away from the real one and start from scratch
+    QVERIFY(home.isValid());
+    qputenv("HOME", home.path().toUtf8());
+    qputenv("XDG_CONFIG_HOME", (home.path() + "/.config").toUtf8());
+    QStandardPaths::setTestModeEnabled(true);
+    const QString dbFolder = QStandardPaths::writableLocation(QStandardPaths::AppDataLocation);
+    QFile::remove(dbFolder + "/ruuviData.sqlite");
+    QDir(dbFolder + "/plotcache").removeRecursively();
+
+    bool ok = false;
+    const int envMaxRows = qEnvironmentVariableIntValue("SKRUUVI_BENCH_MAX_ROWS", &ok);
+    if (ok && envMaxRows > 0) {
+        maxRows = envMaxRows;
+    }
+    db = new database();
+    // The schema is created in the background
+    QTRY_VERIFY_WITH_TIMEOUT(db->isReady(), 60000);
+}
+
+void benchstorage::cleanupTestCase() {
+    const QVariantMap stats = db->getStatementCacheStats();
+    qDebug() << "Statement cache: hits" << stats["hits"].toInt() << "misses" << stats["misses"].toInt()
+             << "hit rate" << stats["hitRate"].toDouble();
+    delete db;
+    db = nullptr;
+    // On-disk cost of the storage layout for all the datasets above
+    const QString dbFolder = QStandardPaths::writableLocation(QStandardPaths::AppDataLocation);
+    qDebug() << "Database size" << QFileInfo(dbFolder + "/ruuviData.sqlite").size() << "bytes";
+}
+
+void benchstorage::insertSensorData_data() {
+    addRowCounts();
+}
+
+void benchstorage::insertSensorData() {
+    QFETCH(int, rows);
+    skipIfTooLarge(rows);
+    const QList<QPair<int, double>> series = syntheticSeries(rows, 21.0);
+    const QString mac = nextDevice();
+    QBENCHMARK_ONCE {
+        db->insertSensorData(mac, "temperature", series);
+    }
+}
+
+void benchstorage::inputRawData_data() {
+    addRowCounts();
+}
+
+void benchstorage::inputRawData() {
+    QFETCH(int, rows);
+    skipIfTooLarge(rows);
+
+    // RuuviTag log format from ruuvi_read.py: [?, sensor, ?, timestamp, value * 100]
+    QVariantList data;
+    data.reserve(rows + 1);
+    data.append(QString("data"));
+    const int sensors[] = {0x30, 0x31, 0x32};
+    for (int i = 0; i < rows; ++i) {
+        QVariantList item;
+        item << 0 << sensors[i % 3] << 0 << (BENCH_START_TIME + (i / 3) * BENCH_INTERVAL) << (2000 + i % 500);
+        data.append(QVariant(item));
+    }
+
+    worker w(db, nextDevice(), "Bench raw", data);
+    QBENCHMARK_ONCE {
+        w.inputRawData();
+    }
+}
+
+void benchstorage::reimportOverlap_data() {
+    QTest::addColumn<bool>("watermarks");
+    QTest::newRow("INSERT OR IGNORE") << false;
+    QTest::newRow("watermarks") << true;
+}
+
+void benchstorage::reimportOverlap() {
+    // A 30 day RuuviTag log (one record per sensor every 5 min) sent again on top of itself
+    QFETCH(bool, watermarks);
+    const int records = 30 * 24 * 12;
+    QVariantList data;
+    data.append(QString("data"));
+    const int sensors[] = {0x30, 0x31, 0x32};
+    QList<QPair<int, double>> series;
+    for (int i = 0; i < records; ++i) {
+        for (int sensor : sensors) {
+            QVariantList item;
+            item << 0 << sensor << 0 << (BENCH_START_TIME + i * 300) << (2000 + i % 500);
+            data.append(QVariant(item));
+        }
+        series.append(qMakePair(BENCH_START_TIME + i * 300, (2000 + i % 500) / 100.0));
+    }
+
+    const QString mac = nextDevice();
+    worker w(db, mac, "Bench reimport", data);
+    if (watermarks) {
+        w.inputRawData();
+        QBENCHMARK {
+            w.inputRawData();
+        }
+    } else {
+        // The plain insert path does not know about the earlier import. The log
+        // parsing is only measured in the watermark case.
+        const char* tables[] = {"temperature", "humidity", "air_pressure"};
+        for (const char* table : tables) {
+            db->insertSensorData(mac, table, series);
+        }
+        QBENCHMARK {
+            for (const char* table : tables) {
+                db->insertSensorData(mac, table, series);
+            }
+        }
+    }
+}
+
+void benchstorage::getSensorData_data() {
+    addRowCounts();
+}
+
+void benchstorage::getSensorData() {
+    QFETCH(int, rows);
+    skipIfTooLarge(rows);
+    const QString mac = populatedDevice(rows);
+    const int endTime = BENCH_START_TIME + rows * BENCH_INTERVAL;
+    QBENCHMARK {
+        QVariantList result = db->getSensorData(mac, "temperature", BENCH_START_TIME, endTime);
+        QCOMPARE(result.size(), rows);
+    }
+}
+
+void benchstorage::downsampleMinMax_data() {
+    addRowCounts();
+}
+
+void benchstorage::downsampleMinMax() {
+    QFETCH(int, rows);
+    skipIfTooLarge(rows);
+    const QVariantList points = syntheticPoints(rows, 21.0);
+    QBENCHMARK {
+        referenceMinMax(points, 540);
+    }
+}
+
+void benchstorage::plotRange_data() {
+    QTest::addColumn<int>("rows");
+    QTest::addColumn<bool>("cached");
+    const int counts[] = {10000, 100000, 1000000, 10000000};
+    for (int rows : counts) {
+        QTest::newRow(qPrintable(QString("%1 sqlite").arg(rows))) << rows << false;
+        QTest::newRow(qPrintable(QString("%1 plot cache").arg(rows))) << rows << true;
+    }
+}
+
+void benchstorage::plotRange() {
+    // Downsampled plot series of the whole range, from SQLite or from the mapped cache
+    QFETCH(int, rows);
+    QFETCH(bool, cached);
+    skipIfTooLarge(rows);
+    const QString mac = populatedDevice(rows);
+    const int endTime = BENCH_START_TIME + rows * BENCH_INTERVAL;
+    if (cached) {
+        QVERIFY(db->getPlotColumns(mac, "temperature").isValid());
+        QBENCHMARK {
+            const plotcolumns columns = db->getPlotColumns(mac, "temperature");
+            const int first = columns.lowerBound(BENCH_START_TIME);
+            const int last = columns.lowerBound(endTime + 1);
+            QCOMPARE(last - first, rows);
+            referenceColumns(columns.timestamps() + first, columns.values() + first, last - first, 540);
+        }
+    } else {
+        QBENCHMARK {
+            referenceMinMax(db->getSensorData(mac, "temperature", BENCH_START_TIME, endTime), 540);
+        }
+    }
+}
+
+void benchstorage::panSeries_data() {
+    QTest::addColumn<int>("rows");
+    const int counts[] = {100000, 1000000, 10000000};
+    for (int rows : counts) {
+        QTest::newRow(qPrintable(QString::number(rows))) << rows;
+    }
+}
+
+void benchstorage::panSeries() {
+    // A day wide window panned over the whole range in steps of an hour, assembled
+    // from the tile pyramid. Only the first iteration builds tiles.
+    QFETCH(int, rows);
+    skipIfTooLarge(rows);
+    const QString mac = populatedDevice(rows);
+    const int endTime = BENCH_START_TIME + rows * BENCH_INTERVAL;
+    QBENCHMARK {
+        for (int start = BENCH_START_TIME; start + 86400 <= endTime; start += 3600) {
+            db->getPlotSeries(mac, "temperature", start, start + 86400, 540);
+        }
+    }
+}
+
+void benchstorage::calculateIAQSList_data() {
+    addRowCounts();
+}
+
+void benchstorage::calculateIAQSList() {
+    QFETCH(int, rows);
+    skipIfTooLarge(rows);
+    const QVariantList pm25 = syntheticPoints(rows, 10.0);
+    const QVariantList co2 = syntheticPoints(rows, 800.0);
+    QBENCHMARK {
+        db->calculateIAQSList(pm25, co2);
+    }
+}
+
+void benchstorage::getComparisonData_data() {
+    addRowCounts();
+}
+
+void benchstorage::getComparisonData() {
+    QFETCH(int, rows);
+    skipIfTooLarge(rows);
+    // The device with this many rows against all the smaller datasets
+    populatedDevice(rows);
+    QStringList devices;
+    for (auto it = populatedDevices.constBegin(); it != populatedDevices.constEnd(); ++it) {
+        if (it.key() <= rows) {
+            devices << it.value();
+        }
+    }
+    const int endTime = BENCH_START_TIME + rows * BENCH_INTERVAL;
+    QBENCHMARK {
+        QVariantMap result = db->getComparisonData(devices, "temperature", BENCH_START_TIME, endTime, 300);
+        QCOMPARE(result["series"].toList().size(), devices.size());
+    }
+}
+
+void benchstorage::getRangeStats_data() {
+    addRowCounts();
+}
+
+void benchstorage::getRangeStats() {
+    QFETCH(int, rows);
+    skipIfTooLarge(rows);
+    const QString mac = populatedDevice(rows);
+    // Off by a few minutes from the hour boundaries so both ends need raw rows
+    const int startTime = BENCH_START_TIME + 150;
+    const int endTime = BENCH_START_TIME + rows * BENCH_INTERVAL - 150;
+    // The first query builds the rollups, the benchmark measures the ones after it
+    const QVariantMap first = db->getRangeStats(mac, "temperature", startTime, endTime);
+    qDebug() << "First query with rollup build:" << first["elapsedMs"].toDouble() << "ms";
+    QBENCHMARK {
+        QVariantMap result = db->getRangeStats(mac, "temperature", startTime, endTime);
+        QCOMPARE(result["count"].toLongLong(), first["count"].toLongLong());
+    }
+}
+
+void benchstorage::getDevices_data() {
+    // The devices table has one row per device, so scale the device count instead
+    QTest::addColumn<int>("rows");
+    QTest::newRow("10 devices") << 10;
+    QTest::newRow("100 devices") << 100;
+    QTest::newRow("1000 devices") << 1000;
+}
+
+void benchstorage::getDevices() {
+    QFETCH(int, rows);
+    while (deviceCounter < rows) {
+        nextDevice();
+    }
+    QBENCHMARK {
+        db->getDevices();
+    }
+}
+
+void benchstorage::exportCSV_data() {
+    addRowCounts();
+}
+
+void benchstorage::exportCSV() {
+    QFETCH(int, rows);
+    skipIfTooLarge(rows);
+    const QString mac = populatedDevice(rows);
+    const int endTime = BENCH_START_TIME + rows * BENCH_INTERVAL;
+    QBENCHMARK {
+        const QString csvPath = db->exportCSV(mac, "bench", BENCH_START_TIME, endTime);
+        QVERIFY(!csvPath.isEmpty());
+        QFile::remove(csvPath);
+    }
+}
+
+void benchstorage::exportNewCSV_data() {
+    addRowCounts();
+}
+
+void benchstorage::exportNewCSV() {
+    // A daily export after the history is exported once, only the new day is written
+    QFETCH(int, rows);
+    skipIfTooLarge(rows);
+    const QString mac = nextDevice();
+    db->insertSensorData(mac, "temperature", syntheticSeries(rows, 21.0));
+    const QString csvPath = db->exportNewCSV(mac, "bench");
+    QVERIFY(!csvPath.isEmpty());
+    const int dayRows = 86400 / BENCH_INTERVAL;
+    QList<QPair<int, double>> day;
+    for (int i = 0; i < dayRows; ++i) {
+        day.append(qMakePair(BENCH_START_TIME + (rows + i) * BENCH_INTERVAL, 21.0));
+    }
+    db->insertSensorData(mac, "temperature", day);
+    QBENCHMARK_ONCE {
+        QCOMPARE(db->exportNewCSV(mac, "bench"), csvPath);
+    }
+    QFile::remove(csvPath);
+}
+
+void benchstorage::statementOverhead_data() {
+    QTest::addColumn<bool>("cached");
+    QTest::newRow("cached statement") << true;
+    QTest::newRow("parsed per call") << false;
+}
+
+void benchstorage::statementOverhead() {
+    // A single row lookup is dominated by the per-call statement overhead
+    QFETCH(bool, cached);
+    const QString mac = populatedDevice(1000);
+    if (cached) {
+        QBENCHMARK {
+            db->getLastSync(mac);
+        }
+    } else {
+        QSqlDatabase connection = QSqlDatabase::database();
+        QBENCHMARK {
+            QSqlQuery query(connection);
+            query.exec("SELECT sync_time FROM devices WHERE mac = '" + mac + "'");
+            query.next();
+        }
+    }
+}
+
+void benchstorage::frameStall_data() {
+    QTest::addColumn<int>("rows");
+    QTest::addColumn<bool>("async");
+    QTest::newRow("1e5 blocking") << 100000 << false;
+    QTest::newRow("1e5 async") << 100000 << true;
+    QTest::newRow("1e6 blocking") << 1000000 << false;
+    QTest::newRow("1e6 async") << 1000000 << true;
+}
+
+void benchstorage::frameStall() {
+    // A 60 Hz timer stands in for the render loop, the result is the longest
+    // gap between two ticks while getSensorData runs
+    QFETCH(int, rows);
+    QFETCH(bool, async);
+    skipIfTooLarge(rows);
+    const QString mac = populatedDevice(rows);
+    const int endTime = BENCH_START_TIME + rows * BENCH_INTERVAL;
+
+    QElapsedTimer frameClock;
+    qint64 lastFrameNs = 0;
+    qint64 worstFrameNs = 0;
+    QTimer frames;
+    frames.setInterval(16);
+    frames.setTimerType(Qt::PreciseTimer);
+    connect(&frames, &QTimer::timeout, [&]() {
+        const qint64 now = frameClock.nsecsElapsed();
+        worstFrameNs = qMax(worstFrameNs, now - lastFrameNs);
+        lastFrameNs = now;
+    });
+    QSignalSpy finished(db, SIGNAL(queryFinished(int,QVariant)));
+
+    frameClock.start();
+    frames.start();
+    QTest::qWait(100);
+    worstFrameNs = 0;
+    if (async) {
+        const int requestId = db->getSensorDataAsync(mac, "temperature", BENCH_START_TIME, endTime);
+        QVERIFY(finished.wait(600000));
+        QCOMPARE(finished.last().at(0).toInt(), requestId);
+    } else {
+        QCOMPARE(db->getSensorData(mac, "temperature", BENCH_START_TIME, endTime).size(), rows);
+    }
+    QTest::qWait(100);
+    frames.stop();
+    QTest::setBenchmarkResult(worstFrameNs / 1e6, QTest::WalltimeMilliseconds);
+}
+
+void benchstorage::readDuringImport_data() {
+    QTest::addColumn<bool>("importing");
+    QTest::newRow("idle") << false;
+    QTest::newRow("during import") << true;
+}
+
+void benchstorage::readDuringImport() {
+    // Worst latency of a short range read on the GUI connection, alone and
+    // while the writer stores a large history import in one transaction
+    QFETCH(bool, importing);
+    const QString readMac = populatedDevice(10000);
+    const QString importMac = nextDevice();
+    const QList<QPair<int, double>> history = syntheticSeries(qMin(maxRows, 1000000), 21.0);
+
+    QAtomicInt imported(importing ? 0 : 1);
+    std::thread importer;
+    if (importing) {
+        importer = std::thread([&]() {
+            db->importSensorData(importMac, "temperature", history);
+            imported.store(1);
+        });
+    }
+    qint64 worstNs = 0;
+    int reads = 0;
+    int shortReads = 0;
+    QElapsedTimer clock;
+    while (reads < 200 || !imported.load()) {
+        clock.start();
+        if (db->getSensorData(readMac, "temperature", BENCH_START_TIME, BENCH_START_TIME + 99 * BENCH_INTERVAL).size() != 100) {
+            ++shortReads;
+        }
+        worstNs = qMax(worstNs, clock.nsecsElapsed());
+        ++reads;
+    }
+    if (importer.joinable()) {
+        importer.join();
+    }
+    QCOMPARE(shortReads, 0);
+    QTest::setBenchmarkResult(worstNs / 1e6, QTest::WalltimeMilliseconds);
+}
+
+void benchstorage::importCSV_data() {
+    addRowCounts();
+}
+
+void benchstorage::importCSV() {
+    // Loading an exportCSV file with temperature, humidity and pressure columns
+    QFETCH(int, rows);
+    skipIfTooLarge(rows);
+    const QString mac = nextDevice();
+    const QString csvPath = QStandardPaths::writableLocation(QStandardPaths::TempLocation) + "/skruuvi-bench-import.csv";
+    {
+        QFile file(csvPath);
+        QVERIFY(file.open(QIODevice::WriteOnly | QIODevice::Text));
+        QTextStream stream(&file);
+        stream << "mac,name,timestamp,temperature,humidity,air_pressure,pm25,co2,voc,nox,iaqs\n";
+        for (int i = 0; i < rows; ++i) {
+            stream << mac << ",bench," << BENCH_START_TIME + i * BENCH_INTERVAL << "," << 21.0 + std::sin(i / 100.0) * 5.0
+                   << ",45.5,1013.25,-,-,-,-,-\n";
+        }
+    }
+    QVariantMap result;
+    QBENCHMARK_ONCE {
+        result = db->importCSV(csvPath);
+    }
+    QFile::remove(csvPath);
+    QCOMPARE(result.value("rows").toLongLong(), qint64(rows));
+    qDebug() << "rows per second:" << result.value("rowsPerSecond").toDouble();
+}
+
+void benchstorage::ingestDuringBackup_data() {
+    QTest::addColumn<bool>("backingUp");
+    QTest::newRow("idle") << false;
+    QTest::newRow("during backup") << true;
+}
+
+void benchstorage::ingestDuringBackup() {
+    // Worst latency of a single live reading stored through the writer, alone
+    // and while the whole benchmark database is copied by the online backup
+    QFETCH(bool, backingUp);
+    populatedDevice(qMin(maxRows, 1000000));
+    const QString mac = nextDevice();
+    const QString backupPath = QStandardPaths::writableLocation(QStandardPaths::TempLocation) + "/skruuvi-bench-backup.sqlite";
+
+    QAtomicInt finished(backingUp ? 0 : 1);
+    QVariantMap backup;
+    std::thread backupThread;
+    if (backingUp) {
+        backupThread = std::thread([&]() {
+            backup = db->backupDatabase(backupPath);
+            finished.store(1);
+        });
+    }
+    qint64 worstNs = 0;
+    int readings = 0;
+    QElapsedTimer clock;
+    while (readings < 200 || !finished.load()) {
+        clock.start();
+        db->insertSensorData(mac, "temperature", {qMakePair(BENCH_START_TIME + readings * BENCH_INTERVAL, 21.0)});
+        worstNs = qMax(worstNs, clock.nsecsElapsed());
+        ++readings;
+    }
+    if (backupThread.joinable()) {
+        backupThread.join();
+    }
+    QFile::remove(backupPath);
+    if (backingUp) {
+        QVERIFY2(!backup.contains("error"), qPrintable(backup.value("error").toString()));
+        qDebug() << "backup of" << backup.value("pages").toInt() << "pages in" << backup.value("seconds").toDouble() << "s";
+    }
+    QTest::setBenchmarkResult(worstNs / 1e6, QTest::WalltimeMilliseconds);
+}
+
+void benchstorage::derivedKernels_data() {
+    addRowCounts();
+}
+
+void benchstorage::derivedKernels() {
+    // Aligning temperature and humidity and computing the three derived series,
+    // the work of building their tiles from the mapped columns
+    QFETCH(int, rows);
+    skipIfTooLarge(rows);
+    const QList<QPair<int, double>> temperature = syntheticSeries(rows, 21.0);
+    const QList<QPair<int, double>> humidity = syntheticSeries(rows, 45.0);
+    QVector<qint32> temperatureTimes, humidityTimes;
+    QVector<double> temperatureValues, humidityValues;
+    for (int i = 0; i < rows; ++i) {
+        temperatureTimes.append(temperature[i].first);
+        temperatureValues.append(temperature[i].second);
+        // Every tenth humidity reading is missing
+        if (i % 10 != 0) {
+            humidityTimes.append(humidity[i].first);
+            humidityValues.append(humidity[i].second);
+        }
+    }
+    QVector<qint32> timestamps;
+    QVector<double> a, b;
+    QVector<double> out(rows);
+    QBENCHMARK {
+        const int aligned = derivedseries::align(temperatureTimes.constData(), temperatureValues.constData(), temperatureTimes.size(),
+                                                 humidityTimes.constData(), humidityValues.constData(), humidityTimes.size(),
+                                                 timestamps, a, b);
+        derivedseries::dewPoint(a.constData(), b.constData(), out.data(), aligned);
+        derivedseries::absoluteHumidity(a.constData(), b.constData(), out.data(), aligned);
+        derivedseries::vapourPressureDeficit(a.constData(), b.constData(), out.data(), aligned);
+    }
+    QCOMPARE(timestamps.size(), humidityTimes.size());
+}
+
+QTEST_GUILESS_MAIN(benchstorage)
+
+#include "benchstorage.moc"
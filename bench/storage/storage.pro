@@ -0,0 +1,37 @@
+# QBENCHMARK suites for the storage and plot hot paths
+TARGET = skruuvi-bench-storage
+
+TEMPLATE = app
+CONFIG += console testcase c++11
+CONFIG -= app_bundle
+CONFIG += link_pkgconfig
+PKGCONFIG += sqlite3
+
+QT += testlib sql
+QT -= gui
+
+INCLUDEPATH += ../../src
+
+HEADERS += \
+    ../../src/database.h \
+    ../../src/worker.h \
+    ../../src/latencystats.h \
+    ../../src/queryprofiler.h \
+    ../../src/rangesummary.h \
+    ../../src/plotcache.h \
+    ../../src/tilepyramid.h \
+    ../../src/csvimporter.h \
+    ../../src/sqlitebackup.h \
+    ../../src/derivedseries.h
+
+SOURCES += benchstorage.cpp \
+    ../../src/database.cpp \
+    ../../src/worker.cpp \
+    ../../src/latencystats.cpp \
+    ../../src/queryprofiler.cpp \
+    ../../src/rangesummary.cpp \
+    ../../src/plotcache.cpp \
+    ../../src/tilepyramid.cpp \
+    ../../src/csvimporter.cpp \
+    ../../src/sqlitebackup.cpp \
+    ../../src/derivedseries.cpp
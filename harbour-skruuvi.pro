@@ -15,16 +15,42 @@ TARGET = harbour-skruuvi
 CONFIG += sailfishapp
 
 QT += dbus sql
+# The online backup uses the SQLite C API next to the Qt driver
+PKGCONFIG += sqlite3
 
 HEADERS += \
     src/database.h \
     src/worker.h \
-    src/backgroundscanner.h
+    src/latencystats.h \
+    src/queryprofiler.h \
+    src/rangesummary.h \
+    src/plotcache.h \
+    src/tilepyramid.h \
+    src/csvimporter.h \
+    src/sqlitebackup.h \
+    src/derivedseries.h \
+    src/plotitem.h \
+    src/advertisementsource.h \
+    src/backgroundscanner.h \
+    src/replayscanner.h \
+    src/scanscheduler.h
 
 SOURCES += src/harbour-skruuvi.cpp \
     src/database.cpp \
     src/worker.cpp \
-    src/backgroundscanner.cpp
+    src/latencystats.cpp \
+    src/queryprofiler.cpp \
+    src/rangesummary.cpp \
+    src/plotcache.cpp \
+    src/tilepyramid.cpp \
+    src/csvimporter.cpp \
+    src/sqlitebackup.cpp \
+    src/derivedseries.cpp \
+    src/plotitem.cpp \
+    src/advertisementsource.cpp \
+    src/backgroundscanner.cpp \
+    src/replayscanner.cpp \
+    src/scanscheduler.cpp
 
 DISTFILES += qml/harbour-skruuvi.qml \
     qml/cover/CoverPage.qml \
@@ -39,6 +39,17 @@ CoverBackground {
         var devices = db.getDevices();
         for (var i = 0; i < devices.length; i++) {
             var d = devices[i];
+            // The scanner may have added it before the database was ready
+            var known = false;
+            for (var j = 0; j < deviceModel.count; j++) {
+                if (deviceModel.get(j).deviceAddress === d.deviceAddress) {
+                    known = true;
+                    break;
+                }
+            }
+            if (known) {
+                continue;
+            }
             deviceModel.append({
                 deviceName: d.deviceName,
                 deviceAddress: d.deviceAddress,
@@ -217,8 +228,10 @@ CoverBackground {
         }
 
         Component.onCompleted: {
-            // Populate the ListModel on component completion
-            populateDeviceModel();
+            // Populate the ListModel on component completion, or once the database is ready
+            if (db.ready) {
+                populateDeviceModel();
+            }
         }
     }
 
@@ -253,36 +266,35 @@ CoverBackground {
     Connections {
         target: db
 
-        onDeviceDataUpdated: {
-            for (var i = 0; i < deviceModel.count; i++) {
-                var d = deviceModel.get(i);
-                if (d.deviceAddress === mac) {
-                    deviceModel.setProperty(i, "temperature", temperature.toFixed(2));
-                    deviceModel.setProperty(i, "humidity", (humidity < 163) ? humidity.toFixed(2) : "NA");
-                    deviceModel.setProperty(i, "pressure", (pressure < 1155) ? pressure.toFixed(2) : "NA");
-                    deviceModel.setProperty(i, "last_obs", timestamp.toString());
-                    break;
-                }
-            }
-        }
+        onReadyChanged: populateDeviceModel()
 
-        onAirDeviceDataUpdated: {
+        onDevicesUpdated: {
+            // One batch with the latest readings of every device heard since the previous one
+            var rows = {};
             for (var i = 0; i < deviceModel.count; i++) {
-                var d = deviceModel.get(i);
-                if (d.deviceAddress === mac) {
-                    deviceModel.setProperty(i, "temperature", temperature.toFixed(2));
-                    deviceModel.setProperty(i, "humidity", humidity.toFixed(2));
-                    deviceModel.setProperty(i, "pressure", pressure.toFixed(2));
-
-                    deviceModel.setProperty(i, "pm25", pm25.toFixed(2));
-                    deviceModel.setProperty(i, "co2",  co2.toString());
-                    deviceModel.setProperty(i, "voc",  voc.toString());
-                    deviceModel.setProperty(i, "nox",  nox.toString());
-                    deviceModel.setProperty(i, "iaqs", iaqs.toString());
-
-                    deviceModel.setProperty(i, "last_obs", timestamp.toString());
-                    break;
+                rows[deviceModel.get(i).deviceAddress] = i;
+            }
+            for (var c = 0; c < changes.length; c++) {
+                var change = changes[c];
+                var row = rows[change.mac];
+                if (row === undefined) {
+                    continue;
+                }
+                deviceModel.setProperty(row, "temperature", change.temperature.toFixed(2));
+                if (change.air) {
+                    deviceModel.setProperty(row, "humidity", change.humidity.toFixed(2));
+                    deviceModel.setProperty(row, "pressure", change.pressure.toFixed(2));
+
+                    deviceModel.setProperty(row, "pm25", change.pm25.toFixed(2));
+                    deviceModel.setProperty(row, "co2",  change.co2.toString());
+                    deviceModel.setProperty(row, "voc",  change.voc.toString());
+                    deviceModel.setProperty(row, "nox",  change.nox.toString());
+                    deviceModel.setProperty(row, "iaqs", change.iaqs.toString());
+                } else {
+                    deviceModel.setProperty(row, "humidity", (change.humidity < 163) ? change.humidity.toFixed(2) : "NA");
+                    deviceModel.setProperty(row, "pressure", (change.pressure < 1155) ? change.pressure.toFixed(2) : "NA");
                 }
+                deviceModel.setProperty(row, "last_obs", change.timestamp.toString());
             }
         }
     }
@@ -1,6 +1,7 @@
 import QtQuick 2.0
 import QtQml 2.1
 import Sailfish.Silica 1.0
+import harbour.skruuvi 1.0
 
 import "."
 
@@ -36,7 +37,7 @@ Item {
     property bool valueTotal: false
 
     property int graphHeight: 250
-    property int graphWidth: canvas.width
+    property int graphWidth: plot.width
     property bool doubleAxisXLables: false
 
     property bool scale: false
@@ -46,41 +47,61 @@ Item {
     property real minY: 0 //Always 0
     property real maxY: 0
 
-    property int minX: 0
-    property int maxX: 0
+    property real minX: 0
+    property real maxX: 0
 
-    property var points: []
-    onPointsChanged: {
-        noData = (points.length == 0);
-    }
     property bool noData: true
 
+    // Takes the typed series of the plot worker or a list of {x, y} points
     function setPoints(data) {
         if (!data) return;
 
-        var pointMaxY = Number.NEGATIVE_INFINITY;
-        var pointMinY = Number.POSITIVE_INFINITY;
-        if (data.length > 0) {
-            minX = data[0].x;
-            maxX = data[data.length-1].x;
-        }
-        data.forEach(function(point) {
-            if (point.y > pointMaxY) {
-                pointMaxY = point.y;
-            }
-            if (point.y < pointMinY) {
-                pointMinY = point.y;
-            }
-        });
-        points = data;
+        plot.setSeries(0, data);
+        noData = (plot.count == 0);
+        if (noData) return;
+
+        minX = plot.dataMinX;
+        maxX = plot.dataMaxX;
         if (scale) {
             // Set the y-axis limits to the nearest integer
-            maxY = Math.ceil(pointMaxY);
-            minY = Math.floor(pointMinY);
+            maxY = Math.ceil(plot.dataMaxY);
+            minY = Math.floor(plot.dataMinY);
         }
         doubleAxisXLables = ((maxX - minX) > 129600); // 1.5 days
 
-        canvas.requestPaint();
+        // Add latest value top of the graph
+        labelLastValue.text = root.createYLabel(plot.lastValue.toFixed(2))+root.axisY.units;
+    }
+
+    // Summary of the plotted range from database::requestRangeStats,
+    // computed from the rollups instead of the plotted points
+    function setStats(stats) {
+        if (!stats || !stats.count) {
+            labelStats.text = "";
+            return;
+        }
+        labelStats.text = qsTr("min %1  mean %2  max %3")
+                .arg(createYLabel(stats.min.toFixed(2)))
+                .arg(createYLabel(stats.mean.toFixed(2)))
+                .arg(createYLabel(stats.max.toFixed(2)));
+    }
+
+    // Replaces the points but keeps the visible window and the axes,
+    // for the finer data of a zoomed or panned view
+    function setDetail(data) {
+        if (!data) return;
+
+        plot.setSeries(0, data);
+        noData = (plot.count == 0);
+    }
+
+    // Pinch and drag, x in the coordinates of the graph item
+    function zoom(factor, x) {
+        plot.zoom(factor, plot.mapFromItem(root, x, 0).x);
+    }
+
+    function pan(dx) {
+        plot.pan(dx);
     }
 
     function createYLabel(value) {
@@ -158,6 +179,18 @@ Item {
                 visible: !noData
             }
 
+            Label {
+                id: labelStats
+                anchors {
+                    right: parent.right
+                    top: parent.top
+                    rightMargin: Theme.paddingSmall
+                }
+                color: Theme.secondaryHighlightColor
+                font.pixelSize: Theme.fontSizeExtraSmall
+                visible: !noData && text.length > 0
+            }
+
             Repeater {
                 model: noData ? 0 : (axisY.grid + 1)
                 delegate: Label {
@@ -201,60 +234,24 @@ Item {
                 }
             }
 
-            Canvas {
-                id: canvas
+            PlotItem {
+                id: plot
                 anchors {
                     fill: parent
                 }
-
-                function drawGrid(ctx) {
-                    ctx.save();
-                    ctx.lineWidth = 1;
-                    ctx.strokeStyle = lineColor;
-                    ctx.globalAlpha = 0.4;
-
-                    for (var i = 1; i < axisY.grid; i++) {
-                        ctx.beginPath();
-                        ctx.moveTo(0, height / axisY.grid * i);
-                        ctx.lineTo(width, height / axisY.grid * i);
-                        ctx.stroke();
-                    }
-                    ctx.restore();
-                }
-
-                function drawPoints(ctx, points) {
-                    if (points.length === 0) return;
-                    ctx.save();
-                    ctx.strokeStyle = lineColor;
-                    ctx.lineWidth = lineWidth;
-                    ctx.beginPath();
-
-                    var xFactor = width / (maxX - minX);
-                    for (var i = 0; i < points.length; i++) {
-                        var x = (points[i].x - minX) * xFactor;
-                        var y = height - ((points[i].y - minY) / (maxY - minY)) * height;
-                        if (i === 0) {
-                            ctx.moveTo(x, y);
-                        } else {
-                            ctx.lineTo(x, y);
-                        }
-                    }
-                    ctx.stroke();
-                    ctx.restore();
-                }
-
-                onPaint: {
-                    var ctx = canvas.getContext("2d");
-                    ctx.globalCompositeOperation = "source-over";
-                    ctx.clearRect(0, 0, width, height);
-
-                    if (points.length > 0) {
-                        drawGrid(ctx);
-                        drawPoints(ctx, points);
-                        // Add latest value top of the graph
-                        var lastValue = points[points.length-1].y;
-                        labelLastValue.text = root.createYLabel(lastValue.toFixed(2))+root.axisY.units;
-                    }
+                clip: true
+                lineColor: root.lineColor
+                lineWidth: root.lineWidth
+                gridColor: root.lineColor
+                gridLines: noData ? 0 : axisY.grid
+                // Panning and zooming move this window, the axis labels follow it
+                viewMinX: minX
+                viewMaxX: maxX
+                viewMinY: minY
+                viewMaxY: maxY
+                onViewChanged: {
+                    minX = viewMinX;
+                    maxX = viewMaxX;
                 }
             }
         }
@@ -30,6 +30,8 @@ Page {
     property int pickedMinute: -1
     property int logStart: 0
     property int syncStart: 0
+    property int lastSync: 0
+    property int lastSyncRequest: -1
 
     // Progressbar properties
     property bool dbInserting: false
@@ -58,9 +60,18 @@ Page {
         return "Last sync: " + new Date(timestamp * 1000).toLocaleString(undefined, options);
     }
 
+    // Read without blocking the page transition
+    Component.onCompleted: lastSyncRequest = db.getLastSyncAsync(selectedDevice.deviceAddress)
+
     Connections {
         target: db
 
+        onQueryFinished: {
+            if (requestId === lastSyncRequest) {
+                lastSync = result;
+            }
+        }
+
         onInputFinished: {
             // Handle the database input finish
             loadingScreen.running = false;
@@ -141,7 +152,7 @@ Page {
                 color: Theme.highlightColor
                 font.pixelSize: Theme.fontSizeSmall
                 visible: !loadingScreen.running
-                text: formatLastSyncLabel(db.getLastSync(selectedDevice.deviceAddress))
+                text: formatLastSyncLabel(lastSync)
             }
 
             SectionHeader {
@@ -289,7 +300,7 @@ Page {
             loadingScreen.text = "Connecting to Ruuvi"
             loadingScreen.running = true
             if (fetchAllSwitch.checked) {
-                logStart = db.getLastSync(selectedDevice.deviceAddress);
+                logStart = db.getSyncStart(selectedDevice.deviceAddress);
             } else {
                 logStart = constructUnixTimestamp(pickedMinute, pickedHour, dateChosen.day, dateChosen.month, dateChosen.year)
             }
@@ -22,9 +22,22 @@ import "../modules/GraphData"
 Page {
     allowedOrientations: Orientation.LandscapeMask
 
-    property var par_data
+    property string par_device
+    property string par_sensor
+    property int par_start
+    property int par_end
     property string par_title
     property string par_units
+    property int seriesRequest: -1
+    property bool loaded: false
+
+    // The visible window and one more to each side, so a short pan has data already
+    function requestWindow() {
+        var span = graph.maxX - graph.minX;
+        var start = Math.max(par_start, Math.floor(graph.minX - span));
+        var end = Math.min(par_end, Math.ceil(graph.maxX + span));
+        seriesRequest = db.requestSeries(par_device, par_sensor, start, end, graph.width * 3);
+    }
 
     GraphData {
         id: graph
@@ -36,15 +49,38 @@ Page {
         width: Screen.height
     }
 
+    // Two finger zoom and pan, a single finger still swipes back
+    PinchArea {
+        anchors.fill: graph
+        onPinchUpdated: {
+            graph.zoom(pinch.scale / pinch.previousScale, pinch.center.x);
+            graph.pan(pinch.center.x - pinch.previousCenter.x);
+            refineTimer.restart();
+        }
+    }
+
+    // Finer data once the gesture has settled, mostly served from the cached tiles
+    Timer {
+        id: refineTimer
+        interval: 200
+        onTriggered: if (loaded) requestWindow()
+    }
+
     Component.onCompleted: {
-        graph.setPoints(par_data);
+        seriesRequest = db.requestSeries(par_device, par_sensor, par_start, par_end, graph.width);
     }
 
-    onVisibleChanged: {
-        if (status === PageStatus.Active & visible) {
-            // Lines are not shown when app is background
-            // redraw the graph when the page is visible again
-            graph.setPoints(par_data);
+    Connections {
+        target: db
+        onQueryFinished: {
+            if (requestId !== seriesRequest) return;
+            seriesRequest = -1;
+            if (loaded) {
+                graph.setDetail(result["series"]);
+            } else {
+                graph.setPoints(result["series"]);
+                loaded = true;
+            }
         }
     }
 }
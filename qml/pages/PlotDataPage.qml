@@ -34,18 +34,14 @@ Page {
     property real bucketDuration: 0
     property bool airInfoExpanded: false
     property bool plotting: false
-    // Use global data so we can redraw it
-    property var tempData: []
-    property var humidityData: []
-    property var pressureData: []
-    property var pm25Data: []
-    property var co2Data: []
-    property var vocData: []
-    property var noxData: []
-    property var iaqsData: []
+    property int exportRequest: -1
+    // Downsampled series, kept so we can redraw them; the full screen graph reads its own
     property var tempPlotData: []
     property var humidityPlotData: []
     property var pressurePlotData: []
+    property var dewPointPlotData: []
+    property var absHumidityPlotData: []
+    property var vpdPlotData: []
     property var pm25PlotData: []
     property var co2PlotData: []
     property var vocPlotData: []
@@ -59,6 +55,31 @@ Page {
         return unixTimestamp;
     }
 
+    // Graphs that show the range statistics, by sensor table
+    function statsGraphs() {
+        var graphs = { "temperature": tempGraph, "humidity": humidityGraph, "air_pressure": pressureGraph };
+        if (selectedDevice.isAir) {
+            graphs["pm25"] = pm25Graph;
+            graphs["co2"] = co2Graph;
+            graphs["voc"] = vocGraph;
+            graphs["nox"] = noxGraph;
+            graphs["iaqs"] = iaqsGraph;
+        }
+        return graphs;
+    }
+
+    function requestStats() {
+        var graphs = statsGraphs();
+        for (var sensor in graphs) {
+            var graph = graphs[sensor];
+            graph.setStats(null);
+            if (!graph.noData) {
+                // The plotted span, a range from the epoch would build empty rollups for decades
+                db.requestRangeStats(selectedDevice.deviceAddress, sensor, Math.floor(graph.minX), Math.ceil(graph.maxX));
+            }
+        }
+    }
+
     function formatBinSize(seconds) {
         if (seconds < 60)
             return Math.round(seconds) + " s";
@@ -92,13 +113,15 @@ Page {
             MenuItem {
                 text: "Export as CSV"
                 onClicked: {
-                    // Save the CSV
-                    var csv_path = db.exportCSV(selectedDevice.deviceAddress, selectedDevice.deviceName, startTime, endTime);
-                    // Launch the share action
-                    if (csv_path.length > 0) {
-                        shareaction.resources = [csv_path];
-                        shareaction.trigger();
-                    }
+                    // Save the CSV, the share action is launched when it is written
+                    exportRequest = db.exportCSVAsync(selectedDevice.deviceAddress, selectedDevice.deviceName, startTime, endTime);
+                }
+            }
+            MenuItem {
+                text: "Export new data as CSV"
+                onClicked: {
+                    // Only the rows stored since the previous export of this device
+                    exportRequest = db.exportNewCSVAsync(selectedDevice.deviceAddress, selectedDevice.deviceName, false);
                 }
             }
             MenuItem {
@@ -210,7 +233,8 @@ Page {
                 axisY.units: "°C"
                 onClicked: {
                     pageStack.push(Qt.resolvedUrl("GraphPage.qml"),
-                                { par_data: tempData, par_title: graphTitle, par_units: axisY.units })
+                                { par_device: selectedDevice.deviceAddress, par_sensor: "temperature", par_start: startTime, par_end: endTime,
+                                  par_title: graphTitle, par_units: axisY.units })
                 }
             }
 
@@ -241,7 +265,8 @@ Page {
                 axisY.units: "%rH"
                 onClicked: {
                     pageStack.push(Qt.resolvedUrl("GraphPage.qml"),
-                                { par_data: humidityData, par_title: graphTitle, par_units: axisY.units })
+                                { par_device: selectedDevice.deviceAddress, par_sensor: "humidity", par_start: startTime, par_end: endTime,
+                                  par_title: graphTitle, par_units: axisY.units })
                 }
             }
 
@@ -272,7 +297,46 @@ Page {
                 axisY.units: "mBar"
                 onClicked: {
                     pageStack.push(Qt.resolvedUrl("GraphPage.qml"),
-                                { par_data: pressureData, par_title: graphTitle, par_units: axisY.units })
+                                { par_device: selectedDevice.deviceAddress, par_sensor: "air_pressure", par_start: startTime, par_end: endTime,
+                                  par_title: graphTitle, par_units: axisY.units })
+                }
+            }
+
+            // Computed from temperature and humidity
+            GraphData {
+                id: dewPointGraph
+                graphTitle: qsTr("Dew point")
+                width: parent.width
+                scale: true
+                axisY.units: "°C"
+                onClicked: {
+                    pageStack.push(Qt.resolvedUrl("GraphPage.qml"),
+                                { par_device: selectedDevice.deviceAddress, par_sensor: "dew_point", par_start: startTime, par_end: endTime,
+                                  par_title: graphTitle, par_units: axisY.units })
+                }
+            }
+            GraphData {
+                id: absHumidityGraph
+                graphTitle: qsTr("Absolute humidity")
+                width: parent.width
+                scale: true
+                axisY.units: "g/m³"
+                onClicked: {
+                    pageStack.push(Qt.resolvedUrl("GraphPage.qml"),
+                                { par_device: selectedDevice.deviceAddress, par_sensor: "absolute_humidity", par_start: startTime, par_end: endTime,
+                                  par_title: graphTitle, par_units: axisY.units })
+                }
+            }
+            GraphData {
+                id: vpdGraph
+                graphTitle: qsTr("Vapour pressure deficit")
+                width: parent.width
+                scale: true
+                axisY.units: "kPa"
+                onClicked: {
+                    pageStack.push(Qt.resolvedUrl("GraphPage.qml"),
+                                { par_device: selectedDevice.deviceAddress, par_sensor: "vpd", par_start: startTime, par_end: endTime,
+                                  par_title: graphTitle, par_units: axisY.units })
                 }
             }
 
@@ -308,7 +372,8 @@ Page {
                 axisY.units: "µg/m³"
                 onClicked: {
                     pageStack.push(Qt.resolvedUrl("GraphPage.qml"),
-                                { par_data: pm25Data, par_title: graphTitle, par_units: axisY.units })
+                                { par_device: selectedDevice.deviceAddress, par_sensor: "pm25", par_start: startTime, par_end: endTime,
+                                  par_title: graphTitle, par_units: axisY.units })
                 }
             }
 
@@ -340,7 +405,8 @@ Page {
                 axisY.units: "ppm"
                 onClicked: {
                     pageStack.push(Qt.resolvedUrl("GraphPage.qml"),
-                                { par_data: co2Data, par_title: graphTitle, par_units: axisY.units })
+                                { par_device: selectedDevice.deviceAddress, par_sensor: "co2", par_start: startTime, par_end: endTime,
+                                  par_title: graphTitle, par_units: axisY.units })
                 }
             }
 
@@ -372,7 +438,8 @@ Page {
                 axisY.units: ""
                 onClicked: {
                     pageStack.push(Qt.resolvedUrl("GraphPage.qml"),
-                                { par_data: vocData, par_title: graphTitle, par_units: axisY.units })
+                                { par_device: selectedDevice.deviceAddress, par_sensor: "voc", par_start: startTime, par_end: endTime,
+                                  par_title: graphTitle, par_units: axisY.units })
                 }
             }
 
@@ -404,7 +471,8 @@ Page {
                 axisY.units: ""
                 onClicked: {
                     pageStack.push(Qt.resolvedUrl("GraphPage.qml"),
-                                { par_data: noxData, par_title: graphTitle, par_units: axisY.units })
+                                { par_device: selectedDevice.deviceAddress, par_sensor: "nox", par_start: startTime, par_end: endTime,
+                                  par_title: graphTitle, par_units: axisY.units })
                 }
             }
 
@@ -436,7 +504,8 @@ Page {
                 axisY.units: ""
                 onClicked: {
                     pageStack.push(Qt.resolvedUrl("GraphPage.qml"),
-                                { par_data: iaqsData, par_title: graphTitle, par_units: axisY.units })
+                                { par_device: selectedDevice.deviceAddress, par_sensor: "iaqs", par_start: startTime, par_end: endTime,
+                                  par_title: graphTitle, par_units: axisY.units })
                 }
             }
 
@@ -531,6 +600,9 @@ Page {
                 tempGraph.setPoints(tempPlotData)
                 humidityGraph.setPoints(humidityPlotData)
                 pressureGraph.setPoints(pressurePlotData)
+                dewPointGraph.setPoints(dewPointPlotData)
+                absHumidityGraph.setPoints(absHumidityPlotData)
+                vpdGraph.setPoints(vpdPlotData)
                 if (selectedDevice.isAir) {
                     pm25Graph.setPoints(pm25PlotData)
                     co2Graph.setPoints(co2PlotData)
@@ -551,26 +623,32 @@ Page {
 
     Connections {
         target: db
+        onQueryFinished: {
+            if (requestId === exportRequest) {
+                exportRequest = -1;
+                // Launch the share action
+                if (result.length > 0) {
+                    shareaction.resources = [result];
+                    shareaction.trigger();
+                }
+            }
+        }
         onPlotDataReady: {
-            // Raw for "tap graph → full data"
-            tempData = result["temperature_raw"]
-            humidityData = result["humidity_raw"]
-            pressureData = result["air_pressure_raw"]
-            // Downsampled for display
             tempPlotData = result["temperature_ds"]
             humidityPlotData = result["humidity_ds"]
             pressurePlotData = result["air_pressure_ds"]
+            dewPointPlotData = result["dew_point_ds"]
+            absHumidityPlotData = result["absolute_humidity_ds"]
+            vpdPlotData = result["vpd_ds"]
             aggregated = result["aggregated"]
             bucketDuration = result["bucketDuration"]
             tempGraph.setPoints(tempPlotData)
             humidityGraph.setPoints(humidityPlotData)
             pressureGraph.setPoints(pressurePlotData)
+            dewPointGraph.setPoints(dewPointPlotData)
+            absHumidityGraph.setPoints(absHumidityPlotData)
+            vpdGraph.setPoints(vpdPlotData)
             if (selectedDevice.isAir) {
-                pm25Data = result["pm25_raw"]
-                co2Data  = result["co2_raw"]
-                vocData  = result["voc_raw"]
-                noxData  = result["nox_raw"]
-                iaqsData = result["iaqs_raw"]
                 pm25PlotData = result["pm25_ds"]
                 co2PlotData  = result["co2_ds"]
                 vocPlotData  = result["voc_ds"]
@@ -583,6 +661,13 @@ Page {
                 iaqsGraph.setPoints(iaqsPlotData)
             }
             plotting = false
+            requestStats()
+        }
+        onRangeStatsReady: {
+            var graph = statsGraphs()[result["sensor"]];
+            if (graph && result["device"] === selectedDevice.deviceAddress) {
+                graph.setStats(result)
+            }
         }
     }
 }
@@ -112,13 +112,23 @@ Page {
             VerticalScrollDecorator {}
 
             // Populate the list with known devices
-            Component.onCompleted: {
+            function populateDevices() {
                 // Fetch devices from the database
                 var devices = db.getDevices();
 
-                // Add the fetched devices to the model
+                // Add the fetched devices to the model, the scanner may have added some already
                 for (var i = 0; i < devices.length; i++) {
                     var device = devices[i];
+                    var known = false;
+                    for (var j = 0; j < deviceModel.count; j++) {
+                        if (deviceModel.get(j).deviceAddress === device.deviceAddress) {
+                            known = true;
+                            break;
+                        }
+                    }
+                    if (known) {
+                        continue;
+                    }
                     deviceModel.append({
                         deviceName: device.deviceName,
                         deviceAddress: device.deviceAddress,
@@ -150,6 +160,17 @@ Page {
                 }
             }
 
+            // The database opens in the background while the page loads
+            Component.onCompleted: {
+                if (db.ready) {
+                    populateDevices();
+                }
+            }
+            Connections {
+                target: db
+                onReadyChanged: deviceList.populateDevices()
+            }
+
             Label {
                 width: parent.width
                 text: "No known devices"
@@ -583,7 +604,7 @@ Page {
                          text: "Remove device"
                          onClicked: listItem.remorseDelete(function() {
                              // Remove device and device data from database
-                             db.removeDevice(deviceAddress)
+                             db.removeDeviceAsync(deviceAddress)
                              // Remove device from the list
                              deviceModel.remove(index)
                          })
@@ -595,49 +616,45 @@ Page {
 
     Connections {
         target: db
-        onDeviceDataUpdated: {
-            console.log("Device data updated for " + mac);
+        onDevicesUpdated: {
+            // One batch with the latest readings of every device heard since the previous one
+            var rows = {};
             for (var i = 0; i < deviceModel.count; i++) {
-                var device = deviceModel.get(i);
-                if (device.deviceAddress === mac) {
-                    deviceModel.setProperty(i, "temperature", temperature.toFixed(2));
-                    if (humidity < 163) {
-                        deviceModel.setProperty(i, "humidity", humidity.toFixed(2));
+                rows[deviceModel.get(i).deviceAddress] = i;
+            }
+            for (var c = 0; c < changes.length; c++) {
+                var change = changes[c];
+                var row = rows[change.mac];
+                if (row === undefined) {
+                    continue;
+                }
+                deviceModel.setProperty(row, "temperature", change.temperature.toFixed(2));
+                if (change.air) {
+                    deviceModel.setProperty(row, "humidity", change.humidity.toFixed(2));
+                    deviceModel.setProperty(row, "pressure", change.pressure.toFixed(2));
+                    deviceModel.setProperty(row, "pm25", change.pm25.toFixed(2));
+                    deviceModel.setProperty(row, "co2", change.co2.toString());
+                    deviceModel.setProperty(row, "voc", change.voc.toString());
+                    deviceModel.setProperty(row, "nox", change.nox.toString());
+                    deviceModel.setProperty(row, "iaqs", change.iaqs.toString());
+                    deviceModel.setProperty(row, "calibrating", change.calibrating ? "Yes" : "No");
+                    deviceModel.setProperty(row, "meas_seq", change.sequence.toString());
+                } else {
+                    if (change.humidity < 163) {
+                        deviceModel.setProperty(row, "humidity", change.humidity.toFixed(2));
                     }
-                    if (pressure < 1155) {
-                        deviceModel.setProperty(i, "pressure", pressure.toFixed(2));
+                    if (change.pressure < 1155) {
+                        deviceModel.setProperty(row, "pressure", change.pressure.toFixed(2));
                     }
-                    deviceModel.setProperty(i, "accX", accX.toFixed(2));
-                    deviceModel.setProperty(i, "accY", accY.toFixed(2));
-                    deviceModel.setProperty(i, "accZ", accZ.toFixed(2));
-                    deviceModel.setProperty(i, "deviceVoltage", voltage.toFixed(2));
-                    deviceModel.setProperty(i, "deviceMovement", movementCounter.toString());
-                    deviceModel.setProperty(i, "meas_seq", measurementSequenceNumber.toString());
-                    deviceModel.setProperty(i, "last_obs", timestamp.toString());
-                    deviceModel.setProperty(i, "showBluetoothIcon", true);
-                    break;
-                }
-            }
-        }
-        onAirDeviceDataUpdated: {
-            console.log("Ruuvi Air updated: " + mac)
-            for (var i = 0; i < deviceModel.count; i++) {
-                var device = deviceModel.get(i)
-                if (device.deviceAddress === mac) {
-                    deviceModel.setProperty(i, "temperature", temperature.toFixed(2))
-                    deviceModel.setProperty(i, "humidity", humidity.toFixed(2))
-                    deviceModel.setProperty(i, "pressure", pressure.toFixed(2))
-                    deviceModel.setProperty(i, "pm25", pm25.toFixed(2))
-                    deviceModel.setProperty(i, "co2", co2.toString())
-                    deviceModel.setProperty(i, "voc", voc.toString())
-                    deviceModel.setProperty(i, "nox", nox.toString())
-                    deviceModel.setProperty(i, "iaqs", iaqs.toString())
-                    deviceModel.setProperty(i, "calibrating", calibrating ? "Yes" : "No")
-                    deviceModel.setProperty(i, "meas_seq", sequence.toString())
-                    deviceModel.setProperty(i, "last_obs", timestamp.toString())
-                    deviceModel.setProperty(i, "showBluetoothIcon", true)
-                    break
+                    deviceModel.setProperty(row, "accX", change.accX.toFixed(2));
+                    deviceModel.setProperty(row, "accY", change.accY.toFixed(2));
+                    deviceModel.setProperty(row, "accZ", change.accZ.toFixed(2));
+                    deviceModel.setProperty(row, "deviceVoltage", change.voltage.toFixed(2));
+                    deviceModel.setProperty(row, "deviceMovement", change.movementCounter.toString());
+                    deviceModel.setProperty(row, "meas_seq", change.measurementSequenceNumber.toString());
                 }
+                deviceModel.setProperty(row, "last_obs", change.timestamp.toString());
+                deviceModel.setProperty(row, "showBluetoothIcon", true);
             }
         }
     }
@@ -14,6 +14,7 @@ BuildRequires:  pkgconfig(Qt5Qml)
 BuildRequires:  pkgconfig(Qt5Quick)
 BuildRequires:  pkgconfig(Qt5DBus)
 BuildRequires:  pkgconfig(Qt5Sql)
+BuildRequires:  pkgconfig(sqlite3)
 BuildRequires:  desktop-file-utils
 
 %description
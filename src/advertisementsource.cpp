@@ -0,0 +1,85 @@
+/*
+    Skruuvi - Reader for Ruuvi sensors
+    Copyright (C) 2025  Miika Malin
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see [http://www.gnu.org/licenses/].
+*/
+#include "advertisementsource.h"
+#include <QDebug>
+#include <QByteArray>
+
+advertisementsource::advertisementsource(QObject *parent, database* db)
+    : QObject(parent)
+    , db(db)
+    , discovering(false)
+{
+}
+
+QVariantMap advertisementsource::getStats() const
+{
+    return QVariantMap();
+}
+
+bool advertisementsource::isDiscovering() const
+{
+    return discovering;
+}
+
+void advertisementsource::setDiscovering(bool active)
+{
+    if (active == discovering) {
+        return;
+    }
+    discovering = active;
+    emit discoveryActiveChanged(active);
+}
+
+int advertisementsource::sequenceNumber(const std::array<uint8_t, 24> &manufacturerData)
+{
+    switch (manufacturerData[0]) {
+        case 5: {
+            // 65535 is "not available" in DF5
+            const int sequence = (manufacturerData[16] << 8) | manufacturerData[17];
+            return sequence == 0xFFFF ? -1 : sequence;
+        }
+        case 6:
+            return manufacturerData[15];
+        default:
+            return -1;
+    }
+}
+
+bool advertisementsource::setRecordingFile(const QString &path)
+{
+    recordingFile.close();
+    recordingFile.setFileName(path);
+    if (!recordingFile.open(QIODevice::WriteOnly | QIODevice::Append | QIODevice::Text)) {
+        qWarning() << "Could not open advertisement recording file:" << recordingFile.errorString();
+        return false;
+    }
+    recordingClock.start();
+    return true;
+}
+
+void advertisementsource::deliverAdvertisement(const QString &deviceAddress, const std::array<uint8_t, 24> &manufacturerData)
+{
+    if (recordingFile.isOpen()) {
+        // Recording format: <milliseconds since recording start> <mac> <payload as hex>
+        const QByteArray payload(reinterpret_cast<const char*>(manufacturerData.data()), int(manufacturerData.size()));
+        recordingFile.write(QByteArray::number(recordingClock.elapsed()) + ' ' + deviceAddress.toLatin1() + ' ' + payload.toHex() + '\n');
+        recordingFile.flush();
+    }
+    db->inputManufacturerData(deviceAddress, manufacturerData);
+    emit advertisementReceived(deviceAddress, sequenceNumber(manufacturerData));
+}
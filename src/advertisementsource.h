@@ -0,0 +1,70 @@
+/*
+    Skruuvi - Reader for Ruuvi sensors
+    Copyright (C) 2025  Miika Malin
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see [http://www.gnu.org/licenses/].
+*/
+#ifndef ADVERTISEMENTSOURCE_H
+#define ADVERTISEMENTSOURCE_H
+
+#include <QObject>
+#include <QFile>
+#include <QElapsedTimer>
+#include <array>
+#include "database.h"
+
+// Common interface for everything that produces Ruuvi advertisements,
+// exposed to QML as "bs". The BlueZ scanner and the replay source both
+// hand their payloads to deliverAdvertisement.
+class advertisementsource : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit advertisementsource(QObject *parent = nullptr, database* db = nullptr);
+    Q_INVOKABLE virtual void startScan() = 0;
+    Q_INVOKABLE virtual void stopScan() = 0;
+    Q_INVOKABLE virtual bool isScanning() const = 0;
+    // Source specific throughput statistics
+    Q_INVOKABLE virtual QVariantMap getStats() const;
+    // Duty cycling by scanscheduler: pauses the radio while scanning stays on
+    virtual void setDiscoveryActive(bool active) = 0;
+    // Whether the radio is discovering right now, see discoveryActiveChanged
+    bool isDiscovering() const;
+    // Appends every delivered advertisement to a file that replayscanner can play back
+    bool setRecordingFile(const QString &path);
+    // Measurement sequence number of a DF5/DF6 payload, -1 for other formats and when not available
+    static int sequenceNumber(const std::array<uint8_t, 24> &manufacturerData);
+
+signals:
+    void deviceFound(const QString deviceName, const QString deviceAddress);
+    void discoveryStopped();
+    void bluetoothOff();
+    void advertisementReceived(const QString &deviceAddress, int sequence);
+    // The radio started or stopped discovering, whoever asked for it
+    void discoveryActiveChanged(bool active);
+
+protected:
+    database* db;
+    void deliverAdvertisement(const QString &deviceAddress, const std::array<uint8_t, 24> &manufacturerData);
+    // Called by the sources whenever their radio state may have changed
+    void setDiscovering(bool active);
+
+private:
+    bool discovering;
+    QFile recordingFile;
+    QElapsedTimer recordingClock;
+};
+
+#endif // ADVERTISEMENTSOURCE_H
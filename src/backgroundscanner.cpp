@@ -22,17 +22,256 @@
 #include <QDBusConnection>
 #include <QDBusArgument>
 #include <QByteArray>
+#include <QDBusMetaType>
+#include <QDBusReply>
+#include "latencystats.h"
+
+static const QString BLUEZ_SERVICE = "org.bluez";
+// Used when the ObjectManager does not list any adapters
+static const QString DEFAULT_ADAPTER = "/org/bluez/hci0";
+static const quint16 RUUVI_MANUFACTURER_ID = 0x0499;
+// Sequence numbers remembered per tag. An adapter can deliver a copy after
+// the next advertisement has already arrived through another one.
+static const int SEQUENCE_WINDOW = 8;
 
 backgroundscanner::backgroundscanner(QObject *parent, database* db)
-    : QObject(parent)
-    , bus(QDBusConnection::systemBus())
-    , db(db)
+    : advertisementsource(parent, db)
+    , bus(bluezBus())
     , scanning(false)
+    , signalsConnected(false)
+    , scanCpuStart(0)
 {
+    qDBusRegisterMetaType<InterfaceList>();
+    qDBusRegisterMetaType<ManagedObjectList>();
     startScan();
 }
 
+QDBusConnection backgroundscanner::bluezBus()
+{
+    // SKRUUVI_BLUEZ_BUS allows running against a mock BlueZ, either on the
+    // session bus ("session") or on a private bus given by its address
+    const QString busName = QString::fromLocal8Bit(qgetenv("SKRUUVI_BLUEZ_BUS"));
+    if (busName.isEmpty()) {
+        return QDBusConnection::systemBus();
+    }
+    if (busName == "session") {
+        return QDBusConnection::sessionBus();
+    }
+    return QDBusConnection::connectToBus(busName, "skruuvi-bluez");
+}
+
+QStringList backgroundscanner::loadManagedObjects()
+{
+    // Lists the adapters, and picks up Ruuvi devices BlueZ already knows
+    // about since those do not get an InterfacesAdded signal
+    QStringList found;
+    QDBusInterface objectManager(BLUEZ_SERVICE, "/", "org.freedesktop.DBus.ObjectManager", bus);
+    QDBusReply<ManagedObjectList> reply = objectManager.call("GetManagedObjects");
+    if (reply.isValid()) {
+        const ManagedObjectList objects = reply.value();
+        for (auto it = objects.constBegin(); it != objects.constEnd(); ++it) {
+            if (it.value().contains("org.bluez.Adapter1")) {
+                found.append(it.key().path());
+            } else if (it.value().contains("org.bluez.Device1")) {
+                registerDevice(it.key().path(), it.value().value("org.bluez.Device1"), false);
+            }
+        }
+    } else {
+        qDebug() << "Could not list Bluetooth adapters:" << reply.error().message();
+    }
+    if (found.isEmpty()) {
+        found.append(DEFAULT_ADAPTER);
+    }
+    return found;
+}
+
+void backgroundscanner::setDiscoveryFilter(QDBusInterface &adapterInterface)
+{
+    // LE only, and report every advertisement instead of just the changed ones.
+    // BlueZ cannot filter on the manufacturer ID and renamed tags do not match a
+    // name pattern, so the ID is checked in parseManufacturerData. Older BlueZ
+    // versions reject the newer keys, so retry without them.
+    QVariantMap filter;
+    filter["Transport"] = "le";
+    filter["DuplicateData"] = true;
+    const QStringList optionalKeys = {"DuplicateData"};
+    for (int i = 0; i <= optionalKeys.size(); ++i) {
+        QDBusMessage reply = adapterInterface.call("SetDiscoveryFilter", filter);
+        if (reply.type() != QDBusMessage::ErrorMessage) {
+            return;
+        }
+        qDebug() << "SetDiscoveryFilter failed:" << reply.errorMessage();
+        if (i < optionalKeys.size()) {
+            filter.remove(optionalKeys[i]);
+        }
+    }
+}
+
+bool backgroundscanner::startAdapterDiscovery(const QString &adapterPath)
+{
+    QDBusInterface adapterInterface(BLUEZ_SERVICE, adapterPath, "org.bluez.Adapter1", bus);
+
+    // Check if the adapter is on
+    QVariant poweredVariant = adapterInterface.property("Powered");
+    if (poweredVariant.isValid() && !poweredVariant.toBool()) {
+        qDebug() << "Bluetooth adapter" << adapterPath << "is off";
+        return false;
+    }
+
+    setDiscoveryFilter(adapterInterface);
+    QDBusMessage startDiscovery = adapterInterface.call("StartDiscovery");
+    if (startDiscovery.type() == QDBusMessage::ErrorMessage) {
+        qDebug() << "Failed to start device discovery on" << adapterPath << ":" << startDiscovery.errorMessage();
+        return false;
+    }
+    adapters[adapterPath].discovering = true;
+    return true;
+}
+
+bool backgroundscanner::registerDevice(const QString &objectPath, const QVariantMap &properties, bool deliver)
+{
+    if (deviceMacs.contains(objectPath)) {
+        return true;
+    }
+    std::array<uint8_t, 24> manufacturerData = {0};
+    if (properties.contains("ManufacturerData")) {
+        manufacturerData = parseManufacturerData(properties.value("ManufacturerData").value<QDBusArgument>());
+    }
+    // The name may not be resolved yet, Ruuvi manufacturer data is enough
+    QString deviceName = properties.value("Name").toString();
+    if (!deviceName.contains("Ruuvi") && manufacturerData[0] == 0) {
+        return false;
+    }
+    QString deviceAddress = properties.value("Address").toString();
+    if (deviceAddress.isEmpty()) {
+        deviceAddress = macFromObjectPath(objectPath);
+    }
+    if (deviceName.isEmpty()) {
+        deviceName = "Ruuvi " + deviceAddress.right(5).remove(':');
+    }
+    deviceMacs.insert(objectPath, deviceAddress);
+
+    if (!announcedDevices.contains(deviceAddress)) {
+        announcedDevices.insert(deviceAddress);
+        // Emit devicefound signal to be able to handle new devices in QML
+        emit deviceFound(deviceName, deviceAddress);
+        db->addDevice(deviceAddress, deviceName);
+    }
+    if (deliver && manufacturerData[0] != 0) {
+        qDebug() << "Backgroundscanner: Got new ManufacturerData (onInterfacesAdded):";
+        handleAdvertisement(objectPath, deviceAddress, manufacturerData);
+    }
+    return true;
+}
+
+void backgroundscanner::stopAdapterDiscovery(const QString &adapterPath)
+{
+    adapterStats &stats = adapters[adapterPath];
+    if (!stats.discovering) {
+        return;
+    }
+    QDBusInterface adapterInterface(BLUEZ_SERVICE, adapterPath, "org.bluez.Adapter1", bus);
+    QDBusMessage stopDiscovery = adapterInterface.call("StopDiscovery");
+    if (stopDiscovery.type() == QDBusMessage::ErrorMessage) {
+        qDebug() << "Failed to stop device discovery on" << adapterPath << ":" << stopDiscovery.errorMessage();
+    }
+    stats.discovering = false;
+}
+
+void backgroundscanner::setDiscoveryActive(bool active)
+{
+    if (!scanning) {
+        return;
+    }
+    for (const QString &adapterPath : adapters.keys()) {
+        if (active) {
+            if (!adapters[adapterPath].discovering) {
+                startAdapterDiscovery(adapterPath);
+            }
+        } else {
+            stopAdapterDiscovery(adapterPath);
+        }
+    }
+    updateDiscovering();
+}
+
+void backgroundscanner::updateDiscovering()
+{
+    bool any = false;
+    for (const adapterStats &stats : adapters) {
+        any = any || stats.discovering;
+    }
+    setDiscovering(scanning && any);
+}
+
+QString backgroundscanner::adapterFromObjectPath(const QString &path)
+{
+    // "/org/bluez/hci0/dev_XX_XX_XX_XX_XX_XX" -> "/org/bluez/hci0"
+    return path.section('/', 0, 3);
+}
+
+void backgroundscanner::handleAdvertisement(const QString &objectPath, const QString &deviceAddress,
+                                            const std::array<uint8_t, 24> &manufacturerData)
+{
+    adapterStats &stats = adapters[adapterFromObjectPath(objectPath)];
+    ++stats.adverts;
+
+    // With several adapters the same advertisement arrives once per adapter,
+    // only the first copy of every sequence number is stored
+    const int sequence = sequenceNumber(manufacturerData);
+    if (sequence >= 0) {
+        QVector<int> &recent = recentSequences[deviceAddress];
+        if (recent.contains(sequence)) {
+            ++stats.duplicates;
+            return;
+        }
+        recent.append(sequence);
+        if (recent.size() > SEQUENCE_WINDOW) {
+            recent.removeFirst();
+        }
+    }
+    deliverAdvertisement(deviceAddress, manufacturerData);
+}
+
+QVariantMap backgroundscanner::getStats() const
+{
+    QVariantMap stats;
+    const double elapsedS = scanClock.isValid() ? scanClock.nsecsElapsed() / 1e9 : 0.0;
+    const QVariantMap latencies = latencystats::snapshot();
+    const QVariantMap counters = latencies.value("counters").toMap();
+    const QVariantMap handler = latencies.value("stages").toMap().value(latencystats::stageName(latencystats::BluezSignal)).toMap();
+    const qint64 signalCount = counters.value(latencystats::counterName(latencystats::BluezSignals)).toLongLong();
+    const double handlerMs = handler.value("meanUs").toDouble() * handler.value("count").toDouble() / 1000.0;
+    const double cpuMs = scanCpuStart > 0 ? (std::clock() - scanCpuStart) * 1000.0 / CLOCKS_PER_SEC : 0.0;
+
+    stats["elapsedSeconds"] = elapsedS;
+    stats["devices"] = announcedDevices.size();
+    stats["signals"] = signalCount;
+    stats["ignoredSignals"] = counters.value(latencystats::counterName(latencystats::IgnoredBluezSignals));
+    stats["signalsPerSecond"] = elapsedS > 0.0 ? signalCount / elapsedS : 0.0;
+    // Time spent in the D-Bus signal handlers, and CPU time of the whole process
+    stats["handlerMs"] = handlerMs;
+    stats["processCpuMs"] = cpuMs;
+    stats["processCpuPercent"] = elapsedS > 0.0 ? cpuMs / 10.0 / elapsedS : 0.0;
+    return stats;
+}
+
+QVariantList backgroundscanner::getAdapterStats() const
+{
+    QVariantList result;
+    for (auto it = adapters.constBegin(); it != adapters.constEnd(); ++it) {
+        QVariantMap adapter;
+        adapter["path"] = it.key();
+        adapter["discovering"] = it.value().discovering;
+        adapter["adverts"] = it.value().adverts;
+        adapter["duplicates"] = it.value().duplicates;
+        result.append(adapter);
+    }
+    return result;
+}
+
 std::array<uint8_t, 24> backgroundscanner::parseManufacturerData(const QDBusArgument &dbusArg) {
+    latencyscope parseScope(latencystats::ParseManufacturerData);
     std::array<uint8_t, 24> manufacturerData = {0};  // Initialize array to zero
 
     // Parse the data
@@ -44,6 +283,9 @@ std::array<uint8_t, 24> backgroundscanner::parseManufacturerData(const QDBusArgu
         dbusArg >> key >> valueVariant;
         QByteArray value = valueVariant.variant().toByteArray();
         dbusArg.endMapEntry();
+        if (key != RUUVI_MANUFACTURER_ID) {
+            continue;
+        }
 
         // Accept either DF5 (24 bytes) or DF6 (20 bytes)
         if (value.size() != 24 && value.size() != 20) {
@@ -76,107 +318,103 @@ QString backgroundscanner::macFromObjectPath(const QString &path)
 void backgroundscanner::startScan()
 {
     qDebug() << "Starting background scan...";
-    // Create the adapter interface
-    QDBusInterface adapterInterface("org.bluez", "/org/bluez/hci0", "org.bluez.Adapter1", bus, this);
-
-    // Check if bluetooth adapter is on
-    QVariant poweredVariant = adapterInterface.property("Powered");
-    if (poweredVariant.isValid()) {
-        bool powered = poweredVariant.toBool();
-        if (!powered) {
-            qDebug() << "Bluetooth is off";
-            emit bluetoothOff();
-            emit discoveryStopped();
-            scanning = false;
-            return;
-        }
+    // Scan with every adapter, advertisements heard by several are deduplicated
+    bool started = false;
+    for (const QString &adapterPath : loadManagedObjects()) {
+        started = startAdapterDiscovery(adapterPath) || started;
     }
-
-    // Start the discovery
-    QDBusMessage startDiscovery = adapterInterface.call("StartDiscovery");
-    if (startDiscovery.type() == QDBusMessage::ErrorMessage) {
-        qDebug() << "Failed to start device discovery:" << startDiscovery.errorMessage();
+    if (!started) {
+        qDebug() << "Bluetooth is off";
+        emit bluetoothOff();
         emit discoveryStopped();
+        scanning = false;
+        updateDiscovering();
         return;
     }
 
-    // Connect the signal handler for DeviceFound signal
-    bus.connect("org.bluez", "/", "org.freedesktop.DBus.ObjectManager", "InterfacesAdded",
-                this, SLOT(onInterfacesAdded(QDBusObjectPath, QVariantMap)));
+    // Connect the signal handlers for new devices and adapters, and a single
+    // PropertiesChanged subscription for all Device1 objects. Other devices
+    // are dropped by the path lookup in onPropertiesChanged.
+    if (!signalsConnected) {
+        signalsConnected = true;
+        bus.connect(BLUEZ_SERVICE, "/", "org.freedesktop.DBus.ObjectManager", "InterfacesAdded",
+                    this, SLOT(onInterfacesAdded(QDBusObjectPath, QVariantMap)));
+        bus.connect(BLUEZ_SERVICE, "/", "org.freedesktop.DBus.ObjectManager", "InterfacesRemoved",
+                    this, SLOT(onInterfacesRemoved(QDBusObjectPath, QStringList)));
+        bus.connect(BLUEZ_SERVICE, QString(), "org.freedesktop.DBus.Properties", "PropertiesChanged",
+                    QStringList() << "org.bluez.Device1", QString(),
+                    this, SLOT(onPropertiesChanged(QString, QVariantMap, QStringList, QDBusMessage)));
+        // BlueZ stops the discovery on its own too, e.g. when the adapter is turned off
+        bus.connect(BLUEZ_SERVICE, QString(), "org.freedesktop.DBus.Properties", "PropertiesChanged",
+                    QStringList() << "org.bluez.Adapter1", QString(),
+                    this, SLOT(onAdapterPropertiesChanged(QString, QVariantMap, QStringList, QDBusMessage)));
+    }
+    scanClock.start();
+    scanCpuStart = std::clock();
     scanning = true;
+    updateDiscovering();
 }
 
 void backgroundscanner::stopScan()
 {
-    // Create the adapter interface
-    QDBusInterface adapterInterface("org.bluez", "/org/bluez/hci0", "org.bluez.Adapter1", bus, this);
-    QDBusMessage stopDiscovery = adapterInterface.call("StopDiscovery");
-    if (stopDiscovery.type() == QDBusMessage::ErrorMessage) {
-        qDebug() << "Failed to stop device discovery:" << stopDiscovery.errorMessage();
-        return;
+    for (const QString &adapterPath : adapters.keys()) {
+        stopAdapterDiscovery(adapterPath);
     }
 
     qDebug() << "Background scanning stopped";
     scanning = false;
+    updateDiscovering();
+    recentSequences.clear();
     // Emit the discoveryStopped signal
     emit discoveryStopped();
 }
 
 void backgroundscanner::onInterfacesAdded(const QDBusObjectPath &objectPath, const QVariantMap &interfaces)
 {
+    latencyscope signalScope(latencystats::BluezSignal);
+    latencystats::increment(latencystats::BluezSignals);
     if (!scanning) {
         qDebug() << "Received InterfacesAdded signal, but background scanner is not active.";
         return;  // Ignore signals if not scanning
     }
+    if (interfaces.contains("org.bluez.Adapter1")) {
+        // Adapter plugged in while scanning
+        startAdapterDiscovery(objectPath.path());
+        updateDiscovering();
+        return;
+    }
     if (interfaces.contains("org.bluez.Device1")) {
-        QDBusInterface deviceInterface("org.bluez", objectPath.path(), "org.bluez.Device1", bus);
-
-        // Get the device name
-        QString deviceName;
-        QVariant deviceNameVariant = deviceInterface.property("Name");
-        if (deviceNameVariant.isValid()) {
-            deviceName = deviceNameVariant.toString();
-        }
-
-        // Get the device MAC address
-        QString deviceAddress;
-        QVariant deviceAddressVariant = deviceInterface.property("Address");
-        if (deviceAddressVariant.isValid()) {
-            deviceAddress = deviceAddressVariant.toString();
+        // The signal carries the device properties, no need to query them
+        const QVariantMap properties = qdbus_cast<QVariantMap>(interfaces.value("org.bluez.Device1"));
+        if (!registerDevice(objectPath.path(), properties, true)) {
+            latencystats::increment(latencystats::IgnoredBluezSignals);
         }
+    }
+}
 
-        // Only continue processing if name contains "Ruuvi"
-        if (deviceName.contains("Ruuvi")) {
-            // Emit devicefound signal to be able to handle new devices in QML
-            emit deviceFound(deviceName, deviceAddress);
-            // Parse BT advertisement data from ManufacturerData field
-            // We need to read the ManufacturerData through org.freedesktop.DBus.Properties,
-            // otherwise we will crash if read the property with deviceInterface.property, see
-            // https://stackoverflow.com/questions/28345362/fatal-error-when-trying-to-get-a-dbus-property-with-custom-type
-            QDBusInterface deviceProps("org.bluez", objectPath.path(), "org.freedesktop.DBus.Properties", bus);
-            QDBusMessage reply = deviceProps.call("Get", "org.bluez.Device1", "ManufacturerData");
-            // See https://stackoverflow.com/questions/20206376/how-do-i-extract-the-returned-data-from-qdbusmessage-in-a-qt-dbus-call
-            // For explanation of the type switches below
-            QVariant firstReply = reply.arguments().first();
-            QVariant firstReplyVariant = firstReply.value<QDBusVariant>().variant();
-            const QDBusArgument &dbusArgs = firstReplyVariant.value<QDBusArgument>();
-            std::array<uint8_t, 24> manufacturerData = parseManufacturerData(dbusArgs);
-            qDebug() << "Backgroundscanner: Got new ManufacturerData (onInterfacesAdded):";
-            db->addDevice(deviceAddress, deviceName);
-            db->inputManufacturerData(deviceAddress, manufacturerData);
-
-            // Connect to PropertiesChanged for this specific device so we get the manufacturerData updates
-            bus.connect("org.bluez", objectPath.path(), "org.freedesktop.DBus.Properties",
-                        "PropertiesChanged", this, SLOT(onPropertiesChanged(QString, QVariantMap, QStringList, QDBusMessage)));
-        }
+void backgroundscanner::onInterfacesRemoved(const QDBusObjectPath &objectPath, const QStringList &interfaces)
+{
+    // BlueZ drops devices that have not been seen for a while, they come back with InterfacesAdded
+    if (interfaces.contains("org.bluez.Device1")) {
+        deviceMacs.remove(objectPath.path());
     }
 }
 
 void backgroundscanner::onPropertiesChanged(const QString &interface, const QVariantMap &changedProperties, const QStringList &, const QDBusMessage &msg) {
+    latencyscope signalScope(latencystats::BluezSignal);
+    latencystats::increment(latencystats::BluezSignals);
     if (!scanning) {
         qDebug() << "Received PropertiesChanged signal, but background scanner is not active.";
         return;  // Ignore signals if not scanning
     }
+    auto device = deviceMacs.constFind(msg.path());
+    if (device == deviceMacs.constEnd()) {
+        // Device added before its name or Ruuvi data was known
+        if (!changedProperties.contains("ManufacturerData") || !registerDevice(msg.path(), changedProperties, true)) {
+            latencystats::increment(latencystats::IgnoredBluezSignals);
+        }
+        return;
+    }
     if (interface.contains("org.bluez.Device1")) {
         // Check if "ManufacturerData" is in changedProperties
         if (!changedProperties.contains("ManufacturerData")) {
@@ -187,11 +425,27 @@ void backgroundscanner::onPropertiesChanged(const QString &interface, const QVar
         QVariant manufacturerDataVar = changedProperties.value("ManufacturerData");
         const QDBusArgument &dbusArg = manufacturerDataVar.value<QDBusArgument>();
         std::array<uint8_t, 24> manufacturerData = parseManufacturerData(dbusArg);
+        if (manufacturerData[0] == 0) {
+            return;  // No Ruuvi payload
+        }
         qDebug() << "Backgroundscanner: Got new ManufacturerData (onPropertiesChanged):";
-        const QString objectPath = msg.path();
-        QString deviceAddress = macFromObjectPath(objectPath);
-        db->inputManufacturerData(deviceAddress, manufacturerData);
+        handleAdvertisement(msg.path(), device.value(), manufacturerData);
+    }
+}
+
+void backgroundscanner::onAdapterPropertiesChanged(const QString &interface, const QVariantMap &changedProperties,
+                                                   const QStringList &, const QDBusMessage &msg) {
+    if (interface != "org.bluez.Adapter1" || !adapters.contains(msg.path())) {
+        return;
+    }
+    adapterStats &stats = adapters[msg.path()];
+    if (changedProperties.contains("Discovering")) {
+        stats.discovering = changedProperties.value("Discovering").toBool();
+    }
+    if (changedProperties.contains("Powered") && !changedProperties.value("Powered").toBool()) {
+        stats.discovering = false;
     }
+    updateDiscovering();
 }
 
 bool backgroundscanner::isScanning() const {
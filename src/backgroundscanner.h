@@ -15,35 +15,82 @@
     You should have received a copy of the GNU General Public License
     along with this program.  If not, see [http://www.gnu.org/licenses/].
 */
+#ifndef BACKGROUNDSCANNER_H
+#define BACKGROUNDSCANNER_H
+
 #include <QObject>
 #include <QDBusConnection>
 #include <QDBusObjectPath>
 #include <QDBusArgument>
-#include "database.h"
+#include <QDBusInterface>
+#include <QMap>
+#include <QHash>
+#include <QSet>
+#include <QVector>
+#include <QElapsedTimer>
+#include <ctime>
+#include "advertisementsource.h"
+
+// Reply of org.freedesktop.DBus.ObjectManager.GetManagedObjects
+typedef QMap<QString, QVariantMap> InterfaceList;
+typedef QMap<QDBusObjectPath, InterfaceList> ManagedObjectList;
+Q_DECLARE_METATYPE(InterfaceList)
+Q_DECLARE_METATYPE(ManagedObjectList)
 
-class backgroundscanner : public QObject
+class backgroundscanner : public advertisementsource
 {
     Q_OBJECT
 
 public:
     explicit backgroundscanner(QObject *parent = nullptr, database* db = nullptr);
-    Q_INVOKABLE void startScan();
-    Q_INVOKABLE void stopScan();
-    Q_INVOKABLE bool isScanning() const;
-
-signals:
-    void deviceFound(const QString deviceName, const QString deviceAddress);
-    void discoveryStopped();
-    void bluetoothOff();
+    Q_INVOKABLE void startScan() override;
+    Q_INVOKABLE void stopScan() override;
+    Q_INVOKABLE bool isScanning() const override;
+    Q_INVOKABLE QVariantList getAdapterStats() const;
+    Q_INVOKABLE QVariantMap getStats() const override;
+    void setDiscoveryActive(bool active) override;
 
 private slots:
     void onInterfacesAdded(const QDBusObjectPath &objectPath, const QVariantMap &interfaces);
+    void onInterfacesRemoved(const QDBusObjectPath &objectPath, const QStringList &interfaces);
     void onPropertiesChanged(const QString &interface, const QVariantMap &changedProperties, const QStringList &invalidated, const QDBusMessage &msg);
+    void onAdapterPropertiesChanged(const QString &interface, const QVariantMap &changedProperties, const QStringList &invalidated, const QDBusMessage &msg);
     std::array<uint8_t, 24> parseManufacturerData(const QDBusArgument &dbusArg);
     QString macFromObjectPath(const QString &path);
 
 private:
+    struct adapterStats {
+        bool discovering = false;
+        qint64 adverts = 0;
+        qint64 duplicates = 0;
+    };
+
     QDBusConnection bus;
-    database* db;
     bool scanning;
+    bool signalsConnected;
+    // Per adapter object path, e.g. /org/bluez/hci1
+    QMap<QString, adapterStats> adapters;
+    // Recent sequence numbers per MAC, oldest first, used to drop the same
+    // advertisement heard by several adapters
+    QHash<QString, QVector<int>> recentSequences;
+    // BlueZ device object path -> MAC of the Ruuvi devices, every other path is ignored
+    QHash<QString, QString> deviceMacs;
+    // MACs already reported with deviceFound
+    QSet<QString> announcedDevices;
+    QElapsedTimer scanClock;
+    std::clock_t scanCpuStart;
+
+    static QDBusConnection bluezBus();
+    QStringList loadManagedObjects();
+    bool startAdapterDiscovery(const QString &adapterPath);
+    void stopAdapterDiscovery(const QString &adapterPath);
+    // Reports whether any adapter is discovering, see advertisementsource::discoveryActiveChanged
+    void updateDiscovering();
+    void setDiscoveryFilter(QDBusInterface &adapterInterface);
+    bool registerDevice(const QString &objectPath, const QVariantMap &properties, bool deliver);
+    static QString adapterFromObjectPath(const QString &path);
+    void handleAdvertisement(const QString &objectPath, const QString &deviceAddress,
+                             const std::array<uint8_t, 24> &manufacturerData);
 };
+
+#endif // BACKGROUNDSCANNER_H
@@ -0,0 +1,120 @@
+/*
+    Skruuvi - Reader for Ruuvi sensors
+    Copyright (C) 2025  Miika Malin
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see [http://www.gnu.org/licenses/].
+*/
+#include "csvimporter.h"
+#include <algorithm>
+#include <vector>
+
+// Longer lines are not written by exportCSV, they are skipped
+static const int MAX_LINE_LENGTH = 4096;
+
+const char* const csvimporter::COLUMNS[COLUMN_COUNT] = {
+    "temperature", "humidity", "air_pressure", "pm25", "co2", "voc", "nox", "iaqs"
+};
+
+csvimporter::csvimporter(QIODevice* device)
+    : device(device)
+{
+}
+
+bool csvimporter::parseLine(const QByteArray &line, QHash<QString, int> &devices, csvchunk &chunk, row &parsed)
+{
+    // The name may contain commas, so the fixed columns are split off from both ends
+    QList<QByteArray> fields = line.trimmed().split(',');
+    if (fields.size() < COLUMN_COUNT + 3) {
+        return false;
+    }
+    const QString mac = QString::fromLatin1(fields.first());
+    const QString name = QString::fromUtf8(fields.mid(1, fields.size() - COLUMN_COUNT - 2).join(','));
+    const int first = fields.size() - COLUMN_COUNT;
+    bool ok = false;
+    parsed.timestamp = fields[first - 1].toInt(&ok);
+    if (!ok || mac.length() != 17) {
+        return false;
+    }
+    parsed.present = 0;
+    for (int column = 0; column < COLUMN_COUNT; ++column) {
+        const QByteArray &field = fields[first + column];
+        if (field == "-") {
+            continue;
+        }
+        parsed.values[column] = field.toDouble(&ok);
+        if (!ok) {
+            return false;
+        }
+        parsed.present |= 1 << column;
+    }
+
+    QHash<QString, int>::const_iterator it = devices.constFind(mac);
+    if (it == devices.constEnd()) {
+        it = devices.insert(mac, chunk.macs.size());
+        chunk.macs << mac;
+        chunk.names << name;
+    }
+    parsed.device = it.value();
+    return true;
+}
+
+bool csvimporter::next(csvchunk &chunk, int maxRows)
+{
+    chunk = csvchunk();
+    QHash<QString, int> devices;
+    std::vector<row> rows;
+    rows.reserve(maxRows);
+    while (int(rows.size()) < maxRows && !device->atEnd()) {
+        QByteArray line = device->readLine(MAX_LINE_LENGTH);
+        if (!line.endsWith('\n') && !device->atEnd()) {
+            // Skip the rest of an overlong line
+            while (!device->atEnd() && !device->readLine(MAX_LINE_LENGTH).endsWith('\n')) {}
+            ++chunk.skipped;
+            continue;
+        }
+        if (line.startsWith("mac,") || line.trimmed().isEmpty()) {
+            // Header, a file may be several exports joined together
+            continue;
+        }
+        row parsed;
+        if (parseLine(line, devices, chunk, parsed)) {
+            rows.push_back(parsed);
+        } else {
+            ++chunk.skipped;
+        }
+    }
+    chunk.position = device->pos();
+    if (rows.empty()) {
+        return chunk.skipped > 0;
+    }
+
+    // Sorted by device and time, each series is then one ordered run of the b-tree
+    std::sort(rows.begin(), rows.end(), [](const row &a, const row &b) {
+        return a.device != b.device ? a.device < b.device : a.timestamp < b.timestamp;
+    });
+    chunk.series.resize(chunk.macs.size());
+    for (QVector<QList<QPair<int, double>>> &columns : chunk.series) {
+        columns.resize(COLUMN_COUNT);
+    }
+    for (const row &r : rows) {
+        QVector<QList<QPair<int, double>>> &columns = chunk.series[r.device];
+        for (int column = 0; column < COLUMN_COUNT; ++column) {
+            if (r.present & (1 << column)) {
+                columns[column].append(qMakePair(r.timestamp, r.values[column]));
+            }
+        }
+    }
+    chunk.rows = int(rows.size());
+    return true;
+}
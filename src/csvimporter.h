@@ -0,0 +1,68 @@
+/*
+    Skruuvi - Reader for Ruuvi sensors
+    Copyright (C) 2025  Miika Malin
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see [http://www.gnu.org/licenses/].
+*/
+#ifndef CSVIMPORTER_H
+#define CSVIMPORTER_H
+
+#include <QHash>
+#include <QIODevice>
+#include <QList>
+#include <QPair>
+#include <QString>
+#include <QStringList>
+#include <QVector>
+
+// Rows of one chunk split by device and sensor, sorted by timestamp
+struct csvchunk {
+    QStringList macs;
+    QStringList names;
+    // series[device][column], the columns are csvimporter::COLUMNS
+    QVector<QVector<QList<QPair<int, double>>>> series;
+    int rows = 0;
+    int skipped = 0;
+    // Position in the file after the chunk
+    qint64 position = 0;
+};
+
+// Reads files in the exportCSV layout, mac,name,timestamp and one column per
+// sensor table with "-" for a missing value. Only one chunk of rows is held
+// in memory at a time, so the size of the file does not matter.
+class csvimporter
+{
+public:
+    static const int COLUMN_COUNT = 8;
+    // The sensor tables of the value columns, in the file order
+    static const char* const COLUMNS[COLUMN_COUNT];
+
+    explicit csvimporter(QIODevice* device);
+
+    // Parses up to maxRows rows into the chunk, false at the end of the file
+    bool next(csvchunk &chunk, int maxRows);
+
+private:
+    struct row {
+        int device;
+        int timestamp;
+        quint8 present;
+        double values[COLUMN_COUNT];
+    };
+
+    QIODevice* device;
+    bool parseLine(const QByteArray &line, QHash<QString, int> &devices, csvchunk &chunk, row &parsed);
+};
+
+#endif // CSVIMPORTER_H
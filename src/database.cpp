@@ -17,15 +17,160 @@
 */
 #include "database.h"
 #include "worker.h"
+#include "latencystats.h"
+#include "queryprofiler.h"
+#include "rangesummary.h"
+#include "sqlitebackup.h"
+#include "derivedseries.h"
 #include <QDebug>
 #include <ctime>
 #include <QThread>
 #include <QFile>
+#include <QFileInfo>
 #include <QTextStream>
+#include <QElapsedTimer>
+#include <QSet>
+#include <QRunnable>
+#include <QSemaphore>
 #include <cmath>
+#include <fcntl.h>
+#include <unistd.h>
+
+// How long the latest device readings are kept in memory before written to the devices table
+static const int DEFAULT_DEVICE_FLUSH_INTERVAL_S = 30;
+// Maximum rate of the live reading notifications to QML, in the foreground and in the background
+static const double DEFAULT_NOTIFY_RATE_HZ = 2.0;
+static const double DEFAULT_BACKGROUND_NOTIFY_RATE_HZ = 0.2;
+// Rows newer than this are left out of the incremental export, they may still be incomplete
+static const int EXPORT_SETTLE_S = 60;
+// Rows parsed per CSV import chunk, and the chunks parsed ahead of the writer
+static const int IMPORT_CHUNK_ROWS = 50000;
+static const int IMPORT_CHUNKS_IN_FLIGHT = 2;
+// Pages copied per backup step and the pause after it, for the writer to get the disk
+static const int BACKUP_PAGES_PER_STEP = 256;
+static const int BACKUP_STEP_PAUSE_MS = 20;
+static const char* CSV_HEADER = "mac,name,timestamp,temperature,humidity,air_pressure,pm25,co2,voc,nox,iaqs\n";
+// Rollup levels (bucket length in seconds) and their t-digest compression
+static const int ROLLUP_HOUR = 3600;
+static const int ROLLUP_DAY = 86400;
+static const double ROLLUP_COMPRESSION = 25.0;
+
+static qint64 bucketStart(qint64 timestamp, int level) {
+    return timestamp - ((timestamp % level) + level) % level;
+}
+
+struct sensorTable {
+    const char* name;
+    const char* valueType;
+};
+static const sensorTable SENSOR_TABLES[] = {
+    {"temperature", "REAL"},
+    {"humidity", "REAL"},
+    {"air_pressure", "REAL"},
+    {"pm25", "REAL"},
+    {"co2", "INT"},
+    {"voc", "INT"},
+    {"nox", "INT"},
+    {"iaqs", "INT"}
+};
+
+// Columns of the devices table after id, mac and name
+struct deviceColumn {
+    const char* name;
+    const char* type;
+};
+static const deviceColumn DEVICE_COLUMNS[] = {
+    {"voltage", "REAL"},
+    {"movement", "INT"},
+    {"sync_time", "INT"},
+    {"temperature", "REAL"},
+    {"humidity", "REAL"},
+    {"pressure", "REAL"},
+    {"tx", "REAL"},
+    {"acc_x", "REAL"},
+    {"acc_y", "REAL"},
+    {"acc_z", "REAL"},
+    {"last_obs", "int"},
+    {"meas_seq", "int"},
+    {"pm25", "REAL"},
+    {"co2", "INT"},
+    {"voc", "INT"},
+    {"nox", "INT"},
+    {"calibrating", "INT"},
+    {"iaqs", "INT"}
+};
+
+static QString sensorTableSchema(const QString &create, const QString &valueType) {
+    return create + " ("
+           "device_id INTEGER REFERENCES devices(id),"
+           "timestamp INT,"
+           "value " + valueType + ","
+           "PRIMARY KEY (device_id, timestamp)) WITHOUT ROWID";
+}
+
+// The low bits of user_version are the schema version, see migrateSchema. The
+// high bits flag the data migrations that ran once in the background.
+static const int SCHEMA_VERSION = 4;
+static const int SCHEMA_VERSION_MASK = 0xFFFF;
+// The IAQS of the readings from before ingest-time IAQS is filled in
+static const int IAQS_BACKFILLED_FLAG = 0x10000;
+// Stored batches up to this size are added to the cached plot tiles in place
+static const int TILE_EXTEND_MAX_ROWS = 256;
+// Readings examined per IAQS backfill write task
+static const int IAQS_BACKFILL_CHUNK_ROWS = 5000;
+// Threads for the async queries and plots, each with its own connection
+static const int READER_THREADS = 2;
+// How long a connection waits for a lock before SQLITE_BUSY
+static const int BUSY_TIMEOUT_MS = 5000;
+
+namespace {
+
+// Runs one async query on the reader pool and hands the result back to the GUI thread
+class queryTask : public QRunnable {
+public:
+    queryTask(QObject* receiver, int requestId, const std::function<QVariant()> &query)
+        : receiver(receiver), requestId(requestId), query(query) {}
+
+    void run() override {
+        const QVariant result = query();
+        QMetaObject::invokeMethod(receiver, "deliverQueryResult", Qt::QueuedConnection,
+                                  Q_ARG(int, requestId), Q_ARG(QVariant, result));
+    }
+
+private:
+    QObject* receiver;
+    int requestId;
+    std::function<QVariant()> query;
+};
+
+// Background work on the reader pool without a result, e.g. tile prefetching
+class backgroundTask : public QRunnable {
+public:
+    explicit backgroundTask(const std::function<void()> &work) : work(work) {}
+
+    void run() override {
+        work();
+    }
+
+private:
+    std::function<void()> work;
+};
+
+}
 
+database::database(QObject* parent)
+    : QObject(parent)
+    , notifyRateHz(DEFAULT_NOTIFY_RATE_HZ)
+    , backgroundNotifyRateHz(DEFAULT_BACKGROUND_NOTIFY_RATE_HZ)
+    , plotCache(QStandardPaths::writableLocation(QStandardPaths::AppDataLocation) + "/plotcache")
+{
+    // SKRUUVI_PROFILE_QUERIES=<threshold ms> profiles the statements from the start
+    bool profileQueries = false;
+    const int slowQueryThresholdMs = qEnvironmentVariableIntValue("SKRUUVI_PROFILE_QUERIES", &profileQueries);
+    if (profileQueries) {
+        queryprofiler::setEnabled(true, slowQueryThresholdMs);
+    }
 
-database::database(QObject* parent) : QObject(parent) {
     db = QSqlDatabase::addDatabase("QSQLITE");
 
     // Setup the database path
@@ -44,103 +189,259 @@ database::database(QObject* parent) : QObject(parent) {
     // Open the database
     qDebug() << "Db path: " << dbPath;
     db.setDatabaseName(dbPath);
-    if (!db.open()) {
-        qDebug() << "Could not open database";
+    openConnection(db);
+
+    // A fixed set of connections: this one for the GUI thread, one per reader
+    // thread and the writer. Their threads live as long as the database.
+    readerPool.setMaxThreadCount(READER_THREADS);
+    readerPool.setExpiryTimeout(-1);
+    writerPool.setMaxThreadCount(1);
+    writerPool.setExpiryTimeout(-1);
+    jobPool.setMaxThreadCount(1);
+
+    // Coalesce the device table updates, see queueDeviceUpdate
+    deviceFlushTimer.setSingleShot(true);
+    deviceFlushTimer.setInterval(DEFAULT_DEVICE_FLUSH_INTERVAL_S * 1000);
+    connect(&deviceFlushTimer, &QTimer::timeout, this, &database::flushDeviceUpdates);
+
+    // Coalesce the live reading notifications, see queueNotification
+    notifyTimer.setSingleShot(true);
+    connect(&notifyTimer, &QTimer::timeout, this, &database::publishNotifications);
+
+    // The schema is created or migrated by the writer while QML loads. The IAQS
+    // series of older data is filled in once, in chunks between the other writes.
+    write([this]() {
+        initialize();
+        QMetaObject::invokeMethod(this, "onInitialized", Qt::QueuedConnection);
+        queueIAQSBackfill(backfillRun, -1, 0);
+    });
+}
+
+database::~database() {
+    // Do not lose the latest readings on exit
+    flushDeviceUpdates();
+    // The queued queries and writes still use this object
+    jobCancelled.store(1);
+    jobPool.waitForDone();
+    readerPool.waitForDone();
+    writerPool.waitForDone();
+    closeConnections();
+}
+
+void database::openConnection(QSqlDatabase &connection)
+{
+    // A reader waits this long for the writer instead of failing with SQLITE_BUSY
+    connection.setConnectOptions(QString("QSQLITE_BUSY_TIMEOUT=%1").arg(BUSY_TIMEOUT_MS));
+    if (!connection.open()) {
+        qWarning() << "DB open failed:" << connection.lastError();
+        return;
     }
+    QSqlQuery foreignKeys(connection);
+    queryprofiler::exec(foreignKeys, "PRAGMA foreign_keys = ON");
+}
 
-    // Set the foreign keys pragma on
-    executeQuery("PRAGMA foreign_keys = ON");
+static QString threadConnectionName()
+{
+    return QStringLiteral("skruuvi-%1").arg(reinterpret_cast<quintptr>(QThread::currentThreadId()));
+}
 
-    // Create the tables if not yet created
-    QString createDevicesTableQuery = "CREATE TABLE IF NOT EXISTS devices ("
-                                      "mac VARCHAR(17) PRIMARY KEY UNIQUE,"
-                                      "name TEXT)";
-    executeQuery(createDevicesTableQuery);
-    QString createTemperatureTableQuery = "CREATE TABLE IF NOT EXISTS temperature ("
-                                          "device TEXT REFERENCES devices(mac),"
-                                          "timestamp INT,"
-                                          "value REAL,"
-                                          "PRIMARY KEY (device, timestamp),"
-                                          "FOREIGN KEY (device) REFERENCES devices(mac))";
-    executeQuery(createTemperatureTableQuery);
-    QString createHumidityTableQuery = "CREATE TABLE IF NOT EXISTS humidity ("
-                                       "device TEXT REFERENCES devices(mac),"
-                                       "timestamp INT,"
-                                       "value REAL,"
-                                       "PRIMARY KEY (device, timestamp),"
-                                       "FOREIGN KEY (device) REFERENCES devices(mac))";
-    executeQuery(createHumidityTableQuery);
-    QString createAirPressureTableQuery = "CREATE TABLE IF NOT EXISTS air_pressure ("
-                                          "device TEXT REFERENCES devices(mac),"
-                                          "timestamp INT,"
-                                          "value REAL,"
-                                          "PRIMARY KEY (device, timestamp),"
-                                          "FOREIGN KEY (device) REFERENCES devices(mac))";
-    executeQuery(createAirPressureTableQuery);
-    executeQuery("CREATE TABLE IF NOT EXISTS pm25 ("
-                "device TEXT REFERENCES devices(mac),"
-                "timestamp INT,"
-                "value REAL,"
-                "PRIMARY KEY (device, timestamp))");
-    executeQuery("CREATE TABLE IF NOT EXISTS co2 ("
-                "device TEXT REFERENCES devices(mac),"
-                "timestamp INT,"
-                "value INT,"
-                "PRIMARY KEY (device, timestamp))");
-    executeQuery("CREATE TABLE IF NOT EXISTS voc ("
-                "device TEXT REFERENCES devices(mac),"
-                "timestamp INT,"
-                "value INT,"
-                "PRIMARY KEY (device, timestamp))");
-    executeQuery("CREATE TABLE IF NOT EXISTS nox ("
-                "device TEXT REFERENCES devices(mac),"
-                "timestamp INT,"
-                "value INT,"
-                "PRIMARY KEY (device, timestamp))");
+void database::closeConnectionForCurrentThread()
+{
+    const QString name = threadConnectionName();
+    {
+        // The prepared statements keep the connection in use
+        QMutexLocker locker(&statementCacheMutex);
+        statementCache.remove(name);
+    }
+    if (!QSqlDatabase::contains(name)) {
+        return;
+    }
+    {
+        QSqlDatabase d = QSqlDatabase::database(name, false);
+        d.close();
+    }
+    QSqlDatabase::removeDatabase(name);
+}
 
-    // Colums added after initial release needs to be appended
-    checkAndAddColumn("devices", "voltage", "REAL");
-    checkAndAddColumn("devices", "movement", "INT");
-    checkAndAddColumn("devices", "sync_time", "INT");
-    checkAndAddColumn("devices", "temperature", "REAL");
-    checkAndAddColumn("devices", "humidity", "REAL");
-    checkAndAddColumn("devices", "pressure", "REAL");
-    checkAndAddColumn("devices", "tx", "REAL");
-    checkAndAddColumn("devices", "acc_x", "REAL");
-    checkAndAddColumn("devices", "acc_y", "REAL");
-    checkAndAddColumn("devices", "acc_z", "REAL");
-    checkAndAddColumn("devices", "last_obs", "int");
-    checkAndAddColumn("devices", "meas_seq", "int");
-    checkAndAddColumn("devices", "pm25", "REAL");
-    checkAndAddColumn("devices", "co2", "INT");
-    checkAndAddColumn("devices", "voc", "INT");
-    checkAndAddColumn("devices", "nox", "INT");
-    checkAndAddColumn("devices", "calibrating", "INT");
+void database::closeConnections()
+{
+    writeAndWait([this]() {
+        closeConnectionForCurrentThread();
+    });
+
+    // One task per reader thread: each one closes the connection of its
+    // thread and keeps the thread busy until all of them have run
+    QSemaphore closed;
+    QSemaphore done;
+    for (int i = 0; i < READER_THREADS; ++i) {
+        readerPool.start(new backgroundTask([this, &closed, &done]() {
+            closeConnectionForCurrentThread();
+            closed.release();
+            done.acquire();
+        }));
+    }
+    closed.acquire(READER_THREADS);
+    done.release(READER_THREADS);
+    readerPool.waitForDone();
+
+    {
+        QMutexLocker locker(&statementCacheMutex);
+        statementCache.clear();
+    }
+    const QString name = db.connectionName();
+    db.close();
+    db = QSqlDatabase();
+    QSqlDatabase::removeDatabase(name);
+}
+
+bool database::onWriterThread() const
+{
+    return QThread::currentThread() == writerThread.load();
+}
+
+void database::write(const std::function<void()> &work)
+{
+    writerPool.start(new backgroundTask([this, work]() {
+        writerThread.store(QThread::currentThread());
+        work();
+    }));
+}
+
+void database::writeAndWait(const std::function<void()> &work)
+{
+    if (onWriterThread()) {
+        work();
+        return;
+    }
+    QSemaphore done;
+    write([&work, &done]() {
+        work();
+        done.release();
+    });
+    done.acquire();
+}
+
+void database::initialize()
+{
+    QElapsedTimer timer;
+    timer.start();
+    // Readers keep reading the last commit while the writer is in a transaction.
+    // The mode is stored in the file, synchronous is per connection.
+    QSqlQuery journal(connectionForCurrentThread());
+    if (!queryprofiler::exec(journal, "PRAGMA journal_mode = WAL") || !journal.next()
+            || journal.value(0).toString().toLower() != "wal") {
+        qWarning() << "Could not enable WAL:" << journal.lastError().text();
+    }
+    queryprofiler::finish(journal);
+    executeQuery("PRAGMA synchronous = NORMAL");
+    migrateSchema();
+    loadWatermarks();
+    loadExportMarks();
+    {
+        QMutexLocker locker(&readyMutex);
+        readyFlag.store(1);
+        readyCondition.wakeAll();
+    }
+    qDebug() << "Database ready in" << timer.elapsed() << "ms";
+}
+
+bool database::isReady() const
+{
+    return readyFlag.load() != 0;
+}
+
+void database::waitUntilReady()
+{
+    QMutexLocker locker(&readyMutex);
+    while (!readyFlag.load()) {
+        readyCondition.wait(&readyMutex);
+    }
+}
+
+void database::onInitialized()
+{
+    // Devices seen by the scanner while the schema was not ready yet
+    for (const auto& device : pendingDevices) {
+        addDevice(device.first, device.second);
+    }
+    pendingDevices.clear();
+    emit readyChanged();
 }
 
 QSqlDatabase database::connectionForCurrentThread()
 {
+    // Nothing but the initialisation on the writer touches the database before the schema
+    // is ready. The GUI thread never waits for the writer, its callers check isReady().
+    if (!readyFlag.load() && !onWriterThread() && QThread::currentThread() != this->thread()) {
+        waitUntilReady();
+    }
+
     // If we're in the same thread as the database object, use the existing connection.
     if (QThread::currentThread() == this->thread()) {
         return db;
     }
 
-    // Otherwise create/use a per-thread connection (same file).
-    const QString connName =
-        QStringLiteral("skruuvi-%1").arg(reinterpret_cast<quintptr>(QThread::currentThreadId()));
-
+    // Otherwise the connection of the reader or writer thread (same file)
+    const QString connName = threadConnectionName();
     if (QSqlDatabase::contains(connName)) {
         return QSqlDatabase::database(connName);
     }
 
     QSqlDatabase d = QSqlDatabase::addDatabase("QSQLITE", connName);
     d.setDatabaseName(db.databaseName());
-    if (!d.open()) {
-        qWarning() << "DB open failed:" << d.lastError();
-    }
+    openConnection(d);
     return d;
 }
 
+QSqlQuery database::cachedQuery(const QSqlDatabase &connection, const QString &statement)
+{
+    // Statements are prepared once per connection and reused, so SQLite
+    // does not need to parse and plan the same SQL on every call
+    QMutexLocker locker(&statementCacheMutex);
+    QHash<QString, QSqlQuery> &statements = statementCache[connection.connectionName()];
+    QHash<QString, QSqlQuery>::const_iterator it = statements.constFind(statement);
+    if (it != statements.constEnd()) {
+        statementCacheHits.ref();
+        return it.value();
+    }
+
+    statementCacheMisses.ref();
+    QSqlQuery query(connection);
+    if (!query.prepare(statement)) {
+        qWarning() << "Prepare failed:" << query.lastError().text();
+        return query;
+    }
+    statements.insert(statement, query);
+    return query;
+}
+
+bool database::isSensorTable(const QString &sensor)
+{
+    // Table names can not be bound as parameters, only allow the known ones
+    static const QStringList sensorTables = {"temperature", "humidity", "air_pressure", "pm25", "co2", "voc", "nox", "iaqs"};
+    return sensorTables.contains(sensor);
+}
+
+QVariantMap database::getStatementCacheStats()
+{
+    const int hits = statementCacheHits.load();
+    const int misses = statementCacheMisses.load();
+    int statements = 0;
+    {
+        QMutexLocker locker(&statementCacheMutex);
+        for (auto it = statementCache.constBegin(); it != statementCache.constEnd(); ++it) {
+            statements += it.value().size();
+        }
+    }
+
+    QVariantMap stats;
+    stats["hits"] = hits;
+    stats["misses"] = misses;
+    stats["hitRate"] = (hits + misses) > 0 ? double(hits) / double(hits + misses) : 0.0;
+    stats["statements"] = statements;
+    return stats;
+}
+
 void database::executeQuery(const QString& queryStr) {
     QSqlDatabase d = connectionForCurrentThread();
     if (!d.isOpen()) {
@@ -149,72 +450,513 @@ void database::executeQuery(const QString& queryStr) {
     }
 
     QSqlQuery query(d);
-    if (!query.exec(queryStr)) {
+    if (!queryprofiler::exec(query, queryStr)) {
         qDebug() << "Error executing query:" << query.lastError().text();
     }
 }
 
-void database::checkAndAddColumn(const QString &tableName, const QString &columnName, const QString &columnType) {
-    QSqlQuery query(db);
-    query.exec("PRAGMA table_info(" + tableName + ")");
-    bool columnExists = false;
+int database::userVersion() {
+    QSqlQuery query(connectionForCurrentThread());
+    int version = 0;
+    if (queryprofiler::exec(query, "PRAGMA user_version") && query.next()) {
+        version = query.value(0).toInt();
+    }
+    queryprofiler::finish(query);
+    return version;
+}
+
+int database::schemaVersion() {
+    return userVersion() & SCHEMA_VERSION_MASK;
+}
+
+bool database::executeStatements(const QStringList &statements) {
+    QSqlDatabase d = connectionForCurrentThread();
+    for (const QString &statement : statements) {
+        QSqlQuery query(d);
+        if (!queryprofiler::exec(query, statement)) {
+            qWarning() << "Error executing query:" << query.lastError().text();
+            return false;
+        }
+    }
+    return true;
+}
+
+void database::migrateSchema() {
+    // Migration i takes the schema from version i to i + 1, in the same
+    // transaction as the new PRAGMA user_version
+    typedef bool (database::*migration)();
+    static const migration MIGRATIONS[] = {
+        &database::migrateToVersion1,
+        &database::migrateToVersion2,
+        &database::migrateToVersion3,
+        &database::migrateToVersion4
+    };
+    static_assert(int(sizeof(MIGRATIONS) / sizeof(MIGRATIONS[0])) == SCHEMA_VERSION, "One migration per schema version");
+
+    const int version = schemaVersion();
+    if (version == SCHEMA_VERSION) {
+        return;
+    }
+    if (version > SCHEMA_VERSION) {
+        qWarning() << "Database schema version" << version << "is newer than" << SCHEMA_VERSION;
+        return;
+    }
+    const int flags = userVersion() & ~SCHEMA_VERSION_MASK;
+
+    QElapsedTimer timer;
+    timer.start();
+    if (version == 0) {
+        // Databases from before the integer device ids are converted in place.
+        // The later migrations assume the new tables, so they wait for another try.
+        if (!migrateDeviceIds()) {
+            qWarning() << "Schema migration stopped at version" << version;
+            return;
+        }
+    }
+    QSqlDatabase d = connectionForCurrentThread();
+    for (int step = version; step < SCHEMA_VERSION; ++step) {
+        if (!d.transaction()) {
+            qWarning() << "Transaction start failed:" << d.lastError();
+            return;
+        }
+        if (!(this->*MIGRATIONS[step])()
+                || !executeStatements(QStringList() << QString("PRAGMA user_version = %1").arg((step + 1) | flags))
+                || !d.commit()) {
+            qWarning() << "Schema migration to version" << step + 1 << "failed";
+            d.rollback();
+            return;
+        }
+    }
+    qDebug() << "Schema migrated from version" << version << "to" << SCHEMA_VERSION << "in" << timer.elapsed() << "ms";
+}
+
+bool database::migrateToVersion1() {
+    // The schema of the first versioned release. Older databases have some of
+    // the tables and columns already, the rest is added here.
+    QStringList statements;
+    QStringList deviceColumns;
+    for (const deviceColumn &column : DEVICE_COLUMNS) {
+        deviceColumns << QString(column.name) + " " + column.type;
+    }
+    statements << "CREATE TABLE IF NOT EXISTS devices ("
+                  "id INTEGER PRIMARY KEY,"
+                  "mac VARCHAR(17) UNIQUE NOT NULL,"
+                  "name TEXT, " + deviceColumns.join(", ") + ")";
+    // The sensor tables are keyed by the integer device id and clustered on
+    // (device_id, timestamp), so a range scan reads one contiguous b-tree run.
+    // IAQS is derived from pm25 and co2 at ingest, see backfillIAQS for older data.
+    for (const sensorTable &table : SENSOR_TABLES) {
+        statements << sensorTableSchema("CREATE TABLE IF NOT EXISTS " + QString(table.name), table.valueType);
+    }
+    // Per hour and per day summaries for the range statistics, built on demand
+    statements << "CREATE TABLE IF NOT EXISTS rollups ("
+                  "sensor TEXT,"
+                  "device_id INTEGER REFERENCES devices(id),"
+                  "level INT,"
+                  "bucket INT,"
+                  "count INT,"
+                  "min REAL,"
+                  "max REAL,"
+                  "mean REAL,"
+                  "m2 REAL,"
+                  "digest BLOB,"
+                  "PRIMARY KEY (sensor, device_id, level, bucket))";
+    // High-water marks of the sensor tables, see storeSensorData
+    statements << "CREATE TABLE IF NOT EXISTS watermarks ("
+                  "device_id INTEGER REFERENCES devices(id),"
+                  "sensor TEXT,"
+                  "newest INT,"
+                  "imported_from INT,"
+                  "imported_to INT,"
+                  "PRIMARY KEY (device_id, sensor)) WITHOUT ROWID";
+    // Data stored before the marks existed, the import spans start empty
+    for (const sensorTable &table : SENSOR_TABLES) {
+        statements << QString("INSERT OR IGNORE INTO watermarks (device_id, sensor, newest)"
+                              " SELECT device_id, '%1', MAX(timestamp) FROM %1 GROUP BY device_id").arg(table.name);
+    }
+    if (!executeStatements(statements)) {
+        return false;
+    }
+
+    // Colums added after initial release needs to be appended
+    QSet<QString> existing;
+    QSqlQuery info(connectionForCurrentThread());
+    queryprofiler::exec(info, "PRAGMA table_info(devices)");
+    while (info.next()) {
+        existing.insert(info.value(1).toString());
+    }
+    queryprofiler::finish(info);
+    QStringList alters;
+    for (const deviceColumn &column : DEVICE_COLUMNS) {
+        if (!existing.contains(column.name)) {
+            qDebug() << "Adding column " << column.name << " to table devices";
+            alters << QString("ALTER TABLE devices ADD COLUMN ") + column.name + " " + column.type;
+        }
+    }
+    return executeStatements(alters);
+}
+
+bool database::migrateToVersion2() {
+    // Where the incremental export of each device got to, see exportNewCSV
+    return executeStatements(QStringList() << "CREATE TABLE IF NOT EXISTS export_marks ("
+                                              "device_id INTEGER PRIMARY KEY REFERENCES devices(id),"
+                                              "exported_to INT,"
+                                              "path TEXT,"
+                                              "size INT)");
+}
+
+bool database::migrateToVersion3() {
+    // Readings whose IAQS can not be computed, so the backfill examines each one once
+    return executeStatements(QStringList() << "CREATE TABLE IF NOT EXISTS iaqs_unscored ("
+                                              "device_id INTEGER REFERENCES devices(id),"
+                                              "timestamp INT,"
+                                              "PRIMARY KEY (device_id, timestamp)) WITHOUT ROWID");
+}
+
+bool database::migrateToVersion4() {
+    // Readings stored behind the export mark of their device, see exportNewCSV
+    return executeStatements(QStringList() << "CREATE TABLE IF NOT EXISTS export_pending ("
+                                              "device_id INTEGER REFERENCES devices(id),"
+                                              "timestamp INT,"
+                                              "PRIMARY KEY (device_id, timestamp)) WITHOUT ROWID");
+}
+
+bool database::migrateDeviceIds() {
+    // Before the integer ids the devices table was keyed by the MAC, and every
+    // sensor row and its primary key repeated the 17 character string
+    QSqlDatabase d = connectionForCurrentThread();
+    QStringList columns;
+    QStringList extraColumns;
+    bool hasId = false;
+    QSqlQuery info(d);
+    queryprofiler::exec(info, "PRAGMA table_info(devices)");
+    while (info.next()) {
+        const QString column = info.value(1).toString();
+        if (column == "id") {
+            hasId = true;
+        } else if (column != "mac" && column != "name") {
+            extraColumns << column + " " + info.value(2).toString();
+        }
+        columns << column;
+    }
+    queryprofiler::finish(info);
+    if (columns.isEmpty() || hasId) {
+        // New or already migrated database
+        return true;
+    }
+
+    qDebug() << "Migrating the database to integer device ids";
+    QElapsedTimer timer;
+    timer.start();
+    const qint64 sizeBefore = QFileInfo(d.databaseName()).size();
+
+    QStringList statements;
+    statements << "CREATE TABLE devices_new (id INTEGER PRIMARY KEY, mac VARCHAR(17) UNIQUE NOT NULL, name TEXT"
+                  + (extraColumns.isEmpty() ? QString() : ", " + extraColumns.join(", ")) + ")"
+               << "INSERT INTO devices_new (" + columns.join(", ") + ") SELECT " + columns.join(", ") + " FROM devices ORDER BY rowid";
+    for (const sensorTable &table : SENSOR_TABLES) {
+        const QString name = table.name;
+        QSqlQuery exists(d);
+        queryprofiler::exec(exists, "SELECT 1 FROM sqlite_master WHERE type = 'table' AND name = '" + name + "'");
+        const bool found = exists.next();
+        queryprofiler::finish(exists);
+        if (!found) {
+            continue;
+        }
+        // Readings of devices that are missing from the devices table are kept,
+        // the devices are added back without a name
+        statements << "INSERT OR IGNORE INTO devices_new (mac) SELECT DISTINCT device FROM " + name +
+                      " WHERE device IS NOT NULL"
+                   << sensorTableSchema("CREATE TABLE " + name + "_new", table.valueType)
+                   << "INSERT INTO " + name + "_new (device_id, timestamp, value)"
+                      " SELECT devices_new.id, " + name + ".timestamp, " + name + ".value FROM " + name +
+                      " LEFT JOIN devices_new ON devices_new.mac = " + name + ".device"
+                   << "DROP TABLE " + name
+                   << "ALTER TABLE " + name + "_new RENAME TO " + name;
+    }
+    // The rollups are only a cache, the next range queries rebuild them
+    statements << "DROP TABLE IF EXISTS rollups"
+               << "DROP TABLE devices"
+               << "ALTER TABLE devices_new RENAME TO devices";
+
+    // The old tables reference devices(mac), so the foreign keys are checked only after the swap
+    executeQuery("PRAGMA foreign_keys = OFF");
+    bool ok = d.transaction();
+    if (!ok) {
+        qWarning() << "Transaction start failed:" << d.lastError();
+    }
+    for (int i = 0; ok && i < statements.size(); ++i) {
+        QSqlQuery query(d);
+        if (!queryprofiler::exec(query, statements[i])) {
+            qWarning() << "Device id migration failed:" << query.lastError().text();
+            ok = false;
+        }
+    }
+    if (ok && !d.commit()) {
+        qWarning() << "Commit failed:" << d.lastError();
+        ok = false;
+    }
+    if (!ok) {
+        d.rollback();
+    }
+    QSqlQuery check(d);
+    if (queryprofiler::exec(check, "PRAGMA foreign_key_check")) {
+        int violations = 0;
+        while (check.next()) {
+            ++violations;
+        }
+        if (violations > 0) {
+            qWarning() << "Device id migration left" << violations << "rows with a missing device";
+        }
+    }
+    queryprofiler::finish(check);
+    executeQuery("PRAGMA foreign_keys = ON");
+    if (!ok) {
+        return false;
+    }
+    qDebug() << "Device id migration took" << timer.elapsed() << "ms";
+
+    // The space of the old tables is given back to the file system after the
+    // database is ready, behind the writes queued by then
+    write([this, sizeBefore]() {
+        QElapsedTimer vacuumTimer;
+        vacuumTimer.start();
+        executeQuery("VACUUM");
+        qDebug() << "VACUUM took" << vacuumTimer.elapsed() << "ms, database size" << sizeBefore << "->"
+                 << QFileInfo(connectionForCurrentThread().databaseName()).size() << "bytes";
+    });
+    return true;
+}
+
+void database::loadWatermarks() {
+    QSqlQuery query(connectionForCurrentThread());
+    if (!queryprofiler::exec(query, "SELECT device_id, sensor, newest, imported_from, imported_to FROM watermarks")) {
+        qDebug() << "Error loading the watermarks:" << query.lastError().text();
+        return;
+    }
+    QMutexLocker locker(&watermarkMutex);
+    while (query.next()) {
+        watermark mark;
+        mark.newest = query.value(2).toInt();
+        if (!query.value(3).isNull() && !query.value(4).isNull()) {
+            mark.importedFrom = query.value(3).toInt();
+            mark.importedTo = query.value(4).toInt();
+        }
+        watermarks.insert(qMakePair(query.value(0).toInt(), query.value(1).toString()), mark);
+    }
+    queryprofiler::finish(query);
+}
+
+void database::loadExportMarks() {
+    QSqlQuery query(connectionForCurrentThread());
+    if (!queryprofiler::exec(query, "SELECT device_id, exported_to FROM export_marks")) {
+        qDebug() << "Error loading the export marks:" << query.lastError().text();
+        return;
+    }
     while (query.next()) {
-        if (query.value(1).toString() == columnName) {
-            columnExists = true;
-            break;
+        exportMarks.insert(query.value(0).toInt(), query.value(1).toInt());
+    }
+    queryprofiler::finish(query);
+}
+
+int database::deviceId(const QString &deviceAddress) {
+    {
+        QMutexLocker locker(&deviceIdMutex);
+        QHash<QString, int>::const_iterator it = deviceIds.constFind(deviceAddress);
+        if (it != deviceIds.constEnd()) {
+            return it.value();
+        }
+    }
+
+    QSqlQuery query = cachedQuery(connectionForCurrentThread(), "SELECT id FROM devices WHERE mac = ?");
+    query.bindValue(0, deviceAddress);
+    int id = -1; // Unknown devices are not cached, they may be added later
+    if (queryprofiler::exec(query)) {
+        if (query.next()) {
+            id = query.value(0).toInt();
         }
+    } else {
+        qDebug() << "Error executing device id query:" << query.lastError().text();
     }
-    if (!columnExists) {
-        qDebug() << "Adding column " << columnName << " to table " << tableName;
-        QString alterTableQuery = "ALTER TABLE " + tableName + " ADD COLUMN " + columnName + " " + columnType;
-        executeQuery(alterTableQuery);
+    queryprofiler::finish(query);
+
+    if (id >= 0) {
+        QMutexLocker locker(&deviceIdMutex);
+        deviceIds.insert(deviceAddress, id);
     }
+    return id;
 }
 
 void database::addDevice(const QString &deviceAddress, const QString &deviceName) {
+    if (!isReady()) {
+        // Added once the schema is ready, see onInitialized
+        pendingDevices.append(qMakePair(deviceAddress, deviceName));
+        return;
+    }
+    if (!onWriterThread()) {
+        write([=]() {
+            addDevice(deviceAddress, deviceName);
+        });
+        return;
+    }
     qDebug() << "Adding device to db: " << deviceAddress << " " << deviceName;
-    QString createDeviceQuery = "INSERT OR IGNORE INTO devices (mac, name) "
-                                "VALUES ('" + deviceAddress + "', '" + deviceName + "')";
-    executeQuery(createDeviceQuery);
+    QSqlQuery query = cachedQuery(connectionForCurrentThread(), "INSERT OR IGNORE INTO devices (mac, name) VALUES (?, ?)");
+    query.bindValue(0, deviceAddress);
+    query.bindValue(1, deviceName);
+    if (!queryprofiler::exec(query)) {
+        qDebug() << "Error adding device:" << query.lastError().text();
+    }
 }
 
 void database::updateDevice(const QString &mac, double temperature, double humidity, double pressure, double accX, double accY,
                             double accZ, double voltage, double txPower, int movementCounter, int measurementSequenceNumber, int timestamp)
 {
-    QSqlQuery query(db);
-    query.prepare(
-        "UPDATE devices SET "
-        "temperature = :temperature, "
-        "humidity = :humidity, "
-        "pressure = :pressure, "
-        "acc_x = :accX, "
-        "acc_y = :accY, "
-        "acc_z = :accZ, "
-        "voltage = :voltage, "
-        "tx = :txPower, "
-        "movement = :movementCounter, "
-        "meas_seq = :measurementSequenceNumber, "
-        "last_obs = :timestamp "
-        "WHERE mac = :mac"
-    );
-
-    query.bindValue(":temperature", temperature);
-    query.bindValue(":humidity", humidity);
-    query.bindValue(":pressure", pressure);
-    query.bindValue(":accX", accX);
-    query.bindValue(":accY", accY);
-    query.bindValue(":accZ", accZ);
-    query.bindValue(":voltage", voltage);
-    query.bindValue(":txPower", txPower);
-    query.bindValue(":movementCounter", movementCounter);
-    query.bindValue(":measurementSequenceNumber", measurementSequenceNumber);
-    query.bindValue(":timestamp", timestamp);
-
-    query.bindValue(":mac", mac);
-
-    if (!query.exec()) {
-        qDebug() << "Error updating manufacturerdata to deviceDB:" << query.lastError().text();
+    QVariantMap columns;
+    columns["temperature"] = temperature;
+    columns["humidity"] = humidity;
+    columns["pressure"] = pressure;
+    columns["acc_x"] = accX;
+    columns["acc_y"] = accY;
+    columns["acc_z"] = accZ;
+    columns["voltage"] = voltage;
+    columns["tx"] = txPower;
+    columns["movement"] = movementCounter;
+    columns["meas_seq"] = measurementSequenceNumber;
+    columns["last_obs"] = timestamp;
+    queueDeviceUpdate(mac, columns);
+}
+
+void database::queueDeviceUpdate(const QString &mac, const QVariantMap &columns)
+{
+    // Only the latest values matter, so overwrite the pending ones instead of
+    // writing every advertisement to the devices table
+    QVariantMap &pending = pendingDeviceUpdates[mac];
+    for (auto it = columns.constBegin(); it != columns.constEnd(); ++it) {
+        pending.insert(it.key(), it.value());
+    }
+    if (!deviceFlushTimer.isActive()) {
+        deviceFlushTimer.start();
+    }
+}
+
+void database::flushDeviceUpdates()
+{
+    deviceFlushTimer.stop();
+    if (pendingDeviceUpdates.isEmpty()) {
+        return;
+    }
+    const QHash<QString, QVariantMap> updates = pendingDeviceUpdates;
+    pendingDeviceUpdates.clear();
+    write([this, updates]() {
+        writeDeviceUpdates(updates);
+    });
+}
+
+void database::writeDeviceUpdates(const QHash<QString, QVariantMap> &updates)
+{
+    QSqlDatabase d = connectionForCurrentThread();
+    if (!d.isOpen()) {
+        qDebug() << "DB not open:" << d.lastError();
+        return;
+    }
+    if (!d.transaction()) {
+        qWarning() << "Transaction start failed:" << d.lastError();
+        return;
+    }
+
+    for (auto it = updates.constBegin(); it != updates.constEnd(); ++it) {
+        const QVariantMap &columns = it.value();
+        QStringList assignments;
+        for (auto c = columns.constBegin(); c != columns.constEnd(); ++c) {
+            assignments << c.key() + " = :" + c.key();
+        }
+
+        QSqlQuery query = cachedQuery(d, "UPDATE devices SET " + assignments.join(", ") + " WHERE mac = :mac");
+        for (auto c = columns.constBegin(); c != columns.constEnd(); ++c) {
+            query.bindValue(":" + c.key(), c.value());
+        }
+        query.bindValue(":mac", it.key());
+        if (!queryprofiler::exec(query)) {
+            qDebug() << "Error updating manufacturerdata to deviceDB:" << query.lastError().text();
+        }
+    }
+
+    if (!d.commit()) {
+        qWarning() << "Commit failed:" << d.lastError();
+        d.rollback();
+    }
+}
+
+void database::setDeviceFlushInterval(int seconds)
+{
+    deviceFlushTimer.setInterval(qMax(1, seconds) * 1000);
+}
+
+void database::queueNotification(const QString &mac, const QVariantMap &values)
+{
+    // Only the latest reading of a device is shown, the older pending one is replaced
+    QHash<QString, QVariantMap>::iterator it = pendingNotifications.find(mac);
+    if (it != pendingNotifications.end()) {
+        latencystats::increment(latencystats::UiUpdatesCoalesced);
+        it.value() = values;
+    } else {
+        pendingNotifications.insert(mac, values);
+    }
+    scheduleNotifications();
+}
+
+void database::scheduleNotifications()
+{
+    const double rate = applicationActive ? notifyRateHz : backgroundNotifyRateHz;
+    if (notifyTimer.isActive() || pendingNotifications.isEmpty() || rate <= 0.0) {
+        return;
+    }
+    // Published right away if the previous batch is older than the interval
+    const qint64 intervalMs = qint64(1000.0 / rate);
+    const qint64 sinceLastMs = lastNotify.isValid() ? lastNotify.elapsed() : intervalMs;
+    notifyTimer.start(int(qBound<qint64>(0, intervalMs - sinceLastMs, intervalMs)));
+}
+
+void database::publishNotifications()
+{
+    if (pendingNotifications.isEmpty()) {
+        return;
+    }
+    QVariantList changes;
+    for (auto it = pendingNotifications.constBegin(); it != pendingNotifications.constEnd(); ++it) {
+        QVariantMap change = it.value();
+        change["mac"] = it.key();
+        changes.append(change);
+    }
+    pendingNotifications.clear();
+    lastNotify.start();
+
+    latencystats::increment(latencystats::UiNotifications);
+    latencystats::increment(latencystats::UiHandlerCalls, receivers(SIGNAL(devicesUpdated(QVariantList))));
+    latencyscope qmlScope(latencystats::QmlSignal);
+    emit devicesUpdated(changes);
+}
+
+void database::setNotificationRates(double activeHz, double backgroundHz)
+{
+    notifyRateHz = activeHz;
+    backgroundNotifyRateHz = backgroundHz;
+    notifyTimer.stop();
+    scheduleNotifications();
+}
+
+void database::setApplicationActive(bool active)
+{
+    if (applicationActive == active) {
+        return;
+    }
+    applicationActive = active;
+    notifyTimer.stop();
+    if (active) {
+        // Show the readings collected in the background without waiting
+        publishNotifications();
     }
+    scheduleNotifications();
 }
 
 double database::calculateIAQS(double pm25, double co2){
@@ -300,67 +1042,330 @@ QVariantList database::calculateIAQSList(const QVariantList &pm25Data,
     return result;
 }
 
+int database::backfillIAQS(int &deviceCursor, int &timestampCursor, int maxRows)
+{
+    // Readings with both PM2.5 and CO2 but no IAQS, e.g. stored before the iaqs table existed.
+    // The cursor is the last row examined, so every chunk continues where the previous stopped.
+    QSqlDatabase d = connectionForCurrentThread();
+    QSqlQuery query = cachedQuery(d,
+                                  "SELECT pm25.device_id, devices.mac, pm25.timestamp, pm25.value, co2.value FROM pm25"
+                                  " JOIN devices ON devices.id = pm25.device_id"
+                                  " JOIN co2 ON co2.device_id = pm25.device_id AND co2.timestamp = pm25.timestamp"
+                                  " LEFT JOIN iaqs ON iaqs.device_id = pm25.device_id AND iaqs.timestamp = pm25.timestamp"
+                                  " LEFT JOIN iaqs_unscored ON iaqs_unscored.device_id = pm25.device_id"
+                                  " AND iaqs_unscored.timestamp = pm25.timestamp"
+                                  " WHERE iaqs.device_id IS NULL AND iaqs_unscored.device_id IS NULL"
+                                  " AND (pm25.device_id > ? OR (pm25.device_id = ? AND pm25.timestamp > ?))"
+                                  " ORDER BY pm25.device_id, pm25.timestamp LIMIT ?");
+    query.bindValue(0, deviceCursor);
+    query.bindValue(1, deviceCursor);
+    query.bindValue(2, timestampCursor);
+    query.bindValue(3, maxRows);
+    QHash<QString, QList<QPair<int, double>>> missing;
+    QVariantList unscoredDevices, unscoredTimestamps;
+    int examined = 0;
+    if (queryprofiler::exec(query)) {
+        while (query.next()) {
+            deviceCursor = query.value(0).toInt();
+            timestampCursor = query.value(2).toInt();
+            ++examined;
+            const double iaqs = calculateIAQS(query.value(3).toDouble(), query.value(4).toDouble());
+            if (!std::isnan(iaqs)) {
+                missing[query.value(1).toString()].append(qMakePair(timestampCursor, iaqs));
+            } else {
+                unscoredDevices << deviceCursor;
+                unscoredTimestamps << timestampCursor;
+            }
+        }
+    } else {
+        qDebug() << "Error executing IAQS backfill query:" << query.lastError().text();
+    }
+    queryprofiler::finish(query);
+
+    for (auto it = missing.constBegin(); it != missing.constEnd(); ++it) {
+        storeSensorData(it.key(), "iaqs", it.value(), 0, -1);
+    }
+    if (!unscoredDevices.isEmpty()) {
+        QSqlQuery unscored = cachedQuery(d, "INSERT OR IGNORE INTO iaqs_unscored (device_id, timestamp) VALUES (?, ?)");
+        unscored.bindValue(0, unscoredDevices);
+        unscored.bindValue(1, unscoredTimestamps);
+        if (!queryprofiler::execBatch(unscored)) {
+            qWarning() << "execBatch failed:" << unscored.lastError();
+        }
+    }
+    return examined;
+}
+
+void database::queueIAQSBackfill(int run, int deviceCursor, int timestampCursor)
+{
+    write([this, run, deviceCursor, timestampCursor]() {
+        // Done once per database, a restore starts a new run
+        const int version = userVersion();
+        if (run != backfillRun || (version & SCHEMA_VERSION_MASK) != SCHEMA_VERSION || (version & IAQS_BACKFILLED_FLAG)) {
+            return;
+        }
+        int device = deviceCursor;
+        int timestamp = timestampCursor;
+        const int examined = backfillIAQS(device, timestamp, IAQS_BACKFILL_CHUNK_ROWS);
+        if (examined > 0) {
+            qDebug() << "Backfilled IAQS for" << examined << "readings";
+        }
+        // The next chunk queues behind the writes that arrived meanwhile
+        if (examined == IAQS_BACKFILL_CHUNK_ROWS) {
+            queueIAQSBackfill(run, device, timestamp);
+        } else {
+            executeStatements(QStringList() << QString("PRAGMA user_version = %1").arg(version | IAQS_BACKFILLED_FLAG));
+        }
+    });
+}
+
 void database::updateRuuviAir(const QString &mac, double temperature, double humidity, double pressure, double pm25,
-                              int co2, int voc, int nox, int calibrating, int sequence, int timestamp)
-{
-    QSqlQuery query(db);
-    query.prepare(
-        "UPDATE devices SET "
-        "temperature = :temperature, "
-        "humidity = :humidity, "
-        "pressure = :pressure, "
-        "pm25 = :pm25, "
-        "co2 = :co2, "
-        "voc = :voc, "
-        "nox = :nox, "
-        "calibrating = :calibrating, "
-        "meas_seq = :sequence, "
-        "last_obs = :timestamp "
-        "WHERE mac = :mac"
-    );
-
-    query.bindValue(":temperature", temperature);
-    query.bindValue(":humidity", humidity);
-    query.bindValue(":pressure", pressure);
-    query.bindValue(":pm25", pm25);
-    query.bindValue(":co2", co2);
-    query.bindValue(":voc", voc);
-    query.bindValue(":nox", nox);
-    query.bindValue(":calibrating", calibrating);
-    query.bindValue(":sequence", sequence);
-    query.bindValue(":timestamp", timestamp);
-    query.bindValue(":mac", mac);
-
-    if (!query.exec())
-        qWarning() << "Error updating Ruuvi Air device data:" << query.lastError().text();
+                              int co2, int voc, int nox, double iaqs, int calibrating, int sequence, int timestamp)
+{
+    QVariantMap columns;
+    columns["temperature"] = temperature;
+    columns["humidity"] = humidity;
+    columns["pressure"] = pressure;
+    columns["pm25"] = pm25;
+    columns["co2"] = co2;
+    columns["voc"] = voc;
+    columns["nox"] = nox;
+    columns["iaqs"] = std::isnan(iaqs) ? QVariant() : QVariant(iaqs);
+    columns["calibrating"] = calibrating;
+    columns["meas_seq"] = sequence;
+    columns["last_obs"] = timestamp;
+    queueDeviceUpdate(mac, columns);
 }
 
 void database::setLastSync(const QString& deviceAddress, const QString& deviceName, int timestamp) {
+    if (!onWriterThread()) {
+        write([=]() {
+            setLastSync(deviceAddress, deviceName, timestamp);
+        });
+        return;
+    }
     addDevice(deviceAddress, deviceName);
-    QString updateQuery = "UPDATE devices SET sync_time = " + QString::number(timestamp) +
-                          " WHERE mac = '" + deviceAddress + "'";
-    executeQuery(updateQuery);
+    QSqlQuery query = cachedQuery(connectionForCurrentThread(), "UPDATE devices SET sync_time = ? WHERE mac = ?");
+    query.bindValue(0, timestamp);
+    query.bindValue(1, deviceAddress);
+    if (!queryprofiler::exec(query)) {
+        qDebug() << "Error updating sync time:" << query.lastError().text();
+    }
 }
 
 void database::inputRawData(QString deviceAddress, QString deviceName, const QVariantList& data) {
-    // Create a QThread to run the function in a separate thread
-    QThread* thread = new QThread(this);
-    // Create a worker object that will handle the execution of the function
-    worker* workerObj = new worker(this, deviceAddress, deviceName, data);
-    workerObj->moveToThread(thread);
-    // Connect signals
-    connect(thread, &QThread::started, workerObj, &worker::inputRawData);
-    connect(workerObj, &worker::inputFinished, this, &database::inputFinished);
-    connect(workerObj, &worker::inputFinished, thread, &QThread::quit);
-    connect(workerObj, &worker::inputProgress, this, &database::inputProgress);
-    // Start the thread
-    thread->start();
+    // Parsed and stored on the writer thread, the progress is queued to the GUI thread
+    write([=]() {
+        worker workerObj(this, deviceAddress, deviceName, data);
+        connect(&workerObj, &worker::inputFinished, this, &database::inputFinished);
+        connect(&workerObj, &worker::inputProgress, this, &database::inputProgress);
+        workerObj.inputRawData();
+    });
 }
 
-void database::inputManufacturerData(const QString &deviceAddress, const std::array<uint8_t, 24> &manufacturerData) {
-    int dataFormat = manufacturerData[0];
-    int timestamp = QDateTime::currentDateTime().toTime_t();
-    if (dataFormat == 5) {
+QVariantMap database::importCSV(const QString &path) {
+    QVariantMap result;
+    if (onWriterThread()) {
+        qWarning() << "importCSV would wait for its own thread";
+        return result;
+    }
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly)) {
+        qWarning() << "Error opening file:" << file.errorString();
+        return result;
+    }
+    waitUntilReady();
+    qDebug() << "Importing" << path;
+    QElapsedTimer timer;
+    timer.start();
+
+    // The next chunk is parsed and sorted while the writer stores the previous
+    // one. The semaphore keeps the memory bounded whatever the file size.
+    csvimporter importer(&file);
+    QSemaphore freeChunks(IMPORT_CHUNKS_IN_FLIGHT);
+    const qint64 totalBytes = file.size();
+    qint64 stored = 0;
+    int skipped = 0;
+    csvchunk chunk;
+    while (!jobCancelled.load() && importer.next(chunk, IMPORT_CHUNK_ROWS)) {
+        skipped += chunk.skipped;
+        freeChunks.acquire();
+        write([this, chunk, totalBytes, &stored, &timer, &freeChunks]() {
+            for (int device = 0; device < chunk.macs.size(); ++device) {
+                if (deviceId(chunk.macs[device]) < 0) {
+                    addDevice(chunk.macs[device], chunk.names[device]);
+                }
+                // One transaction per sensor of the device, up to a chunk of rows each
+                for (int column = 0; column < csvimporter::COLUMN_COUNT; ++column) {
+                    storeSensorData(chunk.macs[device], csvimporter::COLUMNS[column], chunk.series[device][column], 0, -1);
+                }
+            }
+            stored += chunk.rows;
+            const double seconds = timer.nsecsElapsed() / 1e9;
+            emit csvImportProgress(chunk.position, totalBytes, stored, seconds > 0 ? stored / seconds : 0.0);
+            freeChunks.release();
+        });
+    }
+    // The queued chunks still refer to the locals
+    freeChunks.acquire(IMPORT_CHUNKS_IN_FLIGHT);
+
+    const double seconds = timer.nsecsElapsed() / 1e9;
+    result["rows"] = stored;
+    result["skipped"] = skipped;
+    result["seconds"] = seconds;
+    result["rowsPerSecond"] = seconds > 0 ? stored / seconds : 0.0;
+    result["cancelled"] = jobCancelled.load() != 0;
+    qDebug() << "Imported" << stored << "rows in" << seconds << "s," << skipped << "lines skipped";
+    return result;
+}
+
+void database::importCSVAsync(const QString &path) {
+    jobCancelled.store(0);
+    jobPool.start(new backgroundTask([=]() {
+        emit csvImportFinished(importCSV(path));
+    }));
+}
+
+void database::cancelJob() {
+    jobCancelled.store(1);
+}
+
+QVariantMap database::backupDatabase(const QString &path) {
+    QString backupPath = path;
+    if (backupPath.isEmpty()) {
+        std::time_t currentTimestamp = std::time(nullptr);
+        char timeStr[18];
+        std::strftime(timeStr, sizeof(timeStr), "%d-%m-%y-%H-%M-%S", std::localtime(&currentTimestamp));
+        const QString backupFolder = QStandardPaths::writableLocation(QStandardPaths::DocumentsLocation) + "/skruuvi-backups";
+        QDir().mkpath(backupFolder);
+        backupPath = backupFolder + "/ruuviData_" + timeStr + ".sqlite";
+    }
+    waitUntilReady();
+    qDebug() << "Backing up the database to" << backupPath;
+    const QVariantMap result = sqlitebackup::copy(db.databaseName(), backupPath, BACKUP_PAGES_PER_STEP, BACKUP_STEP_PAUSE_MS,
+                                                  [this](int remaining, int total) -> bool {
+        emit backupProgress(remaining, total);
+        return !jobCancelled.load();
+    });
+    qDebug() << "Backup finished:" << result;
+    return result;
+}
+
+void database::backupAsync(const QString &path) {
+    jobCancelled.store(0);
+    jobPool.start(new backgroundTask([=]() {
+        emit backupFinished(backupDatabase(path));
+    }));
+}
+
+void database::restoreBackup(const QString &path) {
+    // The pending device updates would otherwise be written over the restored rows
+    flushDeviceUpdates();
+    write([=]() {
+        emit restoreFinished(restoreFrom(path));
+    });
+}
+
+QSet<QString> database::deviceMacs() {
+    QSet<QString> macs;
+    QSqlQuery query(connectionForCurrentThread());
+    if (queryprofiler::exec(query, "SELECT mac FROM devices")) {
+        while (query.next()) {
+            macs.insert(query.value(0).toString());
+        }
+    }
+    queryprofiler::finish(query);
+    return macs;
+}
+
+bool database::isRestorable(const QString &path) {
+    // The integrity is checked by sqlitebackup::restore, this checks that the file
+    // is a Skruuvi database this version can migrate
+    const QString name = "restore-check";
+    bool valid = false;
+    {
+        QSqlDatabase backup = QSqlDatabase::addDatabase("QSQLITE", name);
+        backup.setDatabaseName(path);
+        backup.setConnectOptions("QSQLITE_OPEN_READONLY");
+        if (!backup.open()) {
+            qWarning() << "Could not open the backup:" << backup.lastError().text();
+        } else {
+            int version = -1;
+            QSqlQuery query(backup);
+            if (queryprofiler::exec(query, "PRAGMA user_version") && query.next()) {
+                version = query.value(0).toInt() & SCHEMA_VERSION_MASK;
+            }
+            queryprofiler::finish(query);
+            // Databases from before the versioning only had the first tables
+            const QStringList tables = backup.tables();
+            QStringList expected = QStringList() << "devices" << "temperature" << "humidity" << "air_pressure";
+            if (version >= 1) {
+                for (const sensorTable &table : SENSOR_TABLES) {
+                    expected << table.name;
+                }
+            }
+            QStringList missing;
+            for (const QString &table : expected) {
+                if (!tables.contains(table)) {
+                    missing << table;
+                }
+            }
+            if (version < 0 || version > SCHEMA_VERSION) {
+                qWarning() << "Backup" << path << "has schema version" << version << "but this version reads up to" << SCHEMA_VERSION;
+            } else if (!missing.isEmpty()) {
+                qWarning() << "Backup" << path << "is missing the tables" << missing;
+            } else {
+                valid = true;
+            }
+            backup.close();
+        }
+    }
+    QSqlDatabase::removeDatabase(name);
+    return valid;
+}
+
+bool database::restoreFrom(const QString &path) {
+    qDebug() << "Restoring the database from" << path;
+    QSet<QString> macs = deviceMacs();
+    if (!isRestorable(path) || !sqlitebackup::restore(connectionForCurrentThread(), path)) {
+        return false;
+    }
+    // The backup may be from an older version of the app
+    migrateSchema();
+    queueIAQSBackfill(++backfillRun, -1, 0);
+
+    // Everything derived from the old rows is dropped and read again
+    macs += deviceMacs();
+    for (const QString &mac : macs) {
+        plotCache.removeDevice(mac);
+        plotTiles.removeDevice(mac);
+    }
+    {
+        QMutexLocker locker(&deviceIdMutex);
+        deviceIds.clear();
+    }
+    {
+        QMutexLocker locker(&watermarkMutex);
+        watermarks.clear();
+    }
+    loadWatermarks();
+    exportMarks.clear();
+    loadExportMarks();
+    qDebug() << "Restored the database from" << path;
+    return true;
+}
+
+void database::inputManufacturerData(const QString &deviceAddress, const std::array<uint8_t, 24> &manufacturerData) {
+    if (!isReady()) {
+        // Advertisements repeat every few seconds, the first ones are not worth blocking the startup for
+        return;
+    }
+    latencyscope ingestScope(latencystats::IngestTotal);
+    latencystats::increment(latencystats::Advertisements);
+    const qint64 decodeStart = latencystats::now();
+    int dataFormat = manufacturerData[0];
+    int timestamp = QDateTime::currentDateTime().toTime_t();
+    if (dataFormat == 5) {
         // Documentation for DF5 is at https://docs.ruuvi.com/communication/bluetooth-advertisements/data-format-5-rawv2
         int16_t temperatureData = (manufacturerData[1] << 8) | manufacturerData[2];
         float temperature = static_cast<float>(temperatureData) * 0.005;
@@ -382,21 +1387,35 @@ void database::inputManufacturerData(const QString &deviceAddress, const std::ar
         char macAddress[18];
         sprintf(macAddress, "%02X:%02X:%02X:%02X:%02X:%02X",
                 manufacturerData[18], manufacturerData[19], manufacturerData[20], manufacturerData[21], manufacturerData[22], manufacturerData[23]);
+        latencystats::record(latencystats::DecodeAdvertisement, latencystats::now() - decodeStart);
 
         // Update the device database with updateDevice
         updateDevice(macAddress, temperature, humidity, pressure, accX, accY, accZ, battery, txPower, movementCounter, measurementSequenceNumber, timestamp);
 
         // Send to database
-        insertSensorData(macAddress, "temperature", {qMakePair(timestamp, temperature)});
+        storeLiveReading(macAddress, "temperature", timestamp, temperature);
         if (humidityData != 0xFFFF) {
-            insertSensorData(macAddress, "humidity", {qMakePair(timestamp, humidity)});
+            storeLiveReading(macAddress, "humidity", timestamp, humidity);
         }
         if (pressureData != 0xFFFF) {
-            insertSensorData(macAddress, "air_pressure", {qMakePair(timestamp, pressure)});
+            storeLiveReading(macAddress, "air_pressure", timestamp, pressure);
         }
 
-        // Emit signal with new readings
-        emit deviceDataUpdated(macAddress, temperature, humidity, pressure, accX, accY, accZ, battery, txPower, movementCounter, measurementSequenceNumber, timestamp);
+        // Show the new readings
+        QVariantMap values;
+        values["air"] = false;
+        values["temperature"] = temperature;
+        values["humidity"] = humidity;
+        values["pressure"] = pressure;
+        values["accX"] = accX;
+        values["accY"] = accY;
+        values["accZ"] = accZ;
+        values["voltage"] = battery;
+        values["txPower"] = txPower;
+        values["movementCounter"] = movementCounter;
+        values["measurementSequenceNumber"] = measurementSequenceNumber;
+        values["timestamp"] = timestamp;
+        queueNotification(macAddress, values);
     }
     else if (dataFormat == 6) {
         // Documentation for DF6 is at https://docs.ruuvi.com/communication/bluetooth-advertisements/data-format-6
@@ -422,40 +1441,59 @@ void database::inputManufacturerData(const QString &deviceAddress, const std::ar
         int voc = (vocHi << 1) | ((flags >> 6) & 1);
         int nox = (noxHi << 1) | ((flags >> 7) & 1);
         bool calibrationInProgress = (flags & 0x01);
+        // IAQS is stored as its own series, only when both inputs are valid
+        const bool hasIAQS = pmRaw != 0xFFFF && co2Raw != 0xFFFF;
+        double iaqs = calculateIAQS(pm25, co2);
+        latencystats::record(latencystats::DecodeAdvertisement, latencystats::now() - decodeStart);
 
         // Update device db
-        updateRuuviAir(deviceAddress, temperature, humidity, pressure, pm25, co2, voc, nox, calibrationInProgress, sequence, timestamp);
+        updateRuuviAir(deviceAddress, temperature, humidity, pressure, pm25, co2, voc, nox,
+                       hasIAQS ? iaqs : std::numeric_limits<double>::quiet_NaN(), calibrationInProgress, sequence, timestamp);
 
         // Send to database
         if (tRaw != 0x7FFF) {
-            insertSensorData(deviceAddress, "temperature", {{timestamp, temperature}});
+            storeLiveReading(deviceAddress, "temperature", timestamp, temperature);
         }
         if (hRaw != 0xFFFF) {
-            insertSensorData(deviceAddress, "humidity", {{timestamp, humidity}});
+            storeLiveReading(deviceAddress, "humidity", timestamp, humidity);
         }
         if (pRaw != 0xFFFF) {
-            insertSensorData(deviceAddress, "air_pressure", {{timestamp, pressure}});
+            storeLiveReading(deviceAddress, "air_pressure", timestamp, pressure);
         }
         if (pmRaw != 0xFFFF) {
-            insertSensorData(deviceAddress, "pm25", {{timestamp, pm25}});
+            storeLiveReading(deviceAddress, "pm25", timestamp, pm25);
         }
         if (co2Raw != 0xFFFF) {
-            insertSensorData(deviceAddress, "co2", {{timestamp, double(co2)}});
+            storeLiveReading(deviceAddress, "co2", timestamp, double(co2));
         }
         if (voc != 0x1FF) {
-            insertSensorData(deviceAddress, "voc", {{timestamp, double(voc)}});
+            storeLiveReading(deviceAddress, "voc", timestamp, double(voc));
         }
         if (nox != 0x1FF) {
-            insertSensorData(deviceAddress, "nox", {{timestamp, double(nox)}});
+            storeLiveReading(deviceAddress, "nox", timestamp, double(nox));
+        }
+        if (hasIAQS && !std::isnan(iaqs)) {
+            storeLiveReading(deviceAddress, "iaqs", timestamp, iaqs);
         }
 
-        // Calculate IAQS
-        double iaqs = calculateIAQS(pm25, co2);
-
-        // Emit signal with new readings
-        emit airDeviceDataUpdated(deviceAddress, temperature, humidity, pressure, pm25, co2, voc, nox, iaqs, calibrationInProgress, sequence, timestamp);
+        // Show the new readings
+        QVariantMap values;
+        values["air"] = true;
+        values["temperature"] = temperature;
+        values["humidity"] = humidity;
+        values["pressure"] = pressure;
+        values["pm25"] = pm25;
+        values["co2"] = co2;
+        values["voc"] = voc;
+        values["nox"] = nox;
+        values["iaqs"] = iaqs;
+        values["calibrating"] = calibrationInProgress;
+        values["sequence"] = sequence;
+        values["timestamp"] = timestamp;
+        queueNotification(deviceAddress, values);
     }
     else {
+        latencystats::increment(latencystats::UnknownDataFormat);
         qDebug() << "Unknown data format:" << dataFormat;
     }
 }
@@ -463,7 +1501,106 @@ void database::inputManufacturerData(const QString &deviceAddress, const std::ar
 void database::insertSensorData(const QString &deviceAddress, const QString &sensor,
                                 const QList<QPair<int, double>> &sensorData)
 {
-    if (sensorData.isEmpty()) return;
+    writeAndWait([&]() {
+        storeSensorData(deviceAddress, sensor, sensorData, 0, -1);
+    });
+}
+
+void database::storeLiveReading(const QString &deviceAddress, const QString &sensor, int timestamp, double value)
+{
+    // The scanner does not wait for the commit. The readings that arrive
+    // before the writer gets to them are stored in the same transaction.
+    QMutexLocker locker(&liveMutex);
+    pendingLive[qMakePair(deviceAddress, sensor)].append(qMakePair(timestamp, value));
+    if (liveFlushQueued) {
+        return;
+    }
+    liveFlushQueued = true;
+    write([this]() {
+        flushLiveReadings();
+    });
+}
+
+void database::flushLiveReadings()
+{
+    QHash<QPair<QString, QString>, QList<QPair<int, double>>> readings;
+    {
+        QMutexLocker locker(&liveMutex);
+        readings.swap(pendingLive);
+        liveFlushQueued = false;
+    }
+    QList<sensorBatch> batches;
+    for (auto it = readings.constBegin(); it != readings.constEnd(); ++it) {
+        batches << sensorBatch(it.key().first, it.key().second, it.value());
+    }
+    storeSensorBatches(batches);
+}
+
+int database::importSensorData(const QString &deviceAddress, const QString &sensor,
+                               const QList<QPair<int, double>> &sensorData)
+{
+    if (sensorData.isEmpty()) return 0;
+    if (!onWriterThread()) {
+        // The watermarks are read and written by the writer only
+        int dropped = 0;
+        writeAndWait([&]() {
+            dropped = importSensorData(deviceAddress, sensor, sensorData);
+        });
+        return dropped;
+    }
+    const QPair<int, QString> key = qMakePair(deviceId(deviceAddress), sensor);
+    watermark mark;
+    {
+        QMutexLocker locker(&watermarkMutex);
+        mark = watermarks.value(key);
+    }
+
+    // The logs are re-sent from the sync start, so most of an overlapping
+    // import is already stored and does not need to reach SQLite at all
+    QList<QPair<int, double>> newRecords;
+    int importFrom = sensorData.first().first;
+    int importTo = importFrom;
+    for (const auto& item : sensorData) {
+        importFrom = qMin(importFrom, item.first);
+        importTo = qMax(importTo, item.first);
+        if (item.first < mark.importedFrom || item.first > mark.importedTo) {
+            newRecords.append(item);
+        }
+    }
+    if (!newRecords.isEmpty()) {
+        storeSensorData(deviceAddress, sensor, newRecords, importFrom, importTo);
+    }
+    return sensorData.size() - newRecords.size();
+}
+
+void database::storeSensorData(const QString &deviceAddress, const QString &sensor,
+                               const QList<QPair<int, double>> &sensorData, int importFrom, int importTo)
+{
+    storeSensorBatches(QList<sensorBatch>() << sensorBatch(deviceAddress, sensor, sensorData, importFrom, importTo));
+}
+
+void database::storeSensorBatches(const QList<sensorBatch> &batches)
+{
+    QList<sensorBatch> valid;
+    QList<int> ids;
+    for (const sensorBatch &batch : batches) {
+        if (batch.rows.isEmpty()) {
+            continue;
+        }
+        if (!isSensorTable(batch.sensor)) {
+            qWarning() << "Unknown sensor table:" << batch.sensor;
+            continue;
+        }
+        const int id = deviceId(batch.mac);
+        if (id < 0) {
+            qWarning() << "Sensor data for an unknown device:" << batch.mac;
+            continue;
+        }
+        valid << batch;
+        ids << id;
+    }
+    if (valid.isEmpty()) return;
+    latencyscope insertScope(latencystats::SensorInsert);
 
     QSqlDatabase d = connectionForCurrentThread();
     if (!d.isOpen()) {
@@ -476,30 +1613,152 @@ void database::insertSensorData(const QString &deviceAddress, const QString &sen
         return;
     }
 
-    QSqlQuery q(d);
-    if (!q.prepare("INSERT OR IGNORE INTO " + sensor + " (device, timestamp, value) VALUES (?, ?, ?)")) {
-        qWarning() << "Prepare failed:" << q.lastError();
-        d.rollback();
-        return;
-    }
+    QVariantList pendingDevices, pendingTimestamps;
+    for (int i = 0; i < valid.size(); ++i) {
+        const sensorBatch &batch = valid.at(i);
+        QSqlQuery q = cachedQuery(d, "INSERT OR IGNORE INTO " + batch.sensor + " (device_id, timestamp, value) VALUES (?, ?, ?)");
+        // Rows behind the export mark are inserted one by one, the ones that
+        // were not stored yet are left for the next incremental export
+        QHash<int, int>::const_iterator exportMark = exportMarks.constFind(ids.at(i));
+
+        QVariantList devices, timestamps, values;
+        devices.reserve(batch.rows.size());
+        timestamps.reserve(batch.rows.size());
+        values.reserve(batch.rows.size());
+
+        for (const auto& item : batch.rows) {
+            if (exportMark != exportMarks.constEnd() && item.first <= exportMark.value()) {
+                q.bindValue(0, ids.at(i));
+                q.bindValue(1, item.first);
+                q.bindValue(2, item.second);
+                if (!queryprofiler::exec(q)) {
+                    qWarning() << "Insert failed:" << q.lastError();
+                    d.rollback();
+                    return;
+                }
+                if (q.numRowsAffected() > 0) {
+                    pendingDevices << ids.at(i);
+                    pendingTimestamps << item.first;
+                }
+                continue;
+            }
+            devices    << ids.at(i);
+            timestamps << item.first;
+            values     << item.second;
+        }
+        if (devices.isEmpty()) {
+            continue;
+        }
 
-    QVariantList devices, timestamps, values;
-    devices.reserve(sensorData.size());
-    timestamps.reserve(sensorData.size());
-    values.reserve(sensorData.size());
+        q.bindValue(0, devices);
+        q.bindValue(1, timestamps);
+        q.bindValue(2, values);
 
-    for (const auto& item : sensorData) {
-        devices    << deviceAddress;
-        timestamps << item.first;
-        values     << item.second;
+        if (!queryprofiler::execBatch(q)) {
+            qWarning() << "execBatch failed:" << q.lastError();
+            d.rollback();
+            return;
+        }
+    }
+    if (!pendingDevices.isEmpty()) {
+        QSqlQuery pending = cachedQuery(d, "INSERT OR IGNORE INTO export_pending (device_id, timestamp) VALUES (?, ?)");
+        pending.bindValue(0, pendingDevices);
+        pending.bindValue(1, pendingTimestamps);
+        if (!queryprofiler::execBatch(pending)) {
+            qWarning() << "execBatch failed:" << pending.lastError();
+            d.rollback();
+            return;
+        }
     }
 
-    q.addBindValue(devices);
-    q.addBindValue(timestamps);
-    q.addBindValue(values);
+    // Rollups covering the new rows are rebuilt by the next range query. Only
+    // buckets that are over are ever stored, live readings fall in open ones.
+    const qint64 now = QDateTime::currentDateTime().toTime_t();
+    QVariantList rollupSensors, rollupDevices, rollupLevels, rollupBuckets;
+    for (int i = 0; i < valid.size(); ++i) {
+        QSet<qint64> hours;
+        QSet<qint64> days;
+        for (const auto& item : valid.at(i).rows) {
+            const qint64 hour = bucketStart(item.first, ROLLUP_HOUR);
+            const qint64 day = bucketStart(item.first, ROLLUP_DAY);
+            if (hour + ROLLUP_HOUR <= now) {
+                hours.insert(hour);
+            }
+            if (day + ROLLUP_DAY <= now) {
+                days.insert(day);
+            }
+        }
+        for (qint64 hour : hours) {
+            rollupSensors << valid.at(i).sensor;
+            rollupDevices << ids.at(i);
+            rollupLevels << ROLLUP_HOUR;
+            rollupBuckets << hour;
+        }
+        for (qint64 day : days) {
+            rollupSensors << valid.at(i).sensor;
+            rollupDevices << ids.at(i);
+            rollupLevels << ROLLUP_DAY;
+            rollupBuckets << day;
+        }
+    }
+    if (!rollupSensors.isEmpty()) {
+        QSqlQuery invalidate = cachedQuery(d, "DELETE FROM rollups WHERE sensor = ? AND device_id = ? AND level = ? AND bucket = ?");
+        invalidate.bindValue(0, rollupSensors);
+        invalidate.bindValue(1, rollupDevices);
+        invalidate.bindValue(2, rollupLevels);
+        invalidate.bindValue(3, rollupBuckets);
+        if (!queryprofiler::execBatch(invalidate)) {
+            qWarning() << "Rollup invalidation failed:" << invalidate.lastError();
+            d.rollback();
+            return;
+        }
+    }
 
-    if (!q.execBatch()) {
-        qWarning() << "execBatch failed:" << q.lastError();
+    // The high-water marks are written in the same transaction as the rows.
+    // An import span is merged with the stored one if they overlap, otherwise
+    // the newer span is kept. The lock is held until the marks are stored
+    // again, so they are never computed from a copy that is being replaced.
+    QMutexLocker markLocker(&watermarkMutex);
+    QHash<QPair<int, QString>, watermark> marks;
+    for (int i = 0; i < valid.size(); ++i) {
+        const sensorBatch &batch = valid.at(i);
+        const QPair<int, QString> key = qMakePair(ids.at(i), batch.sensor);
+        if (!marks.contains(key)) {
+            marks.insert(key, watermarks.value(key));
+        }
+        watermark &mark = marks[key];
+        for (const auto& item : batch.rows) {
+            mark.newest = qMax(mark.newest, item.first);
+        }
+        if (batch.importFrom <= batch.importTo) {
+            if (mark.importedFrom <= mark.importedTo && batch.importFrom <= mark.importedTo
+                    && batch.importTo >= mark.importedFrom) {
+                mark.importedFrom = qMin(mark.importedFrom, batch.importFrom);
+                mark.importedTo = qMax(mark.importedTo, batch.importTo);
+            } else if (batch.importTo > mark.importedTo) {
+                mark.importedFrom = batch.importFrom;
+                mark.importedTo = batch.importTo;
+            }
+        }
+    }
+    QVariantList markDevices, markSensors, markNewest, markFrom, markTo;
+    for (auto it = marks.constBegin(); it != marks.constEnd(); ++it) {
+        const bool hasImport = it.value().importedFrom <= it.value().importedTo;
+        markDevices << it.key().first;
+        markSensors << it.key().second;
+        markNewest << it.value().newest;
+        markFrom << (hasImport ? QVariant(it.value().importedFrom) : QVariant());
+        markTo << (hasImport ? QVariant(it.value().importedTo) : QVariant());
+    }
+    QSqlQuery markQuery = cachedQuery(d, "INSERT OR REPLACE INTO watermarks (device_id, sensor, newest, imported_from, imported_to)"
+                                         " VALUES (?, ?, ?, ?, ?)");
+    markQuery.bindValue(0, markDevices);
+    markQuery.bindValue(1, markSensors);
+    markQuery.bindValue(2, markNewest);
+    markQuery.bindValue(3, markFrom);
+    markQuery.bindValue(4, markTo);
+    if (!queryprofiler::execBatch(markQuery)) {
+        qWarning() << "Watermark update failed:" << markQuery.lastError();
         d.rollback();
         return;
     }
@@ -507,18 +1766,52 @@ void database::insertSensorData(const QString &deviceAddress, const QString &sen
     if (!d.commit()) {
         qWarning() << "Commit failed:" << d.lastError();
         d.rollback();
+        return;
+    }
+    for (auto it = marks.constBegin(); it != marks.constEnd(); ++it) {
+        watermarks.insert(it.key(), it.value());
     }
+    markLocker.unlock();
+
+    int rows = 0;
+    for (const sensorBatch &batch : valid) {
+        plotCache.append(batch.mac, batch.sensor, batch.rows);
+        int oldest = batch.rows.first().first;
+        int newest = oldest;
+        for (const auto& item : batch.rows) {
+            oldest = qMin(oldest, item.first);
+            newest = qMax(newest, item.first);
+        }
+        // Live readings and small syncs update the cached tiles, larger imports rebuild them
+        if (batch.rows.size() <= TILE_EXTEND_MAX_ROWS) {
+            plotTiles.extend(batch.mac, batch.sensor, batch.rows);
+        } else {
+            plotTiles.invalidate(batch.mac, batch.sensor, oldest, newest);
+        }
+        // A derived value needs the rows of its other sources too
+        for (const QString &derived : derivedseries::dependents(batch.sensor)) {
+            plotTiles.invalidate(batch.mac, derived, oldest, newest);
+        }
+        rows += batch.rows.size();
+    }
+    latencystats::increment(latencystats::SensorRowsInserted, rows);
 }
 
 QVariantList database::getSensorData(QString deviceAddress, QString sensor, int startTime, int endTime) {
     QVariantList sensorDataList;
+    if (!isSensorTable(sensor)) {
+        qWarning() << "Unknown sensor table:" << sensor;
+        return sensorDataList;
+    }
 
-    QString selectQuery = "SELECT timestamp, value FROM " + sensor +
-                          " WHERE device = '" + deviceAddress + "' AND timestamp >= " + QString::number(startTime) +
-                          " AND timestamp <= " + QString::number(endTime) +
-                          " ORDER BY timestamp ASC";
-    QSqlQuery query(db);
-    if (query.exec(selectQuery)) {
+    QSqlQuery query = cachedQuery(connectionForCurrentThread(),
+                                  "SELECT timestamp, value FROM " + sensor +
+                                  " WHERE device_id = ? AND timestamp >= ? AND timestamp <= ?"
+                                  " ORDER BY timestamp ASC");
+    query.bindValue(0, deviceId(deviceAddress));
+    query.bindValue(1, startTime);
+    query.bindValue(2, endTime);
+    if (queryprofiler::exec(query)) {
         while (query.next()) {
             int timestamp = query.value(0).toInt();
             double value = query.value(1).toDouble();
@@ -531,20 +1824,52 @@ QVariantList database::getSensorData(QString deviceAddress, QString sensor, int
     } else {
         qDebug() << "Error executing sensor data query:" << query.lastError().text();
     }
+    queryprofiler::finish(query);
 
     return sensorDataList;
 }
 
+// Shows the readings not flushed to the devices table yet on top of the stored ones
+static QVariantList withPendingUpdates(QVariantList devices, const QHash<QString, QVariantMap> &pending)
+{
+    if (pending.isEmpty()) {
+        return devices;
+    }
+    static const QHash<QString, QString> DEVICE_KEYS = {
+        {"voltage", "deviceVoltage"}, {"movement", "deviceMovement"},
+        {"acc_x", "accX"}, {"acc_y", "accY"}, {"acc_z", "accZ"}
+    };
+    for (QVariant &entry : devices) {
+        QVariantMap device = entry.toMap();
+        const QVariantMap columns = pending.value(device.value("deviceAddress").toString());
+        if (columns.isEmpty()) {
+            continue;
+        }
+        for (auto it = columns.constBegin(); it != columns.constEnd(); ++it) {
+            device[DEVICE_KEYS.value(it.key(), it.key())] = it.value().isNull() ? QString("NA") : QString::number(it.value().toDouble());
+        }
+        entry = device;
+    }
+    return devices;
+}
+
 QVariantList database::getDevices()
 {
-    QVariantList devices;
+    // Does not wait for the writer, QML asks again on readyChanged
+    if (!isReady()) {
+        return QVariantList();
+    }
+    return withPendingUpdates(readDevices(), pendingDeviceUpdates);
+}
 
-    QString selectQuery = "SELECT * FROM devices";
-    QSqlQuery query(db);
-    if (query.exec(selectQuery)) {
+QVariantList database::readDevices()
+{
+    QVariantList devices;
+    QSqlQuery query = cachedQuery(connectionForCurrentThread(), "SELECT * FROM devices");
+    if (queryprofiler::exec(query)) {
         while (query.next()) {
-            QString mac = query.value(0).toString();
-            QString name = query.value(1).toString();
+            QString mac = query.value("mac").toString();
+            QString name = query.value("name").toString();
             QString voltage = query.value("voltage").isNull() ? "NA" : QString::number(query.value("voltage").toDouble());
             QString movement = query.value("movement").isNull() ? "NA" : QString::number(query.value("movement").toInt());
             QString temperature = query.value("temperature").isNull() ? "NA" : QString::number(query.value("temperature").toDouble());
@@ -561,8 +1886,9 @@ QVariantList database::getDevices()
             QString voc = query.value("voc").isNull() ? "NA" : QString::number(query.value("voc").toInt());
             QString nox = query.value("nox").isNull() ? "NA" : QString::number(query.value("nox").toInt());
             QString calibrating = query.value("calibrating").isNull() ? "NA" : QString::number(query.value("calibrating").toInt());
-            QString iaqs = "NA";
-            if (!query.value("pm25").isNull() && !query.value("co2").isNull()) {
+            QString iaqs = query.value("iaqs").isNull() ? "NA" : QString::number(query.value("iaqs").toInt());
+            if (query.value("iaqs").isNull() && !query.value("pm25").isNull() && !query.value("co2").isNull()) {
+                // Rows written before the iaqs column existed
                 iaqs = QString::number(
                     calculateIAQS(query.value("pm25").toDouble(), query.value("co2").toDouble())
                 );
@@ -594,92 +1920,186 @@ QVariantList database::getDevices()
     } else {
         qDebug() << "Error executing devices query:" << query.lastError().text();
     }
+    queryprofiler::finish(query);
 
     return devices;
 }
 
 int database::getLastMeasurement(const QString deviceAddress, const QString sensor) {
-    QString selectQuery;
+    QStringList tables;
     if (sensor == "all") {
-        // Find the minimum timestamp among the maximum timestamps of each sensor
-        selectQuery = "SELECT MIN(max_timestamp) FROM "
-                      "(SELECT MAX(timestamp) AS max_timestamp FROM temperature WHERE device = '" + deviceAddress + "' "
-                      "UNION SELECT MAX(timestamp) AS max_timestamp FROM humidity WHERE device = '" + deviceAddress + "' "
-                      "UNION SELECT MAX(timestamp) AS max_timestamp FROM air_pressure WHERE device = '" + deviceAddress + "')";
-    } else if (sensor == "air pressure") {
-        // Find the maximum timestamp for the air_pressure sensor
-        selectQuery = "SELECT MAX(timestamp) FROM air_pressure WHERE device = '" + deviceAddress + "'";
+        // The minimum among the newest timestamps of each sensor
+        tables << "temperature" << "humidity" << "air_pressure";
     } else {
-        // Find the maximum timestamp for the specified sensor
-        selectQuery = "SELECT MAX(timestamp) FROM " + sensor + " WHERE device = '" + deviceAddress + "'";
+        const QString table = (sensor == "air pressure") ? QString("air_pressure") : sensor;
+        if (!isSensorTable(table)) {
+            qWarning() << "Unknown sensor table:" << sensor;
+            return 1; // Return 1 if an error occurred
+        }
+        tables << table;
     }
 
-    QSqlQuery query(db);
-    if (query.exec(selectQuery)) {
-        if (query.next()) {
-            return query.value(0).toInt();
+    // Answered from the high-water marks, 0 if no measurement was found
+    const int id = deviceId(deviceAddress);
+    int lastMeasurement = 0;
+    bool found = false;
+    QMutexLocker locker(&watermarkMutex);
+    for (const QString &table : tables) {
+        QHash<QPair<int, QString>, watermark>::const_iterator it = watermarks.constFind(qMakePair(id, table));
+        if (it != watermarks.constEnd()) {
+            lastMeasurement = found ? qMin(lastMeasurement, it.value().newest) : it.value().newest;
+            found = true;
         }
-    } else {
-        qDebug() << "Error executing getLastMeasurement query:" << query.lastError().text();
     }
-    return 1; // Return 1 if an error occurred or no measurement was found
+    return lastMeasurement;
 }
 
 int database::getLastSync(const QString deviceAddress) {
-    QString selectQuery = "SELECT sync_time FROM devices WHERE mac = '" + deviceAddress + "'";
-    QSqlQuery query(db);
-    if (query.exec(selectQuery)) {
+    QSqlQuery query = cachedQuery(connectionForCurrentThread(), "SELECT sync_time FROM devices WHERE mac = ?");
+    query.bindValue(0, deviceAddress);
+    int lastSync = 0; // Return 0 if an error occurred or no sync time available
+    if (queryprofiler::exec(query)) {
         if (query.next()) {
-            return query.value(0).toInt();
+            lastSync = query.value(0).toInt();
         }
     } else {
         qDebug() << "Error executing getLastMeasurement query:" << query.lastError().text();
     }
-    return 0; // Return 0 if an error occurred or no sync time available
+    queryprofiler::finish(query);
+    return lastSync;
 }
 
-void database::renameDevice(const QString deviceAddress, const QString newDeviceName) {
-    // Check if the device already exists in the devices table
-    QString selectQuery = "SELECT mac FROM devices WHERE mac = '" + deviceAddress + "'";
-    QSqlQuery query(db);
-    if (query.exec(selectQuery)) {
-        if (!query.next()) {
-            // Device does not exist, so insert it into the devices table
-            QString insertQuery = "INSERT INTO devices (mac, name) VALUES ('" + deviceAddress + "', '" + newDeviceName + "')";
-            executeQuery(insertQuery);
-        } else {
-            // Device exist, update the name
-            QString updateQuery = "UPDATE devices SET name = '" + newDeviceName + "' WHERE mac = '" + deviceAddress + "'";
-            executeQuery(updateQuery);
+int database::getSyncStart(const QString deviceAddress) {
+    // The oldest end among the imported sensor logs, so no sensor misses records.
+    // Whatever is sent again falls inside the import spans and is dropped.
+    const int id = deviceId(deviceAddress);
+    int syncStart = -1;
+    {
+        QMutexLocker locker(&watermarkMutex);
+        for (auto it = watermarks.constBegin(); it != watermarks.constEnd(); ++it) {
+            const watermark &mark = it.value();
+            if (it.key().first == id && mark.importedFrom <= mark.importedTo) {
+                syncStart = syncStart < 0 ? mark.importedTo : qMin(syncStart, mark.importedTo);
+            }
         }
-    } else {
-        qDebug() << "Error executing selectQuery in renameDevice:" << query.lastError().text();
+    }
+    return syncStart >= 0 ? syncStart : getLastSync(deviceAddress);
+}
+
+void database::renameDevice(const QString deviceAddress, const QString newDeviceName) {
+    if (!onWriterThread()) {
+        write([=]() {
+            renameDevice(deviceAddress, newDeviceName);
+        });
         return;
     }
+    // Insert the device if it does not exist yet, otherwise update the name
+    QSqlDatabase d = connectionForCurrentThread();
+    QSqlQuery insertQuery = cachedQuery(d, "INSERT OR IGNORE INTO devices (mac, name) VALUES (?, ?)");
+    insertQuery.bindValue(0, deviceAddress);
+    insertQuery.bindValue(1, newDeviceName);
+    if (!queryprofiler::exec(insertQuery)) {
+        qDebug() << "Error inserting device in renameDevice:" << insertQuery.lastError().text();
+        return;
+    }
+    QSqlQuery updateQuery = cachedQuery(d, "UPDATE devices SET name = ? WHERE mac = ?");
+    updateQuery.bindValue(0, newDeviceName);
+    updateQuery.bindValue(1, deviceAddress);
+    if (!queryprofiler::exec(updateQuery)) {
+        qDebug() << "Error updating device name in renameDevice:" << updateQuery.lastError().text();
+    }
 }
 
 void database::removeDevice(const QString deviceAddress) {
-    // Remove sensor readings from temperature table
-    QString deleteTemperatureQuery = "DELETE FROM temperature WHERE device = '" + deviceAddress + "'";
-    executeQuery(deleteTemperatureQuery);
+    pendingDeviceUpdates.remove(deviceAddress);
+    // Queued, an import in progress would otherwise block the caller
+    write([=]() {
+        deleteDevice(deviceAddress);
+    });
+}
 
-    // Remove sensor readings from humidity table
-    QString deleteHumidityQuery = "DELETE FROM humidity WHERE device = '" + deviceAddress + "'";
-    executeQuery(deleteHumidityQuery);
+bool database::deleteDevice(const QString &deviceAddress) {
+    if (!onWriterThread()) {
+        bool removed = false;
+        writeAndWait([&]() {
+            removed = deleteDevice(deviceAddress);
+        });
+        return removed;
+    }
+    QSqlDatabase d = connectionForCurrentThread();
+    if (!d.transaction()) {
+        qWarning() << "Transaction start failed:" << d.lastError();
+        return false;
+    }
 
-    // Remove sensor readings from air_pressure table
-    QString deleteAirPressureQuery = "DELETE FROM air_pressure WHERE device = '" + deviceAddress + "'";
-    executeQuery(deleteAirPressureQuery);
+    // Remove sensor readings from all sensor tables and finally the device itself
+    const int id = deviceId(deviceAddress);
+    const QStringList statements = {
+        "DELETE FROM temperature WHERE device_id = ?",
+        "DELETE FROM humidity WHERE device_id = ?",
+        "DELETE FROM air_pressure WHERE device_id = ?",
+        "DELETE FROM pm25 WHERE device_id = ?",
+        "DELETE FROM co2 WHERE device_id = ?",
+        "DELETE FROM voc WHERE device_id = ?",
+        "DELETE FROM nox WHERE device_id = ?",
+        "DELETE FROM iaqs WHERE device_id = ?",
+        "DELETE FROM iaqs_unscored WHERE device_id = ?",
+        "DELETE FROM rollups WHERE device_id = ?",
+        "DELETE FROM watermarks WHERE device_id = ?",
+        "DELETE FROM export_marks WHERE device_id = ?",
+        "DELETE FROM export_pending WHERE device_id = ?"
+    };
+    for (const QString &statement : statements) {
+        QSqlQuery query = cachedQuery(d, statement);
+        query.bindValue(0, id);
+        if (!queryprofiler::exec(query)) {
+            qDebug() << "Error removing device:" << query.lastError().text();
+            d.rollback();
+            return false;
+        }
+    }
+    QSqlQuery deviceQuery = cachedQuery(d, "DELETE FROM devices WHERE mac = ?");
+    deviceQuery.bindValue(0, deviceAddress);
+    if (!queryprofiler::exec(deviceQuery)) {
+        qDebug() << "Error removing device:" << deviceQuery.lastError().text();
+        d.rollback();
+        return false;
+    }
 
-    // Remove from RuuviAir related tables
-    executeQuery("DELETE FROM pm25 WHERE device = '" + deviceAddress + "'");
-    executeQuery("DELETE FROM co2 WHERE device = '" + deviceAddress + "'");
-    executeQuery("DELETE FROM voc WHERE device = '" + deviceAddress + "'");
-    executeQuery("DELETE FROM nox WHERE device = '" + deviceAddress + "'");
+    if (!d.commit()) {
+        qWarning() << "Commit failed:" << d.lastError();
+        d.rollback();
+        return false;
+    }
+    plotCache.removeDevice(deviceAddress);
+    plotTiles.removeDevice(deviceAddress);
+    // The id can be handed out again to the next new device
+    {
+        QMutexLocker locker(&watermarkMutex);
+        QHash<QPair<int, QString>, watermark>::iterator it = watermarks.begin();
+        while (it != watermarks.end()) {
+            if (it.key().first == id) {
+                it = watermarks.erase(it);
+            } else {
+                ++it;
+            }
+        }
+    }
+    exportMarks.remove(id);
+    QMutexLocker locker(&deviceIdMutex);
+    deviceIds.remove(deviceAddress);
+    return true;
+}
 
-    // Remove device from devices table
-    QString deleteDeviceQuery = "DELETE FROM devices WHERE mac = '" + deviceAddress + "'";
-    executeQuery(deleteDeviceQuery);
+QString database::exportFolder() {
+    QString csvFolder = QStandardPaths::writableLocation(QStandardPaths::DocumentsLocation);
+    csvFolder = csvFolder + "/" + "skruuvi-exports";
+    // Check that skruuviExports dir exists in Documents. If not, create it
+    if (!QDir(csvFolder).exists()) {
+        qDebug() << "skruuvi-exports folder did not exist; creating it";
+        QDir().mkpath(csvFolder);
+    }
+    return csvFolder;
 }
 
 QString database::exportCSV(const QString deviceAddress, const QString deviceName, int startTime, int endTime) {
@@ -690,14 +2110,7 @@ QString database::exportCSV(const QString deviceAddress, const QString deviceNam
     std::strftime(timeStr, sizeof(timeStr), "%d-%m-%y-%H-%M-%S", currentTime);
     QString modifiedDeviceAddress = deviceAddress;
     modifiedDeviceAddress.replace(":", "-");
-    QString csvFolder = QStandardPaths::writableLocation(QStandardPaths::DocumentsLocation);
-    csvFolder = csvFolder + "/" + "skruuvi-exports";
-    // Check that skruuviExports dir exists in Documents. If not, create it
-    if (!QDir(csvFolder).exists()) {
-        qDebug() << "skruuvi-exports folder did not exist; creating it";
-        QDir().mkpath(csvFolder);
-    }
-    QString csvPath = csvFolder + "/" + modifiedDeviceAddress + "_" + deviceName + "_" + timeStr + ".csv";
+    QString csvPath = exportFolder() + "/" + modifiedDeviceAddress + "_" + deviceName + "_" + timeStr + ".csv";
     qDebug() << "Exporting data to" << csvPath;
 
     // Open the file for writing the csv
@@ -708,47 +2121,64 @@ QString database::exportCSV(const QString deviceAddress, const QString deviceNam
     }
     QTextStream stream(&file);
 
+    // Write header to the CSV file
+    stream << CSV_HEADER;
+    writeCSVRows(stream, deviceAddress, deviceName, startTime, endTime);
+
+    file.close();
+    return csvPath;
+}
+
+int database::writeCSVRows(QTextStream &stream, const QString &deviceAddress, const QString &deviceName,
+                           int startTime, int endTime, const QSet<int>* onlyTimestamps) {
     // Get all measurements from db
-    QString selectQuery = "SELECT t.timestamp, temperature.value AS temperature, humidity.value AS humidity, air_pressure.value AS air_pressure,"
-                          " pm25.value AS pm25, co2.value AS co2, voc.value AS voc, nox.value AS nox"
+    QSqlQuery query = cachedQuery(connectionForCurrentThread(),
+                          "SELECT t.timestamp, temperature.value AS temperature, humidity.value AS humidity, air_pressure.value AS air_pressure,"
+                          " pm25.value AS pm25, co2.value AS co2, voc.value AS voc, nox.value AS nox, iaqs.value AS iaqs"
                           " FROM ("
-                          "     SELECT DISTINCT timestamp FROM temperature WHERE device = '" + deviceAddress + "' AND timestamp >= " + QString::number(startTime) +
-                          "     AND timestamp <= " + QString::number(endTime) +
+                          "     SELECT DISTINCT timestamp FROM temperature WHERE device_id = ? AND timestamp >= ? AND timestamp <= ?"
                           "     UNION"
-                          "     SELECT DISTINCT timestamp FROM humidity WHERE device = '" + deviceAddress + "' AND timestamp >= " + QString::number(startTime) +
-                          "     AND timestamp <= " + QString::number(endTime) +
+                          "     SELECT DISTINCT timestamp FROM humidity WHERE device_id = ? AND timestamp >= ? AND timestamp <= ?"
                           "     UNION"
-                          "     SELECT DISTINCT timestamp FROM air_pressure WHERE device = '" + deviceAddress + "' AND timestamp >= " + QString::number(startTime) +
-                          "     AND timestamp <= " + QString::number(endTime) +
+                          "     SELECT DISTINCT timestamp FROM air_pressure WHERE device_id = ? AND timestamp >= ? AND timestamp <= ?"
                           "     UNION"
-                          "     SELECT DISTINCT timestamp FROM pm25 WHERE device = '" + deviceAddress + "'"
-                          "         AND timestamp >= " + QString::number(startTime) + " AND timestamp <= " + QString::number(endTime) +
+                          "     SELECT DISTINCT timestamp FROM pm25 WHERE device_id = ? AND timestamp >= ? AND timestamp <= ?"
                           "     UNION"
-                          "     SELECT DISTINCT timestamp FROM co2 WHERE device = '" + deviceAddress + "'"
-                          "         AND timestamp >= " + QString::number(startTime) + " AND timestamp <= " + QString::number(endTime) +
+                          "     SELECT DISTINCT timestamp FROM co2 WHERE device_id = ? AND timestamp >= ? AND timestamp <= ?"
                           "     UNION"
-                          "     SELECT DISTINCT timestamp FROM voc WHERE device = '" + deviceAddress + "'"
-                          "         AND timestamp >= " + QString::number(startTime) + " AND timestamp <= " + QString::number(endTime) +
+                          "     SELECT DISTINCT timestamp FROM voc WHERE device_id = ? AND timestamp >= ? AND timestamp <= ?"
                           "     UNION"
-                          "     SELECT DISTINCT timestamp FROM nox WHERE device = '" + deviceAddress + "'"
-                          "         AND timestamp >= " + QString::number(startTime) + " AND timestamp <= " + QString::number(endTime) +
+                          "     SELECT DISTINCT timestamp FROM nox WHERE device_id = ? AND timestamp >= ? AND timestamp <= ?"
                           " ) t"
-                          " LEFT JOIN temperature ON t.timestamp = temperature.timestamp AND temperature.device = '" + deviceAddress + "'"
-                          " LEFT JOIN humidity ON t.timestamp = humidity.timestamp AND humidity.device = '" + deviceAddress + "'"
-                          " LEFT JOIN air_pressure ON t.timestamp = air_pressure.timestamp AND air_pressure.device = '" + deviceAddress + "'"
-                          " LEFT JOIN pm25 ON t.timestamp = pm25.timestamp AND pm25.device = '" + deviceAddress + "'"
-                          " LEFT JOIN co2 ON t.timestamp = co2.timestamp AND co2.device = '" + deviceAddress + "'"
-                          " LEFT JOIN voc ON t.timestamp = voc.timestamp AND voc.device = '" + deviceAddress + "'"
-                          " LEFT JOIN nox ON t.timestamp = nox.timestamp AND nox.device = '" + deviceAddress + "'"
-                          " ORDER BY t.timestamp ASC";
-    QSqlQuery query(db);
+                          " LEFT JOIN temperature ON t.timestamp = temperature.timestamp AND temperature.device_id = ?"
+                          " LEFT JOIN humidity ON t.timestamp = humidity.timestamp AND humidity.device_id = ?"
+                          " LEFT JOIN air_pressure ON t.timestamp = air_pressure.timestamp AND air_pressure.device_id = ?"
+                          " LEFT JOIN pm25 ON t.timestamp = pm25.timestamp AND pm25.device_id = ?"
+                          " LEFT JOIN co2 ON t.timestamp = co2.timestamp AND co2.device_id = ?"
+                          " LEFT JOIN voc ON t.timestamp = voc.timestamp AND voc.device_id = ?"
+                          " LEFT JOIN nox ON t.timestamp = nox.timestamp AND nox.device_id = ?"
+                          " LEFT JOIN iaqs ON t.timestamp = iaqs.timestamp AND iaqs.device_id = ?"
+                          " ORDER BY t.timestamp ASC");
+    // One (device, start, end) triplet for each of the 7 timestamp subqueries, then the device for each of the 8 joins
+    const int id = deviceId(deviceAddress);
+    int bindIndex = 0;
+    for (int i = 0; i < 7; ++i) {
+        query.bindValue(bindIndex++, id);
+        query.bindValue(bindIndex++, startTime);
+        query.bindValue(bindIndex++, endTime);
+    }
+    for (int i = 0; i < 8; ++i) {
+        query.bindValue(bindIndex++, id);
+    }
 
-    // Write header to the CSV file
-    stream << "mac,name,timestamp,temperature,humidity,air_pressure,pm25,co2,voc,nox,iaqs\n";
     // Loop through the query results
-    if (query.exec(selectQuery)) {
+    int rows = 0;
+    if (queryprofiler::exec(query)) {
         while (query.next()) {
             int timestamp = query.value(0).toInt();
+            if (onlyTimestamps && !onlyTimestamps->contains(timestamp)) {
+                continue;
+            }
             QString temperature = query.value(1).isNull() ? "-" : QString::number(query.value(1).toDouble());
             QString humidity = query.value(2).isNull() ? "-" : QString::number(query.value(2).toDouble());
             QString air_pressure = query.value(3).isNull() ? "-" : QString::number(query.value(3).toDouble());
@@ -756,37 +2186,879 @@ QString database::exportCSV(const QString deviceAddress, const QString deviceNam
             QString co2   = query.value(5).isNull() ? "-" : QString::number(query.value(5).toDouble());
             QString voc   = query.value(6).isNull() ? "-" : QString::number(query.value(6).toDouble());
             QString nox   = query.value(7).isNull() ? "-" : QString::number(query.value(7).toDouble());
-            QString iaqs = "-";
-            if (!query.value(4).isNull() && !query.value(5).isNull()) {
-                iaqs = QString::number(
-                    calculateIAQS(query.value(4).toDouble(),
-                                query.value(5).toDouble())
-                );
-            }
+            QString iaqs  = query.value(8).isNull() ? "-" : QString::number(query.value(8).toInt());
             // Write the data to the CSV file
             stream << deviceAddress << "," << deviceName << "," << timestamp << "," << temperature << "," << humidity << ","
                    << air_pressure << "," << pm25 << "," << co2 << "," << voc << "," << nox << "," << iaqs << "\n";
+            ++rows;
         }
     } else {
         qDebug() << "Error executing sensor data query:" << query.lastError().text();
+        rows = -1;
     }
+    queryprofiler::finish(query);
+    return rows;
+}
 
+// Flushes the file to the disk, the export mark must not get ahead of the rows
+static bool syncFile(QFile &file) {
+    if (!file.flush() || ::fsync(file.handle()) != 0) {
+        qWarning() << "Syncing" << file.fileName() << "failed";
+        return false;
+    }
+    return true;
+}
+
+// A new file is only durable once its directory entry is
+static void syncDirectory(const QString &path) {
+    const int fd = ::open(QFile::encodeName(path).constData(), O_RDONLY);
+    if (fd < 0) {
+        return;
+    }
+    ::fsync(fd);
+    ::close(fd);
+}
+
+QString database::exportNewCSV(const QString deviceAddress, const QString deviceName, bool rolling) {
+    // One export at a time, two of them would both start from the same mark
+    QMutexLocker exportLocker(&exportMutex);
+    const int id = deviceId(deviceAddress);
+    if (id < 0) {
+        return "";
+    }
+
+    // The newest seconds are left for the next export, their rows may still be
+    // written to some of the sensor tables. From here on the rows stored at or
+    // before the end are queued in export_pending, see storeSensorBatches.
+    const int endTime = int(std::time(nullptr)) - EXPORT_SETTLE_S;
+    writeAndWait([&]() {
+        exportMarks[id] = qMax(exportMarks.value(id, 0), endTime);
+    });
+
+    // The mark, the queued rows and the new rows are read from one snapshot
+    QSqlDatabase d = connectionForCurrentThread();
+    if (!d.transaction()) {
+        qWarning() << "Transaction start failed:" << d.lastError();
+        return "";
+    }
+    int exportedTo = 0;
+    bool hasMark = false;
+    QString markPath;
+    qint64 markSize = 0;
+    QSqlQuery markQuery = cachedQuery(d, "SELECT exported_to, path, size FROM export_marks WHERE device_id = ?");
+    markQuery.bindValue(0, id);
+    if (!queryprofiler::exec(markQuery)) {
+        qWarning() << "Error reading the export mark:" << markQuery.lastError().text();
+        d.rollback();
+        return "";
+    }
+    if (markQuery.next()) {
+        hasMark = true;
+        exportedTo = markQuery.value(0).toInt();
+        markPath = markQuery.value(1).toString();
+        markSize = markQuery.value(2).toLongLong();
+    }
+    queryprofiler::finish(markQuery);
+
+    // Rows stored after an earlier export but timestamped before its mark,
+    // e.g. history synced from the sensor later
+    QSet<int> pending;
+    QVariantList pendingTimestamps;
+    int oldestPending = exportedTo;
+    QSqlQuery pendingQuery = cachedQuery(d, "SELECT timestamp FROM export_pending WHERE device_id = ? AND timestamp <= ?");
+    pendingQuery.bindValue(0, id);
+    pendingQuery.bindValue(1, endTime);
+    if (!queryprofiler::exec(pendingQuery)) {
+        qWarning() << "Error reading the pending export rows:" << pendingQuery.lastError().text();
+        d.rollback();
+        return "";
+    }
+    while (pendingQuery.next()) {
+        const int timestamp = pendingQuery.value(0).toInt();
+        pendingTimestamps << timestamp;
+        if (timestamp <= exportedTo) {
+            pending.insert(timestamp);
+            oldestPending = qMin(oldestPending, timestamp);
+        }
+    }
+    queryprofiler::finish(pendingQuery);
+    if (endTime <= exportedTo && pending.isEmpty()) {
+        d.rollback();
+        return rolling ? markPath : "";
+    }
+
+    QString modifiedDeviceAddress = deviceAddress;
+    modifiedDeviceAddress.replace(":", "-");
+    QString csvPath = exportFolder() + "/" + modifiedDeviceAddress + "_" + deviceName;
+    if (rolling) {
+        csvPath += ".csv";
+    } else {
+        // Named after the mark, so a chunk redone after a crash replaces the old attempt
+        char timeStr[18] = "all";
+        if (exportedTo > 0) {
+            std::time_t markTimestamp = exportedTo;
+            std::strftime(timeStr, sizeof(timeStr), "%d-%m-%y-%H-%M-%S", std::localtime(&markTimestamp));
+        }
+        csvPath += QString("_since-") + timeStr + ".csv";
+    }
+    qDebug() << "Exporting new data to" << csvPath;
+
+    QFile file(csvPath);
+    const bool created = !file.exists();
+    if (rolling && !created && !hasMark) {
+        // The first export of the device crashed before its mark was stored,
+        // nothing in the file is committed
+        qDebug() << "Dropping the uncommitted" << csvPath;
+        file.resize(0);
+    } else if (rolling && !created && csvPath == markPath && file.size() > markSize) {
+        // Rows of an export that crashed before its mark was stored, they are written again below
+        qDebug() << "Dropping" << file.size() - markSize << "uncommitted bytes from" << csvPath;
+        file.resize(markSize);
+    }
+    const QIODevice::OpenMode mode = rolling ? QIODevice::Append : QIODevice::WriteOnly | QIODevice::Truncate;
+    if (!file.open(mode | QIODevice::Text)) {
+        qDebug() << "Error opening file:" << file.errorString();
+        d.rollback();
+        return "";
+    }
+    QTextStream stream(&file);
+    if (file.size() == 0) {
+        stream << CSV_HEADER;
+    }
+    int rows = endTime > exportedTo ? writeCSVRows(stream, deviceAddress, deviceName, exportedTo + 1, endTime) : 0;
+    if (rows >= 0 && !pending.isEmpty()) {
+        const int late = writeCSVRows(stream, deviceAddress, deviceName, oldestPending, exportedTo, &pending);
+        rows = late < 0 ? -1 : rows + late;
+    }
+    d.rollback();
+    stream.flush();
+    if (rows == 0 && !rolling) {
+        file.remove();
+        return "";
+    }
+    if (rows < 0 || !syncFile(file)) {
+        return "";
+    }
+    const qint64 size = file.size();
     file.close();
-    return csvPath;
+    if (created) {
+        syncDirectory(exportFolder());
+    }
+
+    // Only now the rows are on the disk, so the mark can move past them. The
+    // queued rows that were in the snapshot are exported now, by one query or the other.
+    bool stored = false;
+    writeAndWait([&]() {
+        QSqlDatabase writer = connectionForCurrentThread();
+        writer.transaction();
+        QSqlQuery query = cachedQuery(writer,
+                                      "INSERT OR REPLACE INTO export_marks (device_id, exported_to, path, size) VALUES (?, ?, ?, ?)");
+        query.bindValue(0, id);
+        query.bindValue(1, qMax(exportedTo, endTime));
+        query.bindValue(2, csvPath);
+        query.bindValue(3, size);
+        stored = queryprofiler::exec(query);
+        if (!stored) {
+            qWarning() << "Error storing the export mark:" << query.lastError().text();
+        }
+        if (stored && !pendingTimestamps.isEmpty()) {
+            QVariantList devices;
+            for (int i = 0; i < pendingTimestamps.size(); ++i) {
+                devices << id;
+            }
+            QSqlQuery done = cachedQuery(writer, "DELETE FROM export_pending WHERE device_id = ? AND timestamp = ?");
+            done.bindValue(0, devices);
+            done.bindValue(1, pendingTimestamps);
+            stored = queryprofiler::execBatch(done);
+            if (!stored) {
+                qWarning() << "Error removing the exported pending rows:" << done.lastError().text();
+            }
+        }
+        if (!stored || !writer.commit()) {
+            writer.rollback();
+            stored = false;
+        }
+    });
+    qDebug() << "Exported" << rows << "new rows of" << deviceAddress;
+    return stored ? csvPath : "";
+}
+
+plotcolumns database::getPlotColumns(const QString &deviceAddress, const QString &sensor) {
+    if (!isSensorTable(sensor)) {
+        return plotcolumns();
+    }
+    if (!plotCache.isVerified(deviceAddress, sensor)) {
+        // Once per run the cache is compared with SQLite, a crash between the
+        // commit and the append or an older app version leave it behind
+        const int generation = plotCache.generation(deviceAddress, sensor);
+        const int id = deviceId(deviceAddress);
+        QSqlDatabase d = connectionForCurrentThread();
+        QSqlQuery count = cachedQuery(d, "SELECT COUNT(*), MAX(timestamp) FROM " + sensor + " WHERE device_id = ?");
+        count.bindValue(0, id);
+        qint64 rows = -1;
+        int newest = 0;
+        if (queryprofiler::exec(count) && count.next()) {
+            rows = count.value(0).toLongLong();
+            newest = count.value(1).toInt();
+        } else {
+            qDebug() << "Error executing plot cache count query:" << count.lastError().text();
+        }
+        queryprofiler::finish(count);
+        if (rows < 0) {
+            return plotcolumns();
+        }
+
+        if (!plotCache.verify(deviceAddress, sensor, rows, newest)) {
+            QVector<qint32> timestamps;
+            QVector<double> values;
+            timestamps.reserve(int(rows));
+            values.reserve(int(rows));
+            QSqlQuery query = cachedQuery(d, "SELECT timestamp, value FROM " + sensor + " WHERE device_id = ? ORDER BY timestamp ASC");
+            query.bindValue(0, id);
+            if (queryprofiler::exec(query)) {
+                while (query.next()) {
+                    timestamps.append(query.value(0).toInt());
+                    values.append(query.value(1).toDouble());
+                }
+            } else {
+                qDebug() << "Error executing plot cache rebuild query:" << query.lastError().text();
+            }
+            queryprofiler::finish(query);
+            if (!plotCache.rebuild(deviceAddress, sensor, timestamps, values, generation)) {
+                return plotcolumns();
+            }
+        }
+    }
+    return plotCache.map(deviceAddress, sensor);
+}
+
+QVector<tilebucket> database::buildTile(const tilekey &key, const plotcolumns &columns, int generation) {
+    QVector<tilebucket> buckets;
+    if (columns.isValid()) {
+        buckets = tilepyramid::build(columns.timestamps(), columns.values(), columns.count(), key.level, key.index);
+    } else {
+        buckets.resize(tilepyramid::TILE_BUCKETS);
+        const qint64 start = key.index * tilepyramid::tileSpan(key.level);
+        QSqlQuery query = cachedQuery(connectionForCurrentThread(),
+                                      "SELECT timestamp, value FROM " + key.sensor + " WHERE device_id = ? AND timestamp >= ? AND timestamp < ?");
+        query.bindValue(0, deviceId(key.mac));
+        query.bindValue(1, start);
+        query.bindValue(2, start + tilepyramid::tileSpan(key.level));
+        if (queryprofiler::exec(query)) {
+            while (query.next()) {
+                tilepyramid::add(buckets, key.level, key.index, query.value(0).toInt(), query.value(1).toDouble());
+            }
+        } else {
+            qDebug() << "Error executing plot tile query:" << query.lastError().text();
+        }
+        queryprofiler::finish(query);
+    }
+    plotTiles.insert(key, buckets, generation);
+    return buckets;
+}
+
+QVector<tilebucket> database::buildDerivedTile(const tilekey &key, const plotcolumns &temperature, const plotcolumns &humidity,
+                                               int generation) {
+    // Only the rows of the tile are aligned and evaluated, the result is cached like a stored series
+    const qint64 start = key.index * tilepyramid::tileSpan(key.level);
+    const qint64 end = start + tilepyramid::tileSpan(key.level);
+    QVector<qint32> timestamps;
+    QVector<double> temperatureValues;
+    QVector<double> humidityValues;
+    if (temperature.isValid() && humidity.isValid()) {
+        const qint32 from = qint32(qBound<qint64>(std::numeric_limits<qint32>::min(), start, std::numeric_limits<qint32>::max()));
+        const qint32 to = qint32(qBound<qint64>(std::numeric_limits<qint32>::min(), end, std::numeric_limits<qint32>::max()));
+        const int firstA = temperature.lowerBound(from);
+        const int firstB = humidity.lowerBound(from);
+        derivedseries::align(temperature.timestamps() + firstA, temperature.values() + firstA, temperature.lowerBound(to) - firstA,
+                             humidity.timestamps() + firstB, humidity.values() + firstB, humidity.lowerBound(to) - firstB,
+                             timestamps, temperatureValues, humidityValues);
+    } else {
+        QSqlQuery query = cachedQuery(connectionForCurrentThread(),
+                                      "SELECT temperature.timestamp, temperature.value, humidity.value FROM temperature"
+                                      " JOIN humidity ON humidity.device_id = temperature.device_id AND humidity.timestamp = temperature.timestamp"
+                                      " WHERE temperature.device_id = ? AND temperature.timestamp >= ? AND temperature.timestamp < ?"
+                                      " ORDER BY temperature.timestamp ASC");
+        query.bindValue(0, deviceId(key.mac));
+        query.bindValue(1, start);
+        query.bindValue(2, end);
+        if (queryprofiler::exec(query)) {
+            while (query.next()) {
+                timestamps.append(query.value(0).toInt());
+                temperatureValues.append(query.value(1).toDouble());
+                humidityValues.append(query.value(2).toDouble());
+            }
+        } else {
+            qDebug() << "Error executing derived tile query:" << query.lastError().text();
+        }
+        queryprofiler::finish(query);
+    }
+    QVector<double> values(timestamps.size());
+    derivedseries::evaluate(key.sensor, temperatureValues.constData(), humidityValues.constData(), values.data(), values.size());
+    const QVector<tilebucket> buckets = tilepyramid::build(timestamps.constData(), values.constData(), values.size(),
+                                                           key.level, key.index);
+    plotTiles.insert(key, buckets, generation);
+    return buckets;
+}
+
+bool database::plotExtent(const QString &deviceAddress, const QString &sensor, const plotcolumns &columns,
+                          int startTime, int endTime, qint64 &oldest, qint64 &newest) {
+    oldest = 0;
+    newest = -1;
+    if (columns.isValid()) {
+        const int first = columns.lowerBound(startTime);
+        const int last = endTime < std::numeric_limits<int>::max() ? columns.lowerBound(endTime + 1) : columns.count();
+        if (first < last) {
+            oldest = columns.timestamps()[first];
+            newest = columns.timestamps()[last - 1];
+        }
+    } else {
+        QSqlQuery extent = cachedQuery(connectionForCurrentThread(),
+                                       "SELECT (SELECT MIN(timestamp) FROM " + sensor + " WHERE device_id = ? AND timestamp >= ? AND timestamp <= ?),"
+                                       " (SELECT MAX(timestamp) FROM " + sensor + " WHERE device_id = ? AND timestamp >= ? AND timestamp <= ?)");
+        const int id = deviceId(deviceAddress);
+        extent.bindValue(0, id);
+        extent.bindValue(1, startTime);
+        extent.bindValue(2, endTime);
+        extent.bindValue(3, id);
+        extent.bindValue(4, startTime);
+        extent.bindValue(5, endTime);
+        if (queryprofiler::exec(extent) && extent.next() && !extent.value(0).isNull()) {
+            oldest = extent.value(0).toLongLong();
+            newest = extent.value(1).toLongLong();
+        }
+        queryprofiler::finish(extent);
+    }
+    return oldest <= newest;
+}
+
+QVariantMap database::getPlotSeries(const QString &deviceAddress, const QString &sensor, int startTime, int endTime, int maxPoints) {
+    QVariantMap result;
+    QVector<QPointF> series;
+    result["series"] = QVariant::fromValue(series);
+    result["aggregated"] = false;
+    result["bucketDuration"] = 0.0;
+    const bool derived = derivedseries::isDerived(sensor);
+    if ((!isSensorTable(sensor) && !derived) || endTime < startTime) {
+        return result;
+    }
+
+    // Read before the rows, a tile built from older rows is not cached
+    const int generation = plotTiles.generation(deviceAddress, sensor);
+    // A derived series reads the columns of its sources
+    QList<plotcolumns> sourceColumns;
+    const QStringList sources = derived ? derivedseries::sources(sensor) : QStringList() << sensor;
+    for (const QString &source : sources) {
+        sourceColumns << getPlotColumns(deviceAddress, source);
+    }
+
+    // The level follows the span of the data in the range, not the requested
+    // range, "everything until now" would otherwise get the widest buckets.
+    // A derived series only exists where all of its sources have data.
+    qint64 oldest = 0;
+    qint64 newest = -1;
+    for (int source = 0; source < sources.size(); ++source) {
+        qint64 sourceOldest = 0;
+        qint64 sourceNewest = -1;
+        if (!plotExtent(deviceAddress, sources[source], sourceColumns[source], startTime, endTime, sourceOldest, sourceNewest)) {
+            return result;
+        }
+        oldest = source == 0 ? sourceOldest : qMax(oldest, sourceOldest);
+        newest = source == 0 ? sourceNewest : qMin(newest, sourceNewest);
+    }
+    if (newest < oldest) {
+        return result;
+    }
+
+    const int level = tilepyramid::levelFor(newest - oldest, maxPoints > 0 ? maxPoints : 500);
+    const qint64 firstTile = tilepyramid::tileIndex(oldest, level);
+    const qint64 lastTile = tilepyramid::tileIndex(newest, level);
+    bool aggregated = false;
+    for (qint64 index = firstTile; index <= lastTile; ++index) {
+        const tilekey key = {deviceAddress, sensor, level, index};
+        QVector<tilebucket> buckets;
+        if (plotTiles.find(key, buckets)) {
+            latencystats::increment(latencystats::PlotTileHits);
+        } else {
+            latencystats::increment(latencystats::PlotTileMisses);
+            buckets = derived ? buildDerivedTile(key, sourceColumns[0], sourceColumns[1], generation)
+                              : buildTile(key, sourceColumns[0], generation);
+        }
+        tilepyramid::appendPoints(series, buckets, oldest, newest, &aggregated);
+    }
+    result["series"] = QVariant::fromValue(series);
+    result["aggregated"] = aggregated;
+    result["bucketDuration"] = aggregated ? double(tilepyramid::bucketWidth(level)) : 0.0;
+
+    // The neighbours for panning and the next level for zooming in
+    QList<tilekey> prefetch;
+    prefetch << tilekey{deviceAddress, sensor, level, firstTile - 1} << tilekey{deviceAddress, sensor, level, lastTile + 1};
+    if (level < tilepyramid::FINEST_LEVEL) {
+        for (qint64 index = tilepyramid::tileIndex(oldest, level + 1); index <= tilepyramid::tileIndex(newest, level + 1); ++index) {
+            prefetch << tilekey{deviceAddress, sensor, level + 1, index};
+        }
+    }
+    prefetchTiles(prefetch);
+    return result;
+}
+
+void database::prefetchTiles(const QList<tilekey> &keys) {
+    QList<tilekey> claimed;
+    for (const tilekey &key : keys) {
+        if (plotTiles.claimPrefetch(key)) {
+            claimed << key;
+        }
+    }
+    if (claimed.isEmpty()) {
+        return;
+    }
+    // Below the queries that someone waits for
+    readerPool.start(new backgroundTask([this, claimed]() {
+        const QString &mac = claimed.first().mac;
+        const QString &sensor = claimed.first().sensor;
+        const int generation = plotTiles.generation(mac, sensor);
+        const bool derived = derivedseries::isDerived(sensor);
+        QList<plotcolumns> sourceColumns;
+        for (const QString &source : derived ? derivedseries::sources(sensor) : QStringList() << sensor) {
+            sourceColumns << getPlotColumns(mac, source);
+        }
+        for (const tilekey &key : claimed) {
+            if (derived) {
+                buildDerivedTile(key, sourceColumns[0], sourceColumns[1], generation);
+            } else {
+                buildTile(key, sourceColumns[0], generation);
+            }
+            plotTiles.releasePrefetch(key);
+        }
+        latencystats::increment(latencystats::PlotTilePrefetches, claimed.size());
+    }), -1);
 }
 
 void database::requestPlotData(QString deviceAddress, bool isAir, int startTime, int endTime, int maxPoints) {
-    QThread* thread = new QThread(this);
+    latencystats::increment(latencystats::PlotRequests);
+    const qint64 requestedNs = latencystats::now();
+    readerPool.start(new backgroundTask([=]() {
+        worker workerObj(this, deviceAddress, isAir, startTime, endTime, maxPoints, requestedNs);
+        connect(&workerObj, &worker::plotReady, this, &database::deliverPlotData);
+        workerObj.plotData();
+    }));
+}
+
+void database::requestComparisonData(const QStringList &deviceAddresses, const QString &sensor,
+                                     int startTime, int endTime, int buckets) {
+    readerPool.start(new backgroundTask([=]() {
+        worker workerObj(this, deviceAddresses, sensor, startTime, endTime, buckets);
+        connect(&workerObj, &worker::comparisonReady, this, &database::comparisonDataReady);
+        workerObj.compareData();
+    }));
+}
+
+QVariantMap database::getComparisonData(const QStringList &deviceAddresses, const QString &sensor,
+                                        int startTime, int endTime, int buckets) {
+    QVariantMap result;
+    if (!isSensorTable(sensor) || deviceAddresses.isEmpty() || endTime < startTime || buckets <= 0) {
+        qWarning() << "Invalid comparison request for" << sensor;
+        return result;
+    }
+    const qint64 span = qint64(endTime) - startTime + 1;
+    const double bucketDuration = double(span) / buckets;
+    QSqlDatabase d = connectionForCurrentThread();
+
+    // Count, sum, min and max of every device and bucket
+    struct cell {
+        qint64 count = 0;
+        double sum = 0.0;
+        double min = 0.0;
+        double max = 0.0;
+    };
+    QVector<QVector<cell>> cells(deviceAddresses.size(), QVector<cell>(buckets));
+    QHash<int, int> seriesIndex;
+    for (int i = 0; i < deviceAddresses.size(); ++i) {
+        seriesIndex.insert(deviceId(deviceAddresses[i]), i);
+    }
+    auto addCell = [&](int series, qint64 timestamp, qint64 count, double mean, double min, double max) {
+        const qint64 bucket = (timestamp - startTime) * buckets / span;
+        if (series < 0 || count <= 0 || bucket < 0 || bucket >= buckets) {
+            return;
+        }
+        cell &c = cells[series][int(bucket)];
+        c.min = c.count > 0 ? qMin(c.min, min) : min;
+        c.max = c.count > 0 ? qMax(c.max, max) : max;
+        c.count += count;
+        c.sum += mean * count;
+    };
+
+    // Buckets of an hour or longer are filled from the hourly or daily rollups,
+    // only the partial rollup buckets at both ends read raw rows
+    const int level = bucketDuration >= ROLLUP_DAY ? ROLLUP_DAY : ROLLUP_HOUR;
+    const qint64 stop = qint64(endTime) + 1;
+    qint64 firstRollup = stop;
+    qint64 lastRollup = stop;
+    if (bucketDuration >= ROLLUP_HOUR) {
+        firstRollup = qMin(bucketStart(qint64(startTime) + level - 1, level), stop);
+        lastRollup = qMax(firstRollup, bucketStart(stop, level));
+    }
+
+    // Raw rows of all devices in one statement: SQLite walks the (device_id, timestamp)
+    // key once per device and only the bucket aggregates are returned
+    QStringList placeholders;
+    for (int i = 0; i < deviceAddresses.size(); ++i) {
+        placeholders << "?";
+    }
+    auto addRaw = [&](qint64 from, qint64 to) {
+        if (from >= to) {
+            return;
+        }
+        QSqlQuery query = cachedQuery(d,
+                                      "SELECT device_id, MIN(timestamp), COUNT(value), MIN(value), AVG(value), MAX(value)"
+                                      " FROM " + sensor +
+                                      " WHERE device_id IN (" + placeholders.join(", ") + ") AND timestamp >= ? AND timestamp < ?"
+                                      " GROUP BY device_id, (timestamp - ?) * ? / ?");
+        int bindIndex = 0;
+        for (auto it = seriesIndex.constBegin(); it != seriesIndex.constEnd(); ++it) {
+            query.bindValue(bindIndex++, it.key());
+        }
+        // Duplicate addresses share an id, the unused placeholders match nothing
+        while (bindIndex < deviceAddresses.size()) {
+            query.bindValue(bindIndex++, -1);
+        }
+        query.bindValue(bindIndex++, from);
+        query.bindValue(bindIndex++, to);
+        query.bindValue(bindIndex++, startTime);
+        query.bindValue(bindIndex++, buckets);
+        query.bindValue(bindIndex++, span);
+        if (queryprofiler::exec(query)) {
+            while (query.next()) {
+                addCell(seriesIndex.value(query.value(0).toInt(), -1), query.value(1).toLongLong(),
+                        query.value(2).toLongLong(), query.value(4).toDouble(), query.value(3).toDouble(),
+                        query.value(5).toDouble());
+            }
+        } else {
+            qDebug() << "Error executing comparison query:" << query.lastError().text();
+        }
+        queryprofiler::finish(query);
+    };
+    addRaw(startTime, firstRollup);
+    for (auto it = seriesIndex.constBegin(); it != seriesIndex.constEnd() && firstRollup < lastRollup; ++it) {
+        if (it.key() < 0) {
+            continue;
+        }
+        const int series = it.value();
+        visitRollups(d, deviceAddresses[series], sensor, level, firstRollup, lastRollup,
+                     [&](qint64 bucket, const rangesummary &summary) {
+            addCell(series, bucket, summary.count(), summary.mean(), summary.min(), summary.max());
+        });
+    }
+    addRaw(lastRollup, stop);
+
+    // Every series has one slot per bucket, null where the device has no data
+    QVector<QVariantList> minimums(deviceAddresses.size(), QVariantList());
+    QVector<QVariantList> means(deviceAddresses.size(), QVariantList());
+    QVector<QVariantList> maximums(deviceAddresses.size(), QVariantList());
+    for (int i = 0; i < deviceAddresses.size(); ++i) {
+        for (const cell &c : cells[i]) {
+            minimums[i].append(c.count > 0 ? QVariant(c.min) : QVariant());
+            means[i].append(c.count > 0 ? QVariant(c.sum / c.count) : QVariant());
+            maximums[i].append(c.count > 0 ? QVariant(c.max) : QVariant());
+        }
+    }
+
+    QVariantList timestamps;
+    for (int b = 0; b < buckets; ++b) {
+        timestamps.append(qint64(startTime + (b + 0.5) * bucketDuration));
+    }
+    QVariantList series;
+    for (int i = 0; i < deviceAddresses.size(); ++i) {
+        QVariantMap entry;
+        entry["device"] = deviceAddresses[i];
+        entry["min"] = minimums[i];
+        entry["mean"] = means[i];
+        entry["max"] = maximums[i];
+        series.append(entry);
+    }
+
+    result["sensor"] = sensor;
+    result["startTime"] = startTime;
+    result["endTime"] = endTime;
+    result["bucketDuration"] = bucketDuration;
+    result["timestamps"] = timestamps;
+    result["series"] = series;
+    return result;
+}
+
+void database::requestRangeStats(const QString &deviceAddress, const QString &sensor, int startTime, int endTime) {
+    readerPool.start(new backgroundTask([=]() {
+        worker workerObj(this, deviceAddress, sensor, startTime, endTime);
+        connect(&workerObj, &worker::rangeStatsReady, this, &database::rangeStatsReady);
+        workerObj.rangeStats();
+    }));
+}
+
+QVariantMap database::getRangeStats(const QString &deviceAddress, const QString &sensor, int startTime, int endTime) {
+    QElapsedTimer timer;
+    timer.start();
+    rangesummary summary;
+    if (!isSensorTable(sensor) || endTime < startTime) {
+        qWarning() << "Invalid range statistics request for" << sensor;
+        return summary.toVariantMap();
+    }
+    QSqlDatabase d = connectionForCurrentThread();
+
+    // Raw rows only for the partial hours at both ends, whole hours and days
+    // in between come from the rollups
+    const qint64 stop = qint64(endTime) + 1;
+    const qint64 firstHour = qMin(bucketStart(qint64(startTime) + ROLLUP_HOUR - 1, ROLLUP_HOUR), stop);
+    const qint64 lastHour = bucketStart(stop, ROLLUP_HOUR);
+    accumulateRaw(summary, d, deviceAddress, sensor, startTime, firstHour);
+    if (firstHour < lastHour) {
+        const qint64 firstDay = qMin(bucketStart(firstHour + ROLLUP_DAY - 1, ROLLUP_DAY), lastHour);
+        const qint64 lastDay = qMax(firstDay, bucketStart(stop, ROLLUP_DAY));
+        const rollupVisitor merge = [&summary](qint64, const rangesummary &bucket) {
+            summary.merge(bucket);
+        };
+        visitRollups(d, deviceAddress, sensor, ROLLUP_HOUR, firstHour, firstDay, merge);
+        visitRollups(d, deviceAddress, sensor, ROLLUP_DAY, firstDay, lastDay, merge);
+        visitRollups(d, deviceAddress, sensor, ROLLUP_HOUR, lastDay, lastHour, merge);
+        accumulateRaw(summary, d, deviceAddress, sensor, lastHour, stop);
+    } else {
+        accumulateRaw(summary, d, deviceAddress, sensor, firstHour, stop);
+    }
+
+    QVariantMap result = summary.toVariantMap();
+    result["device"] = deviceAddress;
+    result["sensor"] = sensor;
+    result["startTime"] = startTime;
+    result["endTime"] = endTime;
+    result["elapsedMs"] = timer.nsecsElapsed() / 1e6;
+    return result;
+}
+
+void database::accumulateRaw(rangesummary &summary, const QSqlDatabase &connection, const QString &deviceAddress,
+                             const QString &sensor, qint64 from, qint64 to) {
+    if (from >= to) {
+        return;
+    }
+    QSqlQuery query = cachedQuery(connection, "SELECT value FROM " + sensor + " WHERE device_id = ? AND timestamp >= ? AND timestamp < ?");
+    query.bindValue(0, deviceId(deviceAddress));
+    query.bindValue(1, from);
+    query.bindValue(2, to);
+    if (queryprofiler::exec(query)) {
+        while (query.next()) {
+            summary.add(query.value(0).toDouble());
+        }
+    } else {
+        qDebug() << "Error executing range query:" << query.lastError().text();
+    }
+    queryprofiler::finish(query);
+}
+
+void database::visitRollups(const QSqlDatabase &connection, const QString &deviceAddress, const QString &sensor,
+                            int level, qint64 from, qint64 to, const rollupVisitor &visit) {
+    if (from >= to) {
+        return;
+    }
+    QSqlQuery query = cachedQuery(connection,
+                                  "SELECT bucket, count, min, max, mean, m2, digest FROM rollups"
+                                  " WHERE sensor = ? AND device_id = ? AND level = ? AND bucket >= ? AND bucket < ?");
+    query.bindValue(0, sensor);
+    query.bindValue(1, deviceId(deviceAddress));
+    query.bindValue(2, level);
+    query.bindValue(3, from);
+    query.bindValue(4, to);
+    QSet<qint64> stored;
+    if (queryprofiler::exec(query)) {
+        while (query.next()) {
+            const qint64 bucket = query.value(0).toLongLong();
+            stored.insert(bucket);
+            const qint64 count = query.value(1).toLongLong();
+            if (count > 0) {
+                visit(bucket, rangesummary::fromStored(count, query.value(2).toDouble(), query.value(3).toDouble(),
+                                                       query.value(4).toDouble(), query.value(5).toDouble(),
+                                                       query.value(6).toByteArray()));
+            }
+        }
+    } else {
+        qDebug() << "Error executing rollup query:" << query.lastError().text();
+    }
+    queryprofiler::finish(query);
+
+    // Missing buckets are built from the raw rows, one query per run of them
+    qint64 runStart = -1;
+    for (qint64 bucket = from; bucket <= to; bucket += level) {
+        const bool missing = bucket < to && !stored.contains(bucket);
+        if (missing && runStart < 0) {
+            runStart = bucket;
+        } else if (!missing && runStart >= 0) {
+            buildRollups(connection, deviceAddress, sensor, level, runStart, bucket, visit);
+            runStart = -1;
+        }
+    }
+}
+
+void database::buildRollups(const QSqlDatabase &connection, const QString &deviceAddress, const QString &sensor,
+                            int level, qint64 from, qint64 to, const rollupVisitor &visit) {
+    QVector<rangesummary> buckets(int((to - from) / level), rangesummary(ROLLUP_COMPRESSION));
+    QSqlQuery query = cachedQuery(connection,
+                                  "SELECT timestamp, value FROM " + sensor + " WHERE device_id = ? AND timestamp >= ? AND timestamp < ?");
+    const int id = deviceId(deviceAddress);
+    query.bindValue(0, id);
+    query.bindValue(1, from);
+    query.bindValue(2, to);
+    if (queryprofiler::exec(query)) {
+        while (query.next()) {
+            buckets[int((query.value(0).toLongLong() - from) / level)].add(query.value(1).toDouble());
+        }
+    } else {
+        qDebug() << "Error executing rollup build query:" << query.lastError().text();
+    }
+    queryprofiler::finish(query);
+
+    // Empty buckets are stored too, so they are not scanned again. Buckets
+    // that are not over yet are only used for this query.
+    const qint64 now = QDateTime::currentDateTime().toTime_t();
+    QVariantList sensors, devices, levels, bucketStarts, counts, minimums, maximums, means, m2s, digests;
+    for (int i = 0; i < buckets.size(); ++i) {
+        rangesummary &bucket = buckets[i];
+        const qint64 start = from + qint64(i) * level;
+        if (bucket.count() > 0) {
+            visit(start, bucket);
+        }
+        if (start + level > now) {
+            continue;
+        }
+        const bool empty = bucket.count() == 0;
+        sensors << sensor;
+        devices << id;
+        levels << level;
+        bucketStarts << start;
+        counts << bucket.count();
+        minimums << (empty ? QVariant() : QVariant(bucket.min()));
+        maximums << (empty ? QVariant() : QVariant(bucket.max()));
+        means << bucket.mean();
+        m2s << bucket.m2Value();
+        digests << bucket.digestBlob();
+    }
+    if (sensors.isEmpty()) {
+        return;
+    }
+
+    // Stored by the writer, the range query does not wait for it
+    write([=]() {
+        QSqlDatabase d = connectionForCurrentThread();
+        d.transaction();
+        QSqlQuery insert = cachedQuery(d,
+                                       "INSERT OR REPLACE INTO rollups (sensor, device_id, level, bucket, count, min, max, mean, m2, digest)"
+                                       " VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?, ?)");
+        insert.bindValue(0, sensors);
+        insert.bindValue(1, devices);
+        insert.bindValue(2, levels);
+        insert.bindValue(3, bucketStarts);
+        insert.bindValue(4, counts);
+        insert.bindValue(5, minimums);
+        insert.bindValue(6, maximums);
+        insert.bindValue(7, means);
+        insert.bindValue(8, m2s);
+        insert.bindValue(9, digests);
+        if (!queryprofiler::execBatch(insert)) {
+            qWarning() << "Storing rollups failed:" << insert.lastError();
+            d.rollback();
+            return;
+        }
+        d.commit();
+    });
+}
+
+int database::startQuery(const std::function<QVariant()> &query) {
+    const int requestId = nextRequestId.fetchAndAddRelaxed(1) + 1;
+    readerPool.start(new queryTask(this, requestId, query));
+    return requestId;
+}
 
-    worker* workerObj = new worker(this, deviceAddress, isAir, startTime, endTime, maxPoints);
-    workerObj->moveToThread(thread);
+int database::getSensorDataAsync(QString deviceAddress, QString sensor, int startTime, int endTime) {
+    return startQuery([=]() {
+        return QVariant(getSensorData(deviceAddress, sensor, startTime, endTime));
+    });
+}
+
+int database::getDevicesAsync() {
+    // The pending readings live on the GUI thread, the reader gets a copy
+    const QHash<QString, QVariantMap> pending = pendingDeviceUpdates;
+    return startQuery([this, pending]() {
+        return QVariant(withPendingUpdates(readDevices(), pending));
+    });
+}
 
-    connect(thread, &QThread::started, workerObj, &worker::plotData);
-    connect(workerObj, &worker::plotReady, this, &database::plotDataReady);
+int database::getLastMeasurementAsync(const QString deviceAddress, const QString sensor) {
+    return startQuery([=]() {
+        return QVariant(getLastMeasurement(deviceAddress, sensor));
+    });
+}
 
-    connect(workerObj, &worker::plotReady, thread, &QThread::quit);
-    connect(thread, &QThread::finished, workerObj, &QObject::deleteLater);
-    connect(thread, &QThread::finished, thread, &QObject::deleteLater);
+int database::getLastSyncAsync(const QString deviceAddress) {
+    return startQuery([=]() {
+        return QVariant(getLastSync(deviceAddress));
+    });
+}
+
+int database::removeDeviceAsync(const QString deviceAddress) {
+    pendingDeviceUpdates.remove(deviceAddress);
+    // Queued behind a running import on the writer, so no reader waits for it
+    const int requestId = nextRequestId.fetchAndAddRelaxed(1) + 1;
+    write([=]() {
+        const bool removed = deleteDevice(deviceAddress);
+        QMetaObject::invokeMethod(this, "deliverQueryResult", Qt::QueuedConnection,
+                                  Q_ARG(int, requestId), Q_ARG(QVariant, QVariant(removed)));
+    });
+    return requestId;
+}
+
+int database::requestSeries(const QString deviceAddress, const QString sensor, int startTime, int endTime, int maxPoints) {
+    return startQuery([=]() {
+        return QVariant(getPlotSeries(deviceAddress, sensor, startTime, endTime, maxPoints));
+    });
+}
+
+int database::exportCSVAsync(const QString deviceAddress, const QString deviceName, int startTime, int endTime) {
+    return startQuery([=]() {
+        return QVariant(exportCSV(deviceAddress, deviceName, startTime, endTime));
+    });
+}
+
+int database::exportNewCSVAsync(const QString deviceAddress, const QString deviceName, bool rolling) {
+    return startQuery([=]() {
+        return QVariant(exportNewCSV(deviceAddress, deviceName, rolling));
+    });
+}
+
+void database::deliverQueryResult(int requestId, QVariant result) {
+    emit queryFinished(requestId, result);
+}
+
+void database::deliverPlotData(QVariantMap result, qint64 readyNs) {
+    latencystats::record(latencystats::PlotDelivery, latencystats::now() - readyNs);
+    latencyscope qmlScope(latencystats::PlotQml);
+    emit plotDataReady(result);
+}
+
+QVariantMap database::getLatencyStats() {
+    return latencystats::snapshot();
+}
+
+QString database::dumpLatencyStats(const QString &path) {
+    const QString dumpPath = path.isEmpty()
+        ? QStandardPaths::writableLocation(QStandardPaths::AppDataLocation) + "/latency-stats.json"
+        : path;
+    return latencystats::dump(dumpPath) ? dumpPath : QString();
+}
+
+void database::resetLatencyStats() {
+    latencystats::reset();
+}
+
+void database::setQueryProfiling(bool enabled, int slowThresholdMs) {
+    queryprofiler::setEnabled(enabled, slowThresholdMs);
+}
 
-    thread->start();
+QVariantList database::getSlowQueryReport(int topN) {
+    return queryprofiler::report(topN);
 }
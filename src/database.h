@@ -21,48 +21,286 @@
 #include <QObject>
 #include <QVariant>
 #include <QVariantList>
+#include <QVariantMap>
+#include <QHash>
+#include <QTimer>
+#include <QElapsedTimer>
+#include <QMutex>
+#include <QWaitCondition>
+#include <QAtomicInt>
+#include <QThread>
+#include <QThreadPool>
 #include <QtSql>
+#include <functional>
+#include "plotcache.h"
+#include "tilepyramid.h"
+#include "csvimporter.h"
+
+class rangesummary;
 
 class database : public QObject {
     Q_OBJECT
+    // False until the schema has been created or migrated, until then the
+    // queries block and the advertisements are dropped
+    Q_PROPERTY(bool ready READ isReady NOTIFY readyChanged)
 
 public:
     explicit database(QObject* parent = nullptr);
+    ~database();
+    // Brings the schema up to date, run on the writer thread
+    void initialize();
+    bool isReady() const;
+    // The mutations below run on the writer thread. addDevice, renameDevice, removeDevice,
+    // setLastSync and the live readings are queued, the others wait for it.
     void addDevice(const QString &deviceAddress, const QString &deviceName);
     Q_INVOKABLE void inputRawData(QString deviceAddress, QString deviceName, const QVariantList& data);
     void inputManufacturerData(const QString &deviceAddress, const std::array<uint8_t,24> &manufacturerData);
     Q_INVOKABLE QVariantList getSensorData(QString deviceAddress, QString sensor, int startTime, int endTime);
     void executeQuery(const QString& queryStr);
     void insertSensorData(const QString &deviceAddress, const QString &sensor, const QList<QPair<int, double>> &sensorData);
+    // Bulk insert of history logs, drops the records inside the span imported before. Returns the number of dropped records.
+    int importSensorData(const QString &deviceAddress, const QString &sensor, const QList<QPair<int, double>> &sensorData);
+    // The stored devices with the latest readings, empty until the database is ready
     Q_INVOKABLE QVariantList getDevices();
     Q_INVOKABLE int getLastMeasurement(const QString deviceAddress, const QString sensor);
     Q_INVOKABLE int getLastSync(const QString deviceAddress);
+    // Where the next history sync can start from, the end of the imported logs or the last sync time
+    Q_INVOKABLE int getSyncStart(const QString deviceAddress);
     Q_INVOKABLE void renameDevice(const QString deviceAddress, const QString newDeviceName);
     Q_INVOKABLE void removeDevice(const QString deviceAddress);
     Q_INVOKABLE QString exportCSV(const QString deviceAddress, const QString deviceName, int startTime, int endTime);
+    // Appends the rows newer than the previous call exported to <mac>_<name>.csv, or with rolling false
+    // writes them to a new file named after the previous export. Returns the file, empty if
+    // there was nothing to export or it failed. Waits for the writer, QML uses exportNewCSVAsync.
+    QString exportNewCSV(const QString deviceAddress, const QString deviceName, bool rolling = true);
+    // Loads a file in the exportCSV layout, unknown devices are added. Parsed here in
+    // chunks, stored by the writer. Returns "rows", "skipped", "seconds" and "rowsPerSecond".
+    QVariantMap importCSV(const QString &path);
+    // importCSV on a background thread, reports csvImportProgress and csvImportFinished
+    Q_INVOKABLE void importCSVAsync(const QString &path);
+    // Copies the database to path, or to Documents/skruuvi-backups, while the app keeps
+    // writing to it. Returns "path", "pages", "steps" and "seconds", or "error".
+    QVariantMap backupDatabase(const QString &path = QString());
+    // backupDatabase on a background thread, reports backupProgress and backupFinished
+    Q_INVOKABLE void backupAsync(const QString &path = QString());
+    // Replaces all the data with a backup, the result arrives in restoreFinished
+    Q_INVOKABLE void restoreBackup(const QString &path);
+    // Stops the running CSV import or backup
+    Q_INVOKABLE void cancelJob();
     Q_INVOKABLE void setLastSync(const QString& deviceAddress, const QString& deviceName, int timestamp);
+    // Non-blocking versions of the queries above. They run on the reader pool and
+    // return a request id, the result arrives in queryFinished with the same id.
+    Q_INVOKABLE int getSensorDataAsync(QString deviceAddress, QString sensor, int startTime, int endTime);
+    Q_INVOKABLE int getDevicesAsync();
+    Q_INVOKABLE int getLastMeasurementAsync(const QString deviceAddress, const QString sensor);
+    Q_INVOKABLE int getLastSyncAsync(const QString deviceAddress);
+    Q_INVOKABLE int removeDeviceAsync(const QString deviceAddress);
+    Q_INVOKABLE int exportCSVAsync(const QString deviceAddress, const QString deviceName, int startTime, int endTime);
+    Q_INVOKABLE int exportNewCSVAsync(const QString deviceAddress, const QString deviceName, bool rolling = true);
+    Q_INVOKABLE int requestSeries(const QString deviceAddress, const QString sensor, int startTime, int endTime, int maxPoints);
     Q_INVOKABLE QVariantList calculateIAQSList(const QVariantList &pm25Data, const QVariantList &co2Data);
+    static double calculateIAQS(double pm25, double co2);
+    // Computes the IAQS series for up to maxRows stored PM2.5/CO2 readings after the
+    // cursor that do not have it yet, and marks the ones that can not be scored.
+    // Moves the cursor. Returns the readings examined.
+    int backfillIAQS(int &deviceCursor, int &timestampCursor, int maxRows);
+    // Memory mapped columns of one sensor for plotting, checked against and if needed rebuilt from SQLite.
+    // Not valid if the cache can not be used, then the plot reads SQLite.
+    plotcolumns getPlotColumns(const QString &deviceAddress, const QString &sensor);
+    // Min/max series of one sensor, or of a derived series (see derivedseries), assembled from the tile pyramid, with "series"
+    // (QVector<QPointF>), "aggregated" and "bucketDuration". Queues the neighbouring
+    // tiles and the next level for the reader pool.
+    QVariantMap getPlotSeries(const QString &deviceAddress, const QString &sensor, int startTime, int endTime, int maxPoints);
     Q_INVOKABLE void requestPlotData(QString deviceAddress, bool isAir, int startTime, int endTime, int maxPoints);
+    // Time aligned per bucket min/mean/max of one sensor for several devices, result in comparisonDataReady
+    Q_INVOKABLE void requestComparisonData(const QStringList &deviceAddresses, const QString &sensor,
+                                           int startTime, int endTime, int buckets);
+    QVariantMap getComparisonData(const QStringList &deviceAddresses, const QString &sensor,
+                                  int startTime, int endTime, int buckets);
+    // Count, min, max, mean, stddev and approximate percentiles, result in rangeStatsReady
+    Q_INVOKABLE void requestRangeStats(const QString &deviceAddress, const QString &sensor, int startTime, int endTime);
+    QVariantMap getRangeStats(const QString &deviceAddress, const QString &sensor, int startTime, int endTime);
+    Q_INVOKABLE void setDeviceFlushInterval(int seconds);
+    // Maximum rate of devicesUpdated while the app is active and while it is in the background, 0 pauses
+    Q_INVOKABLE void setNotificationRates(double activeHz, double backgroundHz);
+    Q_INVOKABLE QVariantMap getStatementCacheStats();
+    Q_INVOKABLE QVariantMap getLatencyStats();
+    Q_INVOKABLE QString dumpLatencyStats(const QString &path = QString());
+    Q_INVOKABLE void resetLatencyStats();
+    Q_INVOKABLE void setQueryProfiling(bool enabled, int slowThresholdMs = 50);
+    Q_INVOKABLE QVariantList getSlowQueryReport(int topN = 10);
+
+public slots:
+    void flushDeviceUpdates();
+    void setApplicationActive(bool active);
+
+private slots:
+    void deliverPlotData(QVariantMap result, qint64 readyNs);
+    void deliverQueryResult(int requestId, QVariant result);
+    void onInitialized();
+    void publishNotifications();
 
 private:
     QSqlDatabase db;
-    void checkAndAddColumn(const QString &tableName, const QString &columnName, const QString &columnType);
+    // Latest readings per device (the dirty set), written to the devices table by flushDeviceUpdates
+    QHash<QString, QVariantMap> pendingDeviceUpdates;
+    QTimer deviceFlushTimer;
+    void queueDeviceUpdate(const QString &mac, const QVariantMap &columns);
+    // Latest live reading per device not yet sent to QML, published by publishNotifications
+    QHash<QString, QVariantMap> pendingNotifications;
+    QTimer notifyTimer;
+    QElapsedTimer lastNotify;
+    double notifyRateHz;
+    double backgroundNotifyRateHz;
+    bool applicationActive = true;
+    void queueNotification(const QString &mac, const QVariantMap &values);
+    void scheduleNotifications();
+    int userVersion();
+    int schemaVersion();
+    void migrateSchema();
+    bool migrateToVersion1();
+    bool migrateToVersion2();
+    bool migrateToVersion3();
+    bool migrateToVersion4();
+    bool executeStatements(const QStringList &statements);
+    bool migrateDeviceIds();
+    void waitUntilReady();
+    void loadWatermarks();
+    void loadExportMarks();
+    // Backfills the IAQS in chunks, then marks the database done with it
+    void queueIAQSBackfill(int run, int deviceCursor, int timestampCursor);
+    // Writer only, a backfill chain stops once it is not the latest run
+    int backfillRun = 0;
+    void storeLiveReading(const QString &deviceAddress, const QString &sensor, int timestamp, double value);
+    void storeSensorData(const QString &deviceAddress, const QString &sensor, const QList<QPair<int, double>> &sensorData,
+                         int importFrom, int importTo);
+    // Rows of one device and sensor, importFrom > importTo if they are not from a history import
+    struct sensorBatch {
+        sensorBatch(const QString &mac, const QString &sensor, const QList<QPair<int, double>> &rows,
+                    int importFrom = 0, int importTo = -1)
+            : mac(mac), sensor(sensor), rows(rows), importFrom(importFrom), importTo(importTo) {}
+        QString mac;
+        QString sensor;
+        QList<QPair<int, double>> rows;
+        int importFrom;
+        int importTo;
+    };
+    // Stores the batches in one transaction, with one rollup and watermark update for all
+    void storeSensorBatches(const QList<sensorBatch> &batches);
+    void flushLiveReadings();
+    // Integer id of the device in the sensor tables, -1 if the device is not known
+    int deviceId(const QString &deviceAddress);
     void updateDevice(const QString &mac, double temperature, double humidity, double pressure, double accX, double accY,
         double accZ, double voltage, double txPower, int movementCounter, int measurementSequenceNumber, int timestamp);
     void updateRuuviAir(const QString &mac, double temperature, double humidity, double pressure,
-        double pm25, int co2, int voc, int nox, int calibrating, int sequence, int timestamp);
-    double calculateIAQS(double pm25, double co2);
+        double pm25, int co2, int voc, int nox, double iaqs, int calibrating, int sequence, int timestamp);
+    QVariantList readDevices();
+    bool deleteDevice(const QString &deviceAddress);
+    static QString exportFolder();
+    bool isRestorable(const QString &path);
+    bool restoreFrom(const QString &path);
+    QSet<QString> deviceMacs();
+    // CSV rows of the device in [startTime, endTime], only the given timestamps if set.
+    // Returns the number of rows or -1.
+    int writeCSVRows(QTextStream &stream, const QString &deviceAddress, const QString &deviceName, int startTime, int endTime,
+                     const QSet<int>* onlyTimestamps = nullptr);
+    int startQuery(const std::function<QVariant()> &query);
+    // Queues a mutation for the writer thread
+    void write(const std::function<void()> &work);
+    // Runs a mutation on the writer thread and waits for it, directly if already there
+    void writeAndWait(const std::function<void()> &work);
+    bool onWriterThread() const;
+    static void openConnection(QSqlDatabase &connection);
+    void closeConnectionForCurrentThread();
+    void closeConnections();
+    void writeDeviceUpdates(const QHash<QString, QVariantMap> &updates);
+    QVector<tilebucket> buildTile(const tilekey &key, const plotcolumns &columns, int generation);
+    QVector<tilebucket> buildDerivedTile(const tilekey &key, const plotcolumns &temperature, const plotcolumns &humidity,
+                                         int generation);
+    // Oldest and newest timestamp of the sensor in [startTime, endTime], false if there are none
+    bool plotExtent(const QString &deviceAddress, const QString &sensor, const plotcolumns &columns,
+                    int startTime, int endTime, qint64 &oldest, qint64 &newest);
+    void prefetchTiles(const QList<tilekey> &keys);
     QSqlDatabase connectionForCurrentThread();
+    QSqlQuery cachedQuery(const QSqlDatabase &connection, const QString &statement);
+    static bool isSensorTable(const QString &sensor);
+    void accumulateRaw(rangesummary &summary, const QSqlDatabase &connection, const QString &deviceAddress,
+                       const QString &sensor, qint64 from, qint64 to);
+    // Called with the start and summary of every non-empty rollup bucket
+    typedef std::function<void(qint64 bucket, const rangesummary &summary)> rollupVisitor;
+    // Rollups of the level in [from, to), the missing ones are built from the raw rows
+    void visitRollups(const QSqlDatabase &connection, const QString &deviceAddress, const QString &sensor,
+                      int level, qint64 from, qint64 to, const rollupVisitor &visit);
+    void buildRollups(const QSqlDatabase &connection, const QString &deviceAddress, const QString &sensor,
+                      int level, qint64 from, qint64 to, const rollupVisitor &visit);
+
+    plotcache plotCache;
+    tilepyramid plotTiles;
+
+    QAtomicInt readyFlag;
+    QMutex readyMutex;
+    QWaitCondition readyCondition;
+    // Devices found before the schema was ready
+    QList<QPair<QString, QString>> pendingDevices;
+
+    // Runs the async queries and plots, its threads live as long as the
+    // database so their per-thread connections are reused
+    QThreadPool readerPool;
+    // One thread and connection that all the mutations go through, in order
+    QThreadPool writerPool;
+    QAtomicPointer<QThread> writerThread;
+    // Runs the CSV imports and backups one at a time, it does not use a connection of its own
+    QThreadPool jobPool;
+    QAtomicInt jobCancelled;
+    QAtomicInt nextRequestId;
+
+    // MAC to device id, shared by all connections
+    QMutex deviceIdMutex;
+    QHash<QString, int> deviceIds;
+
+    // Newest stored timestamp per device and sensor, and the span covered by
+    // the history imports. Mirrors the watermarks table.
+    struct watermark {
+        int newest = 0;
+        int importedFrom = 0;
+        int importedTo = -1;
+    };
+    QMutex watermarkMutex;
+    QHash<QPair<int, QString>, watermark> watermarks;
+
+    // Live readings not yet taken by the writer, by MAC and sensor
+    QMutex liveMutex;
+    QHash<QPair<QString, QString>, QList<QPair<int, double>>> pendingLive;
+    bool liveFlushQueued = false;
+
+    // Serializes exportNewCSV, the export marks are read and moved by the same call
+    QMutex exportMutex;
+    // Export mark per device id, or the end of the export in progress if that is
+    // later. The rows stored at or before it are queued in export_pending. Writer only.
+    QHash<int, int> exportMarks;
+
+    // Prepared statements per connection name and statement template
+    QMutex statementCacheMutex;
+    QHash<QString, QHash<QString, QSqlQuery>> statementCache;
+    QAtomicInt statementCacheHits;
+    QAtomicInt statementCacheMisses;
 
 signals:
+    void readyChanged();
     void inputFinished();
     void inputProgress(int step);
+    void csvImportProgress(qint64 bytesRead, qint64 totalBytes, qint64 rows, double rowsPerSecond);
+    void csvImportFinished(QVariantMap result);
+    void backupProgress(int remainingPages, int totalPages);
+    void backupFinished(QVariantMap result);
+    void restoreFinished(bool success);
     void plotDataReady(QVariantMap result);
-    void deviceDataUpdated(
-        const QString &mac, double temperature, double humidity, double pressure, double accX, double accY, double accZ,
-        double voltage, double txPower, int movementCounter, int measurementSequenceNumber, int timestamp);
-    void airDeviceDataUpdated(const QString &mac, double temperature, double humidity, double pressure, double pm25,
-                              int co2, int voc, int nox, double iaqs, int calibrating, int sequence, int timestamp);
+    void comparisonDataReady(QVariantMap result);
+    void rangeStatsReady(QVariantMap result);
+    void queryFinished(int requestId, QVariant result);
+    // Latest readings of the devices heard since the previous batch, one map per device
+    // with "mac", "air" and the values, at most at the rate set by setNotificationRates
+    void devicesUpdated(QVariantList changes);
 };
 
 #endif // DATABASE_H
@@ -0,0 +1,120 @@
+/*
+    Skruuvi - Reader for Ruuvi sensors
+    Copyright (C) 2025  Miika Malin
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see [http://www.gnu.org/licenses/].
+*/
+#include "derivedseries.h"
+#include <algorithm>
+#include <cmath>
+
+// Magnus formula over water, saturation vapour pressure in hPa
+static const double MAGNUS_A = 17.62;
+static const double MAGNUS_B = 243.12;
+static const double MAGNUS_P = 6.112;
+// Water vapour density factor, g/m³ from hPa and K
+static const double VAPOUR_FACTOR = 216.7;
+static const double ZERO_CELSIUS_K = 273.15;
+// The logarithm of the dew point is not defined at 0 %rH
+static const double MIN_HUMIDITY = 0.1;
+
+bool derivedseries::isDerived(const QString &sensor)
+{
+    return sensor == "dew_point" || sensor == "absolute_humidity" || sensor == "vpd";
+}
+
+QStringList derivedseries::sources(const QString &sensor)
+{
+    return isDerived(sensor) ? QStringList() << "temperature" << "humidity" : QStringList();
+}
+
+QStringList derivedseries::dependents(const QString &sensor)
+{
+    if (sensor == "temperature" || sensor == "humidity") {
+        return QStringList() << "dew_point" << "absolute_humidity" << "vpd";
+    }
+    return QStringList();
+}
+
+int derivedseries::align(const qint32* timestampsA, const double* valuesA, int countA,
+                         const qint32* timestampsB, const double* valuesB, int countB,
+                         QVector<qint32> &timestamps, QVector<double> &a, QVector<double> &b)
+{
+    // Same matching as calculateIAQSList, on the raw columns
+    const int capacity = std::min(countA, countB);
+    timestamps.resize(capacity);
+    a.resize(capacity);
+    b.resize(capacity);
+    qint32* timestampOut = timestamps.data();
+    double* aOut = a.data();
+    double* bOut = b.data();
+    int rows = 0;
+    int i = 0;
+    int j = 0;
+    while (i < countA && j < countB) {
+        if (timestampsA[i] == timestampsB[j]) {
+            timestampOut[rows] = timestampsA[i];
+            aOut[rows] = valuesA[i];
+            bOut[rows] = valuesB[j];
+            ++rows;
+            ++i;
+            ++j;
+        } else if (timestampsA[i] < timestampsB[j]) {
+            ++i;
+        } else {
+            ++j;
+        }
+    }
+    timestamps.resize(rows);
+    a.resize(rows);
+    b.resize(rows);
+    return rows;
+}
+
+void derivedseries::evaluate(const QString &sensor, const double* temperature, const double* humidity, double* out, int count)
+{
+    if (sensor == "dew_point") {
+        dewPoint(temperature, humidity, out, count);
+    } else if (sensor == "absolute_humidity") {
+        absoluteHumidity(temperature, humidity, out, count);
+    } else if (sensor == "vpd") {
+        vapourPressureDeficit(temperature, humidity, out, count);
+    }
+}
+
+void derivedseries::dewPoint(const double* temperature, const double* humidity, double* out, int count)
+{
+    for (int i = 0; i < count; ++i) {
+        const double gamma = std::log(std::max(humidity[i], MIN_HUMIDITY) / 100.0)
+                + MAGNUS_A * temperature[i] / (MAGNUS_B + temperature[i]);
+        out[i] = MAGNUS_B * gamma / (MAGNUS_A - gamma);
+    }
+}
+
+void derivedseries::absoluteHumidity(const double* temperature, const double* humidity, double* out, int count)
+{
+    for (int i = 0; i < count; ++i) {
+        const double saturation = MAGNUS_P * std::exp(MAGNUS_A * temperature[i] / (MAGNUS_B + temperature[i]));
+        out[i] = VAPOUR_FACTOR * saturation * humidity[i] / 100.0 / (ZERO_CELSIUS_K + temperature[i]);
+    }
+}
+
+void derivedseries::vapourPressureDeficit(const double* temperature, const double* humidity, double* out, int count)
+{
+    for (int i = 0; i < count; ++i) {
+        const double saturation = MAGNUS_P * std::exp(MAGNUS_A * temperature[i] / (MAGNUS_B + temperature[i]));
+        // hPa to kPa
+        out[i] = saturation * (1.0 - humidity[i] / 100.0) / 10.0;
+    }
+}
@@ -0,0 +1,51 @@
+/*
+    Skruuvi - Reader for Ruuvi sensors
+    Copyright (C) 2025  Miika Malin
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see [http://www.gnu.org/licenses/].
+*/
+#ifndef DERIVEDSERIES_H
+#define DERIVEDSERIES_H
+
+#include <QString>
+#include <QStringList>
+#include <QVector>
+
+// Series computed from the temperature and humidity tables instead of stored:
+// dew_point (°C), absolute_humidity (g/m³) and vpd, the vapour pressure deficit
+// (kPa). The kernels work on plain arrays without branches, so the compiler
+// can vectorize them.
+class derivedseries
+{
+public:
+    static bool isDerived(const QString &sensor);
+    // The stored series a derived one is computed from, in the kernel argument order
+    static QStringList sources(const QString &sensor);
+    // The derived series that change when rows of a stored sensor change
+    static QStringList dependents(const QString &sensor);
+
+    // Merge join of two series sorted by time, keeps the timestamps found in both.
+    // Returns the number of aligned rows.
+    static int align(const qint32* timestampsA, const double* valuesA, int countA,
+                     const qint32* timestampsB, const double* valuesB, int countB,
+                     QVector<qint32> &timestamps, QVector<double> &a, QVector<double> &b);
+    // Computes count values of the derived sensor from aligned temperature and humidity
+    static void evaluate(const QString &sensor, const double* temperature, const double* humidity, double* out, int count);
+
+    static void dewPoint(const double* temperature, const double* humidity, double* out, int count);
+    static void absoluteHumidity(const double* temperature, const double* humidity, double* out, int count);
+    static void vapourPressureDeficit(const double* temperature, const double* humidity, double* out, int count);
+};
+
+#endif // DERIVEDSERIES_H
@@ -20,17 +20,48 @@
 #endif
 
 #include <sailfishapp.h>
+#include <QElapsedTimer>
+#include <QFile>
 #include <QGuiApplication>
 #include <QQmlContext>
 #include <QQuickView>
 #include <QScopedPointer>
+#include <QSharedPointer>
 #include <QtQml>
+#include <unistd.h>
 
 #include "database.h"
+#include "plotitem.h"
 #include "backgroundscanner.h"
+#include "replayscanner.h"
+#include "scanscheduler.h"
+
+// Time since the kernel started the process, covers the loading before main().
+// 0 if /proc can not be read.
+static qint64 processAgeMs()
+{
+    QFile stat("/proc/self/stat");
+    QFile uptime("/proc/uptime");
+    if (!stat.open(QIODevice::ReadOnly) || !uptime.open(QIODevice::ReadOnly)) {
+        return 0;
+    }
+    // The command name may contain spaces, starttime is the 20th field after it
+    const QByteArray line = stat.readAll();
+    const QList<QByteArray> fields = line.mid(line.lastIndexOf(')') + 2).split(' ');
+    if (fields.size() < 20) {
+        return 0;
+    }
+    const double startedS = fields[19].toLongLong() / double(sysconf(_SC_CLK_TCK));
+    const double uptimeS = uptime.readAll().split(' ').value(0).toDouble();
+    return qMax<qint64>(0, qint64((uptimeS - startedS) * 1000.0));
+}
 
 int main(int argc, char *argv[])
 {
+    QElapsedTimer startupTimer;
+    startupTimer.start();
+    const qint64 beforeMainMs = processAgeMs();
+
     // SailfishApp::main() will display "qml/harbour-skruuvi.qml", if you need more
     // control over initialization, you can use:
     //
@@ -46,10 +77,56 @@ int main(int argc, char *argv[])
     QScopedPointer<QQuickView> v(SailfishApp::createView());
 
     // Register c++ classes for QML
+    qmlRegisterType<plotitem>("harbour.skruuvi", 1, 0, "PlotItem");
     database db;
     v->engine()->rootContext()->setContextProperty("db", &db);
-    backgroundscanner bs(nullptr, &db);
-    v->engine()->rootContext()->setContextProperty("bs", &bs);
+    // SKRUUVI_REPLAY_SOURCE plays back a recording instead of scanning with BlueZ,
+    // SKRUUVI_RECORD_ADVERTS records the received advertisements for that
+    QScopedPointer<advertisementsource> bs;
+    const QString replaySource = QString::fromLocal8Bit(qgetenv("SKRUUVI_REPLAY_SOURCE"));
+    if (!replaySource.isEmpty()) {
+        replayscanner* replay = new replayscanner(nullptr, &db);
+        replay->loadRecording(replaySource, 1.0, true);
+        replay->startScan();
+        bs.reset(replay);
+    } else {
+        bs.reset(new backgroundscanner(nullptr, &db));
+    }
+    const QString recordPath = QString::fromLocal8Bit(qgetenv("SKRUUVI_RECORD_ADVERTS"));
+    if (!recordPath.isEmpty()) {
+        bs->setRecordingFile(recordPath);
+    }
+    v->engine()->rootContext()->setContextProperty("bs", bs.data());
+    // Duty cycled scanning, SKRUUVI_SCAN_FRESHNESS enables it with that freshness target in seconds
+    scanscheduler scheduler(bs.data(), &db);
+    const int freshness = qgetenv("SKRUUVI_SCAN_FRESHNESS").toInt();
+    if (freshness > 0) {
+        scheduler.setDefaultFreshnessTarget(freshness);
+        scheduler.setEnabled(true);
+    }
+    v->engine()->rootContext()->setContextProperty("scheduler", &scheduler);
+
+    // Write the coalesced device readings when the app is backgrounded or closed,
+    // and slow down the live reading notifications in the background
+    QObject::connect(app.data(), &QGuiApplication::applicationStateChanged, &db, [&db](Qt::ApplicationState state) {
+        if (state != Qt::ApplicationActive) {
+            db.flushDeviceUpdates();
+        }
+        db.setApplicationActive(state == Qt::ApplicationActive);
+    });
+    QObject::connect(app.data(), &QCoreApplication::aboutToQuit, &db, &database::flushDeviceUpdates);
+
+    // Startup time from the process start to the database being ready and to the first frame
+    QObject::connect(&db, &database::readyChanged, [&startupTimer, beforeMainMs]() {
+        qDebug() << "Startup: database ready after" << beforeMainMs + startupTimer.elapsed() << "ms";
+    });
+    QSharedPointer<QMetaObject::Connection> firstFrame(new QMetaObject::Connection);
+    *firstFrame = QObject::connect(v.data(), &QQuickWindow::frameSwapped, [firstFrame, &startupTimer, beforeMainMs]() {
+        // Emitted on the render thread
+        QObject::disconnect(*firstFrame);
+        qDebug() << "Startup: first frame after" << beforeMainMs + startupTimer.elapsed() << "ms,"
+                 << beforeMainMs << "ms before main()";
+    });
 
     // Start the application.
     v->setSource(SailfishApp::pathTo("qml/harbour-skruuvi.qml"));
@@ -0,0 +1,189 @@
+/*
+    Skruuvi - Reader for Ruuvi sensors
+    Copyright (C) 2025  Miika Malin
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see [http://www.gnu.org/licenses/].
+*/
+#include "latencystats.h"
+#include <QAtomicInt>
+#include <QAtomicInteger>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QDebug>
+#include <cmath>
+
+// HDR style log-linear buckets: every power of two is split into 16 linear
+// sub-buckets, which keeps the relative error of the percentiles below ~6 %
+static const int SUB_BUCKET_BITS = 4;
+static const int SUB_BUCKETS = 1 << SUB_BUCKET_BITS;
+static const int BUCKETS = 64 * SUB_BUCKETS;
+
+static QAtomicInt histograms[latencystats::StageCount][BUCKETS];
+static QAtomicInt counts[latencystats::StageCount];
+static QAtomicInteger<qint64> sums[latencystats::StageCount];
+static QAtomicInteger<qint64> maxima[latencystats::StageCount];
+static QAtomicInt counters[latencystats::CounterCount];
+static QAtomicInteger<qint64> countersSince;
+
+static int bucketIndex(quint64 ns) {
+    if (ns < quint64(SUB_BUCKETS)) {
+        return int(ns);
+    }
+    const int msb = 63 - __builtin_clzll(ns);
+    const int shift = msb - SUB_BUCKET_BITS;
+    const int sub = int(ns >> shift) - SUB_BUCKETS;
+    return (shift + 1) * SUB_BUCKETS + sub;
+}
+
+static double bucketMidpoint(int index) {
+    if (index < SUB_BUCKETS) {
+        return index;
+    }
+    const int shift = index / SUB_BUCKETS - 1;
+    const int sub = index % SUB_BUCKETS;
+    const double lower = double(quint64(SUB_BUCKETS + sub) << shift);
+    return lower + double(quint64(1) << shift) / 2.0;
+}
+
+qint64 latencystats::now() {
+    static const QElapsedTimer clock = []() {
+        QElapsedTimer timer;
+        timer.start();
+        return timer;
+    }();
+    return clock.nsecsElapsed();
+}
+
+void latencystats::record(Stage stage, qint64 ns) {
+    if (ns < 0) {
+        ns = 0;
+    }
+    histograms[stage][bucketIndex(quint64(ns))].ref();
+    counts[stage].ref();
+    sums[stage].fetchAndAddRelaxed(ns);
+    qint64 current = maxima[stage].load();
+    while (ns > current && !maxima[stage].testAndSetRelaxed(current, ns, current)) {
+    }
+}
+
+void latencystats::increment(Counter counter, int amount) {
+    counters[counter].fetchAndAddRelaxed(amount);
+}
+
+QString latencystats::stageName(Stage stage) {
+    switch (stage) {
+        case BluezSignal: return "bluez_signal";
+        case ParseManufacturerData: return "parse_manufacturer_data";
+        case IngestTotal: return "ingest_total";
+        case DecodeAdvertisement: return "decode_advertisement";
+        case SensorInsert: return "sensor_insert";
+        case QmlSignal: return "qml_signal";
+        case PlotQueue: return "plot_queue";
+        case PlotWorker: return "plot_worker";
+        case PlotDelivery: return "plot_delivery";
+        case PlotQml: return "plot_qml";
+        default: return "unknown";
+    }
+}
+
+QString latencystats::counterName(Counter counter) {
+    switch (counter) {
+        case BluezSignals: return "bluez_signals";
+        case IgnoredBluezSignals: return "ignored_bluez_signals";
+        case Advertisements: return "advertisements";
+        case UnknownDataFormat: return "unknown_data_format";
+        case SensorRowsInserted: return "sensor_rows_inserted";
+        case PlotRequests: return "plot_requests";
+        case PlotTileHits: return "plot_tile_hits";
+        case PlotTileMisses: return "plot_tile_misses";
+        case PlotTilePrefetches: return "plot_tile_prefetches";
+        case UiUpdatesCoalesced: return "ui_updates_coalesced";
+        case UiNotifications: return "ui_notifications";
+        case UiHandlerCalls: return "ui_handler_calls";
+        default: return "unknown";
+    }
+}
+
+QVariantMap latencystats::snapshot() {
+    QVariantMap stages;
+    for (int s = 0; s < StageCount; ++s) {
+        const int count = counts[s].load();
+        QVariantMap stage;
+        stage["count"] = count;
+        stage["meanUs"] = count > 0 ? sums[s].load() / 1000.0 / count : 0.0;
+        stage["maxUs"] = maxima[s].load() / 1000.0;
+
+        // Walk the histogram once for all percentiles
+        const double percentiles[] = {0.50, 0.90, 0.99};
+        const char* keys[] = {"p50Us", "p90Us", "p99Us"};
+        int next = 0;
+        qint64 seen = 0;
+        for (int b = 0; b < BUCKETS && next < 3 && count > 0; ++b) {
+            seen += histograms[s][b].load();
+            while (next < 3 && seen >= qMax<qint64>(1, qint64(std::ceil(percentiles[next] * count)))) {
+                stage[keys[next]] = bucketMidpoint(b) / 1000.0;
+                ++next;
+            }
+        }
+        for (; next < 3; ++next) {
+            stage[keys[next]] = 0.0;
+        }
+        stages[stageName(Stage(s))] = stage;
+    }
+
+    QVariantMap counterValues;
+    for (int c = 0; c < CounterCount; ++c) {
+        counterValues[counterName(Counter(c))] = counters[c].load();
+    }
+
+    // Counters per minute since the start or the last reset
+    const double minutes = (now() - countersSince.load()) / 60e9;
+    QVariantMap counterRates;
+    for (int c = 0; c < CounterCount; ++c) {
+        counterRates[counterName(Counter(c))] = minutes > 0.0 ? counters[c].load() / minutes : 0.0;
+    }
+
+    QVariantMap result;
+    result["stages"] = stages;
+    result["counters"] = counterValues;
+    result["countersPerMinute"] = counterRates;
+    return result;
+}
+
+bool latencystats::dump(const QString &path) {
+    QFile file(path);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        qWarning() << "Could not write latency statistics:" << file.errorString();
+        return false;
+    }
+    file.write(QJsonDocument(QJsonObject::fromVariantMap(snapshot())).toJson());
+    return true;
+}
+
+void latencystats::reset() {
+    for (int s = 0; s < StageCount; ++s) {
+        for (int b = 0; b < BUCKETS; ++b) {
+            histograms[s][b].store(0);
+        }
+        counts[s].store(0);
+        sums[s].store(0);
+        maxima[s].store(0);
+    }
+    for (int c = 0; c < CounterCount; ++c) {
+        counters[c].store(0);
+    }
+    countersSince.store(now());
+}
@@ -0,0 +1,83 @@
+/*
+    Skruuvi - Reader for Ruuvi sensors
+    Copyright (C) 2025  Miika Malin
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see [http://www.gnu.org/licenses/].
+*/
+#ifndef LATENCYSTATS_H
+#define LATENCYSTATS_H
+
+#include <QString>
+#include <QVariantMap>
+
+// Always-on latency histograms and counters for the ingest and plot
+// pipelines. Recording is a few atomic increments, nothing runs while idle.
+class latencystats
+{
+public:
+    enum Stage {
+        // Ingest: backgroundscanner -> database::inputManufacturerData -> insertSensorData
+        BluezSignal,            // Whole D-Bus signal handler in the scanner
+        ParseManufacturerData,  // Unmarshalling ManufacturerData from D-Bus
+        IngestTotal,            // database::inputManufacturerData
+        DecodeAdvertisement,    // DF5/DF6 decoding
+        SensorInsert,           // insertSensorData incl. the SQLite commit
+        QmlSignal,              // Emitting the device update to QML handlers
+        // Plot: requestPlotData -> worker::plotData -> plotDataReady
+        PlotQueue,              // Request until the worker starts
+        PlotWorker,             // worker::plotData
+        PlotDelivery,           // Worker result until back on the GUI thread
+        PlotQml,                // Emitting plotDataReady to QML handlers
+        StageCount
+    };
+
+    enum Counter {
+        BluezSignals,
+        IgnoredBluezSignals,
+        Advertisements,
+        UnknownDataFormat,
+        SensorRowsInserted,
+        PlotRequests,
+        PlotTileHits,           // Plot tiles served from memory
+        PlotTileMisses,         // Plot tiles built while the plot waited
+        PlotTilePrefetches,     // Plot tiles built ahead in the background
+        UiUpdatesCoalesced,     // Live readings replaced by a newer one before reaching QML
+        UiNotifications,        // devicesUpdated batches
+        UiHandlerCalls,         // devicesUpdated batches times the connected handlers
+        CounterCount
+    };
+
+    static qint64 now();
+    static void record(Stage stage, qint64 ns);
+    static void increment(Counter counter, int amount = 1);
+    static QVariantMap snapshot();
+    static bool dump(const QString &path);
+    static void reset();
+    static QString stageName(Stage stage);
+    static QString counterName(Counter counter);
+};
+
+// Records the lifetime of the scope to a stage
+class latencyscope
+{
+public:
+    explicit latencyscope(latencystats::Stage stage) : stage(stage), start(latencystats::now()) {}
+    ~latencyscope() { latencystats::record(stage, latencystats::now() - start); }
+
+private:
+    latencystats::Stage stage;
+    qint64 start;
+};
+
+#endif // LATENCYSTATS_H
@@ -0,0 +1,315 @@
+/*
+    Skruuvi - Reader for Ruuvi sensors
+    Copyright (C) 2025  Miika Malin
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see [http://www.gnu.org/licenses/].
+*/
+#include "plotcache.h"
+#include <QDebug>
+#include <QDir>
+#include <QMutexLocker>
+#include <QSaveFile>
+#include <algorithm>
+
+// Every INDEX_STRIDE:th timestamp goes to the sparse index, so a range lookup
+// touches a few pages of the index and one block of the timestamps
+static const int INDEX_STRIDE = 1024;
+
+int plotcolumns::lowerBound(qint32 timestamp) const
+{
+    if (rows == 0) {
+        return 0;
+    }
+    const int block = int(std::lower_bound(indexData, indexData + indexRows, timestamp) - indexData);
+    if (block == 0) {
+        return 0;
+    }
+    const int begin = (block - 1) * INDEX_STRIDE;
+    const int end = block < indexRows ? block * INDEX_STRIDE + 1 : rows;
+    return int(std::lower_bound(timestampData + begin, timestampData + end, timestamp) - timestampData);
+}
+
+plotcache::plotcache(const QString &directory)
+    : directory(directory)
+{
+}
+
+plotcache::~plotcache()
+{
+    for (auto it = columns.begin(); it != columns.end(); ++it) {
+        closeWriters(it.value());
+    }
+}
+
+QString plotcache::basePath(const QString &mac, const QString &sensor) const
+{
+    return directory + "/" + QString(mac).remove(':') + "_" + sensor;
+}
+
+plotcache::column& plotcache::load(const QString &mac, const QString &sensor)
+{
+    column &c = columns[mac + "/" + sensor];
+    if (c.loaded) {
+        return c;
+    }
+    c.loaded = true;
+    const QString base = basePath(mac, sensor);
+    QFile timestampFile(base + ".ts");
+    QFile valueFile(base + ".val");
+    QFile indexFile(base + ".idx");
+    c.exists = timestampFile.exists() && valueFile.exists() && indexFile.exists();
+    if (!c.exists) {
+        return c;
+    }
+
+    // An append may have been cut short, only the rows found in both columns count
+    c.rows = int(qMin(timestampFile.size() / qint64(sizeof(qint32)), valueFile.size() / qint64(sizeof(double))));
+    const int indexRows = (c.rows + INDEX_STRIDE - 1) / INDEX_STRIDE;
+    if (timestampFile.size() != c.rows * qint64(sizeof(qint32))) {
+        timestampFile.resize(c.rows * qint64(sizeof(qint32)));
+    }
+    if (valueFile.size() != c.rows * qint64(sizeof(double))) {
+        valueFile.resize(c.rows * qint64(sizeof(double)));
+    }
+    if (indexFile.size() != indexRows * qint64(sizeof(qint32))) {
+        indexFile.resize(indexRows * qint64(sizeof(qint32)));
+    }
+    if (c.rows > 0 && timestampFile.open(QIODevice::ReadOnly)) {
+        timestampFile.seek((c.rows - 1) * qint64(sizeof(qint32)));
+        timestampFile.read(reinterpret_cast<char*>(&c.newest), sizeof(qint32));
+    }
+    return c;
+}
+
+bool plotcache::openWriters(column &c, const QString &base)
+{
+    if (c.timestampFile) {
+        return true;
+    }
+    c.timestampFile = new QFile(base + ".ts");
+    c.valueFile = new QFile(base + ".val");
+    c.indexFile = new QFile(base + ".idx");
+    if (!c.timestampFile->open(QIODevice::WriteOnly | QIODevice::Append)
+            || !c.valueFile->open(QIODevice::WriteOnly | QIODevice::Append)
+            || !c.indexFile->open(QIODevice::WriteOnly | QIODevice::Append)) {
+        qWarning() << "Could not open the plot cache:" << base;
+        closeWriters(c);
+        return false;
+    }
+    return true;
+}
+
+void plotcache::closeWriters(column &c)
+{
+    delete c.timestampFile;
+    delete c.valueFile;
+    delete c.indexFile;
+    c.timestampFile = nullptr;
+    c.valueFile = nullptr;
+    c.indexFile = nullptr;
+}
+
+void plotcache::drop(column &c, const QString &base)
+{
+    // Readers keep their mappings of the removed files
+    closeWriters(c);
+    QFile::remove(base + ".ts");
+    QFile::remove(base + ".val");
+    QFile::remove(base + ".idx");
+    c.exists = false;
+    c.verified = false;
+    c.rows = 0;
+    c.newest = 0;
+    ++c.generation;
+}
+
+void plotcache::append(const QString &mac, const QString &sensor, const QList<QPair<int, double>> &rows)
+{
+    QMutexLocker locker(&mutex);
+    column &c = load(mac, sensor);
+    if (!c.exists || rows.isEmpty()) {
+        // Created by the first read, not by the inserts
+        return;
+    }
+    const QString base = basePath(mac, sensor);
+
+    QList<QPair<int, double>> sorted = rows;
+    std::stable_sort(sorted.begin(), sorted.end(), [](const QPair<int, double> &a, const QPair<int, double> &b) {
+        return a.first < b.first;
+    });
+    QByteArray timestamps;
+    QByteArray values;
+    QByteArray index;
+    int newRows = 0;
+    qint32 newest = c.newest;
+    for (const auto& row : sorted) {
+        if (c.rows + newRows > 0 && row.first <= newest) {
+            if (row.first == newest) {
+                // Ignored by INSERT OR IGNORE as well
+                continue;
+            }
+            // Older than the cached rows, they can not be appended
+            drop(c, base);
+            return;
+        }
+        const qint32 timestamp = row.first;
+        const double value = row.second;
+        if ((c.rows + newRows) % INDEX_STRIDE == 0) {
+            index.append(reinterpret_cast<const char*>(&timestamp), sizeof(qint32));
+        }
+        timestamps.append(reinterpret_cast<const char*>(&timestamp), sizeof(qint32));
+        values.append(reinterpret_cast<const char*>(&value), sizeof(double));
+        newest = timestamp;
+        ++newRows;
+    }
+    if (newRows == 0) {
+        return;
+    }
+
+    if (!openWriters(c, base)
+            || c.valueFile->write(values) != values.size()
+            || c.timestampFile->write(timestamps) != timestamps.size()
+            || c.indexFile->write(index) != index.size()
+            || !c.valueFile->flush() || !c.timestampFile->flush() || !c.indexFile->flush()) {
+        qWarning() << "Plot cache append failed:" << base;
+        drop(c, base);
+        return;
+    }
+    c.rows += newRows;
+    c.newest = newest;
+    ++c.generation;
+}
+
+void plotcache::removeDevice(const QString &mac)
+{
+    QMutexLocker locker(&mutex);
+    for (auto it = columns.begin(); it != columns.end();) {
+        if (it.key().startsWith(mac + "/")) {
+            closeWriters(it.value());
+            it = columns.erase(it);
+        } else {
+            ++it;
+        }
+    }
+    QDir cacheDir(directory);
+    for (const QString &file : cacheDir.entryList(QStringList() << QString(mac).remove(':') + "_*", QDir::Files)) {
+        cacheDir.remove(file);
+    }
+}
+
+bool plotcache::isVerified(const QString &mac, const QString &sensor)
+{
+    QMutexLocker locker(&mutex);
+    return load(mac, sensor).verified;
+}
+
+bool plotcache::verify(const QString &mac, const QString &sensor, qint64 count, int newest)
+{
+    QMutexLocker locker(&mutex);
+    column &c = load(mac, sensor);
+    c.verified = c.exists && c.rows == count && (count == 0 || c.newest == newest);
+    return c.verified;
+}
+
+int plotcache::generation(const QString &mac, const QString &sensor)
+{
+    QMutexLocker locker(&mutex);
+    return load(mac, sensor).generation;
+}
+
+bool plotcache::rebuild(const QString &mac, const QString &sensor, const QVector<qint32> &timestamps,
+                        const QVector<double> &values, int generation)
+{
+    if (!QDir().mkpath(directory)) {
+        qWarning() << "Could not create the plot cache folder:" << directory;
+        return false;
+    }
+    const QString base = basePath(mac, sensor);
+    QVector<qint32> index;
+    for (int i = 0; i < timestamps.size(); i += INDEX_STRIDE) {
+        index.append(timestamps[i]);
+    }
+
+    // Written next to the old files and renamed over them, outside of the lock
+    QSaveFile timestampFile(base + ".ts");
+    QSaveFile valueFile(base + ".val");
+    QSaveFile indexFile(base + ".idx");
+    const qint64 timestampBytes = timestamps.size() * qint64(sizeof(qint32));
+    const qint64 valueBytes = values.size() * qint64(sizeof(double));
+    const qint64 indexBytes = index.size() * qint64(sizeof(qint32));
+    if (!timestampFile.open(QIODevice::WriteOnly) || !valueFile.open(QIODevice::WriteOnly) || !indexFile.open(QIODevice::WriteOnly)
+            || timestampFile.write(reinterpret_cast<const char*>(timestamps.constData()), timestampBytes) != timestampBytes
+            || valueFile.write(reinterpret_cast<const char*>(values.constData()), valueBytes) != valueBytes
+            || indexFile.write(reinterpret_cast<const char*>(index.constData()), indexBytes) != indexBytes) {
+        qWarning() << "Plot cache rebuild failed:" << base;
+        return false;
+    }
+
+    QMutexLocker locker(&mutex);
+    column &c = load(mac, sensor);
+    if (c.generation != generation) {
+        // Rows were appended after SQLite was read, try again on the next read
+        timestampFile.cancelWriting();
+        valueFile.cancelWriting();
+        indexFile.cancelWriting();
+        return false;
+    }
+    closeWriters(c);
+    if (!valueFile.commit() || !timestampFile.commit() || !indexFile.commit()) {
+        qWarning() << "Plot cache rebuild failed:" << base;
+        drop(c, base);
+        return false;
+    }
+    c.exists = true;
+    c.verified = true;
+    c.rows = timestamps.size();
+    c.newest = timestamps.isEmpty() ? 0 : timestamps.last();
+    ++c.generation;
+    return true;
+}
+
+plotcolumns plotcache::map(const QString &mac, const QString &sensor)
+{
+    QMutexLocker locker(&mutex);
+    plotcolumns view;
+    column &c = load(mac, sensor);
+    if (!c.exists) {
+        return view;
+    }
+    view.rows = c.rows;
+    view.indexRows = (c.rows + INDEX_STRIDE - 1) / INDEX_STRIDE;
+    if (c.rows == 0) {
+        view.valid = true;
+        return view;
+    }
+
+    const QString base = basePath(mac, sensor);
+    QSharedPointer<QFile> timestampFile(new QFile(base + ".ts"));
+    QSharedPointer<QFile> valueFile(new QFile(base + ".val"));
+    QSharedPointer<QFile> indexFile(new QFile(base + ".idx"));
+    if (!timestampFile->open(QIODevice::ReadOnly) || !valueFile->open(QIODevice::ReadOnly) || !indexFile->open(QIODevice::ReadOnly)) {
+        qWarning() << "Could not open the plot cache:" << base;
+        return view;
+    }
+    view.timestampData = reinterpret_cast<const qint32*>(timestampFile->map(0, view.rows * qint64(sizeof(qint32))));
+    view.valueData = reinterpret_cast<const double*>(valueFile->map(0, view.rows * qint64(sizeof(double))));
+    view.indexData = reinterpret_cast<const qint32*>(indexFile->map(0, view.indexRows * qint64(sizeof(qint32))));
+    if (!view.timestampData || !view.valueData || !view.indexData) {
+        qWarning() << "Could not map the plot cache:" << base;
+        return plotcolumns();
+    }
+    view.files << timestampFile << valueFile << indexFile;
+    view.valid = true;
+    return view;
+}
@@ -0,0 +1,105 @@
+/*
+    Skruuvi - Reader for Ruuvi sensors
+    Copyright (C) 2025  Miika Malin
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see [http://www.gnu.org/licenses/].
+*/
+#ifndef PLOTCACHE_H
+#define PLOTCACHE_H
+
+#include <QFile>
+#include <QHash>
+#include <QList>
+#include <QMutex>
+#include <QPair>
+#include <QSharedPointer>
+#include <QString>
+#include <QVector>
+
+// Read-only view of the memory mapped columns of one device and sensor.
+// The mapping stays valid as long as the view exists, also if the cache
+// is rebuilt or removed meanwhile.
+class plotcolumns
+{
+public:
+    bool isValid() const { return valid; }
+    int count() const { return rows; }
+    const qint32* timestamps() const { return timestampData; }
+    const double* values() const { return valueData; }
+    // Index of the first row with a timestamp >= timestamp, count() if none
+    int lowerBound(qint32 timestamp) const;
+
+private:
+    friend class plotcache;
+    bool valid = false;
+    int rows = 0;
+    int indexRows = 0;
+    const qint32* timestampData = nullptr;
+    const double* valueData = nullptr;
+    const qint32* indexData = nullptr;
+    QList<QSharedPointer<QFile>> files;
+};
+
+// On-disk columnar copy of the sensor tables for plotting: per device and
+// sensor an array of int32 timestamps, an array of double values and a
+// sparse index with every INDEX_STRIDE:th timestamp. The files are only
+// appended to; SQLite stays the source of truth and the cache is rebuilt
+// from it when it does not match.
+class plotcache
+{
+public:
+    explicit plotcache(const QString &directory);
+    ~plotcache();
+
+    // Appends rows newer than the cached ones. Older rows drop the cache,
+    // the next read rebuilds it.
+    void append(const QString &mac, const QString &sensor, const QList<QPair<int, double>> &rows);
+    void removeDevice(const QString &mac);
+
+    // Checked against SQLite during this run
+    bool isVerified(const QString &mac, const QString &sensor);
+    // Compares with the row count and newest timestamp of SQLite
+    bool verify(const QString &mac, const QString &sensor, qint64 count, int newest);
+    // Changes on every append, a rebuild from an older state is not trusted
+    int generation(const QString &mac, const QString &sensor);
+    bool rebuild(const QString &mac, const QString &sensor, const QVector<qint32> &timestamps,
+                 const QVector<double> &values, int generation);
+
+    plotcolumns map(const QString &mac, const QString &sensor);
+
+private:
+    struct column {
+        QFile* timestampFile = nullptr;
+        QFile* valueFile = nullptr;
+        QFile* indexFile = nullptr;
+        bool loaded = false;
+        bool exists = false;
+        bool verified = false;
+        int rows = 0;
+        qint32 newest = 0;
+        int generation = 0;
+    };
+
+    QString directory;
+    QMutex mutex;
+    QHash<QString, column> columns;
+
+    QString basePath(const QString &mac, const QString &sensor) const;
+    column& load(const QString &mac, const QString &sensor);
+    bool openWriters(column &c, const QString &base);
+    void closeWriters(column &c);
+    void drop(column &c, const QString &base);
+};
+
+#endif // PLOTCACHE_H
@@ -0,0 +1,296 @@
+/*
+    Skruuvi - Reader for Ruuvi sensors
+    Copyright (C) 2025  Miika Malin
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see [http://www.gnu.org/licenses/].
+*/
+#include "plotitem.h"
+#include <QMatrix4x4>
+#include <QSGFlatColorMaterial>
+#include <QSGGeometryNode>
+#include <QSGTransformNode>
+#include <limits>
+
+plotitem::plotitem(QQuickItem *parent)
+    : QQuickItem(parent)
+{
+    setFlag(ItemHasContents, true);
+}
+
+QVector<QPointF> plotitem::toPoints(const QVariant &points)
+{
+    if (points.userType() == qMetaTypeId<QVector<QPointF>>()) {
+        return points.value<QVector<QPointF>>();
+    }
+    // {x, y} maps, e.g. the raw data of the full screen graph
+    const QVariantList list = points.toList();
+    QVector<QPointF> result;
+    result.reserve(list.size());
+    for (const QVariant &point : list) {
+        const QVariantMap map = point.toMap();
+        result.append(QPointF(map.value("x").toDouble(), map.value("y").toDouble()));
+    }
+    return result;
+}
+
+void plotitem::setSeries(int index, const QVariant &points, const QColor &color)
+{
+    if (index < 0) {
+        return;
+    }
+    if (index >= seriesList.size()) {
+        seriesList.resize(index + 1);
+    }
+    series &s = seriesList[index];
+    s.points = toPoints(points);
+    s.color = color;
+    s.originX = s.points.isEmpty() ? 0.0 : s.points.first().x();
+    s.dirty = true;
+    updateBounds();
+    update();
+}
+
+void plotitem::clear()
+{
+    seriesList.clear();
+    updateBounds();
+    update();
+}
+
+int plotitem::count() const
+{
+    int points = 0;
+    for (const series &s : seriesList) {
+        points += s.points.size();
+    }
+    return points;
+}
+
+void plotitem::updateBounds()
+{
+    window found;
+    found.minX = found.minY = std::numeric_limits<qreal>::max();
+    found.maxX = found.maxY = std::numeric_limits<qreal>::lowest();
+    for (const series &s : seriesList) {
+        for (const QPointF &point : s.points) {
+            found.minX = qMin(found.minX, point.x());
+            found.maxX = qMax(found.maxX, point.x());
+            found.minY = qMin(found.minY, point.y());
+            found.maxY = qMax(found.maxY, point.y());
+        }
+    }
+    bounds = found.minX <= found.maxX ? found : window();
+    last = !seriesList.isEmpty() && !seriesList.first().points.isEmpty() ? seriesList.first().points.last().y() : 0;
+    emit dataChanged();
+}
+
+void plotitem::fitView()
+{
+    setView(bounds.minX, bounds.maxX, bounds.minY, bounds.maxY);
+}
+
+void plotitem::zoom(qreal factor, qreal centerX)
+{
+    if (factor <= 0 || width() <= 0) {
+        return;
+    }
+    const qreal center = view.minX + (view.maxX - view.minX) * centerX / width();
+    setView(center - (center - view.minX) / factor, center + (view.maxX - center) / factor, view.minY, view.maxY);
+}
+
+void plotitem::pan(qreal dx)
+{
+    if (width() <= 0) {
+        return;
+    }
+    const qreal shift = -dx * (view.maxX - view.minX) / width();
+    setView(view.minX + shift, view.maxX + shift, view.minY, view.maxY);
+}
+
+void plotitem::setView(qreal minX, qreal maxX, qreal minY, qreal maxY)
+{
+    if (minX == view.minX && maxX == view.maxX && minY == view.minY && maxY == view.maxY) {
+        return;
+    }
+    view.minX = minX;
+    view.maxX = maxX;
+    view.minY = minY;
+    view.maxY = maxY;
+    emit viewChanged();
+    update();
+}
+
+void plotitem::setLineColor(const QColor &color)
+{
+    if (style.lineColor == color) {
+        return;
+    }
+    style.lineColor = color;
+    for (series &s : seriesList) {
+        s.dirty = true;
+    }
+    emit appearanceChanged();
+    update();
+}
+
+void plotitem::setLineWidth(qreal width)
+{
+    if (style.lineWidth == width) {
+        return;
+    }
+    style.lineWidth = width;
+    for (series &s : seriesList) {
+        s.dirty = true;
+    }
+    emit appearanceChanged();
+    update();
+}
+
+void plotitem::setGridColor(const QColor &color)
+{
+    if (style.gridColor == color) {
+        return;
+    }
+    style.gridColor = color;
+    gridDirty = true;
+    emit appearanceChanged();
+    update();
+}
+
+void plotitem::setGridLines(int lines)
+{
+    if (style.gridLines == lines) {
+        return;
+    }
+    style.gridLines = lines;
+    gridDirty = true;
+    emit appearanceChanged();
+    update();
+}
+
+void plotitem::setViewMinX(qreal value)
+{
+    setView(value, view.maxX, view.minY, view.maxY);
+}
+
+void plotitem::setViewMaxX(qreal value)
+{
+    setView(view.minX, value, view.minY, view.maxY);
+}
+
+void plotitem::setViewMinY(qreal value)
+{
+    setView(view.minX, view.maxX, value, view.maxY);
+}
+
+void plotitem::setViewMaxY(qreal value)
+{
+    setView(view.minX, view.maxX, view.minY, value);
+}
+
+void plotitem::geometryChanged(const QRectF &newGeometry, const QRectF &oldGeometry)
+{
+    QQuickItem::geometryChanged(newGeometry, oldGeometry);
+    if (newGeometry.size() != oldGeometry.size()) {
+        gridDirty = true;
+        update();
+    }
+}
+
+static QSGGeometryNode* createLineNode(int vertices, GLenum mode)
+{
+    QSGGeometryNode* node = new QSGGeometryNode;
+    QSGGeometry* geometry = new QSGGeometry(QSGGeometry::defaultAttributes_Point2D(), vertices);
+    geometry->setDrawingMode(mode);
+    node->setGeometry(geometry);
+    node->setFlag(QSGNode::OwnsGeometry);
+    node->setMaterial(new QSGFlatColorMaterial);
+    node->setFlag(QSGNode::OwnsMaterial);
+    return node;
+}
+
+QSGNode *plotitem::updatePaintNode(QSGNode *oldNode, UpdatePaintNodeData *)
+{
+    // The first child is the grid, then one transform node per series
+    QSGNode* root = oldNode;
+    if (!root) {
+        root = new QSGNode;
+        root->appendChildNode(createLineNode(0, GL_LINES));
+        gridDirty = true;
+    }
+
+    QSGGeometryNode* grid = static_cast<QSGGeometryNode*>(root->firstChild());
+    if (gridDirty) {
+        const int lines = qMax(0, style.gridLines - 1);
+        QSGGeometry* geometry = grid->geometry();
+        geometry->allocate(lines * 2);
+        QSGGeometry::Point2D* vertices = geometry->vertexDataAsPoint2D();
+        for (int i = 0; i < lines; ++i) {
+            const float y = float(height() / style.gridLines * (i + 1));
+            vertices[i * 2].set(0, y);
+            vertices[i * 2 + 1].set(float(width()), y);
+        }
+        geometry->setLineWidth(1);
+        QColor color = style.gridColor;
+        color.setAlphaF(color.alphaF() * 0.4);
+        static_cast<QSGFlatColorMaterial*>(grid->material())->setColor(color);
+        grid->markDirty(QSGNode::DirtyGeometry | QSGNode::DirtyMaterial);
+        gridDirty = false;
+    }
+
+    while (root->childCount() - 1 > seriesList.size()) {
+        QSGNode* extra = root->lastChild();
+        root->removeChildNode(extra);
+        delete extra;
+    }
+    while (root->childCount() - 1 < seriesList.size()) {
+        QSGTransformNode* transform = new QSGTransformNode;
+        transform->appendChildNode(createLineNode(0, GL_LINE_STRIP));
+        root->appendChildNode(transform);
+        seriesList[root->childCount() - 2].dirty = true;
+    }
+
+    const qreal spanX = view.maxX - view.minX;
+    const qreal spanY = view.maxY - view.minY;
+    const qreal scaleX = spanX > 0 ? width() / spanX : 1;
+    const qreal scaleY = spanY > 0 ? height() / spanY : 1;
+    QSGNode* child = grid->nextSibling();
+    for (int i = 0; i < seriesList.size(); ++i, child = child->nextSibling()) {
+        series &s = seriesList[i];
+        QSGTransformNode* transform = static_cast<QSGTransformNode*>(child);
+        if (s.dirty) {
+            // Uploaded once, x relative to the first point so float is precise enough
+            QSGGeometryNode* line = static_cast<QSGGeometryNode*>(transform->firstChild());
+            QSGGeometry* geometry = line->geometry();
+            geometry->allocate(s.points.size());
+            QSGGeometry::Point2D* vertices = geometry->vertexDataAsPoint2D();
+            for (int p = 0; p < s.points.size(); ++p) {
+                vertices[p].set(float(s.points[p].x() - s.originX), float(s.points[p].y()));
+            }
+            // Line widths are in pixels, they are not affected by the transform
+            geometry->setLineWidth(float(style.lineWidth));
+            static_cast<QSGFlatColorMaterial*>(line->material())->setColor(s.color.isValid() ? s.color : style.lineColor);
+            line->markDirty(QSGNode::DirtyGeometry | QSGNode::DirtyMaterial);
+            s.dirty = false;
+        }
+
+        // Data to item coordinates, y grows upwards
+        QMatrix4x4 matrix;
+        matrix.translate(0, float(height()));
+        matrix.scale(float(scaleX), float(-scaleY));
+        matrix.translate(float(s.originX - view.minX), float(-view.minY));
+        transform->setMatrix(matrix);
+    }
+    return root;
+}
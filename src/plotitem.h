@@ -0,0 +1,132 @@
+/*
+    Skruuvi - Reader for Ruuvi sensors
+    Copyright (C) 2025  Miika Malin
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see [http://www.gnu.org/licenses/].
+*/
+#ifndef PLOTITEM_H
+#define PLOTITEM_H
+
+#include <QColor>
+#include <QPointF>
+#include <QQuickItem>
+#include <QVariant>
+#include <QVector>
+
+// Line plot drawn by the scene graph. Every series is one vertex buffer in
+// data coordinates below a transform node, so panning and zooming only
+// change the transform matrices and the vertices are uploaded once per
+// setSeries.
+class plotitem : public QQuickItem
+{
+    Q_OBJECT
+    Q_PROPERTY(QColor lineColor READ lineColor WRITE setLineColor NOTIFY appearanceChanged)
+    Q_PROPERTY(qreal lineWidth READ lineWidth WRITE setLineWidth NOTIFY appearanceChanged)
+    Q_PROPERTY(QColor gridColor READ gridColor WRITE setGridColor NOTIFY appearanceChanged)
+    // Number of horizontal grid divisions, 0 for no grid
+    Q_PROPERTY(int gridLines READ gridLines WRITE setGridLines NOTIFY appearanceChanged)
+    // The visible window in data coordinates
+    Q_PROPERTY(qreal viewMinX READ viewMinX WRITE setViewMinX NOTIFY viewChanged)
+    Q_PROPERTY(qreal viewMaxX READ viewMaxX WRITE setViewMaxX NOTIFY viewChanged)
+    Q_PROPERTY(qreal viewMinY READ viewMinY WRITE setViewMinY NOTIFY viewChanged)
+    Q_PROPERTY(qreal viewMaxY READ viewMaxY WRITE setViewMaxY NOTIFY viewChanged)
+    // Bounds of all series, and the last value of the first one
+    Q_PROPERTY(int count READ count NOTIFY dataChanged)
+    Q_PROPERTY(qreal dataMinX READ dataMinX NOTIFY dataChanged)
+    Q_PROPERTY(qreal dataMaxX READ dataMaxX NOTIFY dataChanged)
+    Q_PROPERTY(qreal dataMinY READ dataMinY NOTIFY dataChanged)
+    Q_PROPERTY(qreal dataMaxY READ dataMaxY NOTIFY dataChanged)
+    Q_PROPERTY(qreal lastValue READ lastValue NOTIFY dataChanged)
+
+public:
+    explicit plotitem(QQuickItem *parent = nullptr);
+
+    // Points as QVector<QPointF> from the plot worker, or a list of {x, y} maps.
+    // An invalid color uses lineColor.
+    Q_INVOKABLE void setSeries(int index, const QVariant &points, const QColor &color = QColor());
+    Q_INVOKABLE void clear();
+    // Shows all the data
+    Q_INVOKABLE void fitView();
+    // Scales the x window around the given x pixel, factor > 1 zooms in
+    Q_INVOKABLE void zoom(qreal factor, qreal centerX);
+    // Moves the x window by the given amount of pixels
+    Q_INVOKABLE void pan(qreal dx);
+
+    static QVector<QPointF> toPoints(const QVariant &points);
+
+    QColor lineColor() const { return style.lineColor; }
+    void setLineColor(const QColor &color);
+    qreal lineWidth() const { return style.lineWidth; }
+    void setLineWidth(qreal width);
+    QColor gridColor() const { return style.gridColor; }
+    void setGridColor(const QColor &color);
+    int gridLines() const { return style.gridLines; }
+    void setGridLines(int lines);
+    qreal viewMinX() const { return view.minX; }
+    void setViewMinX(qreal value);
+    qreal viewMaxX() const { return view.maxX; }
+    void setViewMaxX(qreal value);
+    qreal viewMinY() const { return view.minY; }
+    void setViewMinY(qreal value);
+    qreal viewMaxY() const { return view.maxY; }
+    void setViewMaxY(qreal value);
+    int count() const;
+    qreal dataMinX() const { return bounds.minX; }
+    qreal dataMaxX() const { return bounds.maxX; }
+    qreal dataMinY() const { return bounds.minY; }
+    qreal dataMaxY() const { return bounds.maxY; }
+    qreal lastValue() const { return last; }
+
+signals:
+    void appearanceChanged();
+    void viewChanged();
+    void dataChanged();
+
+protected:
+    QSGNode *updatePaintNode(QSGNode *oldNode, UpdatePaintNodeData *) override;
+    void geometryChanged(const QRectF &newGeometry, const QRectF &oldGeometry) override;
+
+private:
+    struct series {
+        QVector<QPointF> points;
+        QColor color;
+        // Subtracted from x before it is stored as float, the timestamps do not fit
+        double originX = 0.0;
+        bool dirty = true;
+    };
+    QVector<series> seriesList;
+    bool gridDirty = true;
+
+    struct appearance {
+        QColor lineColor = Qt::white;
+        qreal lineWidth = 3;
+        QColor gridColor = Qt::gray;
+        int gridLines = 4;
+    };
+    appearance style;
+    struct window {
+        qreal minX = 0;
+        qreal maxX = 0;
+        qreal minY = 0;
+        qreal maxY = 0;
+    };
+    window view;
+    window bounds;
+    qreal last = 0;
+
+    void updateBounds();
+    void setView(qreal minX, qreal maxX, qreal minY, qreal maxY);
+};
+
+#endif // PLOTITEM_H
@@ -0,0 +1,225 @@
+/*
+    Skruuvi - Reader for Ruuvi sensors
+    Copyright (C) 2025  Miika Malin
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see [http://www.gnu.org/licenses/].
+*/
+#include "queryprofiler.h"
+#include <QAtomicInt>
+#include <QElapsedTimer>
+#include <QHash>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QSqlDriver>
+#include <QSqlResult>
+#include <QStringList>
+#include <QDebug>
+#include <algorithm>
+
+namespace {
+
+struct statementStats {
+    qint64 count = 0;
+    qint64 slowCount = 0;
+    qint64 totalNs = 0;
+    qint64 maxNs = 0;
+    bool planCaptured = false;
+    QString plan;
+};
+
+QAtomicInt profilingEnabled;
+QAtomicInt slowThresholdMs(50);
+QMutex statsMutex;
+QHash<QString, statementStats> statistics;
+
+// SELECTs are timed from exec until finish, so the row fetching is included
+QElapsedTimer& selectClock(const QSqlQuery &query) {
+    static thread_local QHash<const QSqlResult*, QElapsedTimer> clocks;
+    return clocks[query.result()];
+}
+
+QVariantList boundValues(const QSqlQuery &query) {
+    QVariantList values;
+    const int count = query.boundValues().size();
+    for (int i = 0; i < count; ++i) {
+        values.append(query.boundValue(i));
+    }
+    return values;
+}
+
+QString describeValues(const QVariantList &values) {
+    QStringList parts;
+    for (const QVariant &value : values) {
+        if (value.type() == QVariant::List) {
+            parts << QString("[%1 values]").arg(value.toList().size());
+        } else {
+            parts << value.toString();
+        }
+    }
+    return parts.join(", ");
+}
+
+QString queryPlan(const QSqlQuery &query, const QString &statement, const QVariantList &values) {
+    // Run on the same connection, with the first row of batch values
+    QSqlQuery explain(query.driver()->createResult());
+    if (!explain.prepare("EXPLAIN QUERY PLAN " + statement)) {
+        return QString();
+    }
+    for (int i = 0; i < values.size(); ++i) {
+        const QVariant &value = values[i];
+        explain.bindValue(i, value.type() == QVariant::List ? value.toList().value(0) : value);
+    }
+    QStringList plan;
+    if (explain.exec()) {
+        while (explain.next()) {
+            // Columns: id, parent, notused, detail
+            plan << explain.value(3).toString();
+        }
+    }
+    explain.finish();
+    return plan.join("\n");
+}
+
+}
+
+void queryprofiler::setEnabled(bool enabled, int slowThreshold) {
+    slowThresholdMs.store(qMax(0, slowThreshold));
+    profilingEnabled.store(enabled ? 1 : 0);
+}
+
+bool queryprofiler::isEnabled() {
+    return profilingEnabled.load() != 0;
+}
+
+bool queryprofiler::exec(QSqlQuery &query) {
+    if (!isEnabled()) {
+        return query.exec();
+    }
+    QElapsedTimer timer;
+    timer.start();
+    const bool ok = query.exec();
+    if (ok && query.isSelect()) {
+        selectClock(query) = timer;
+    } else {
+        record(query, query.lastQuery(), timer.nsecsElapsed(), false);
+    }
+    return ok;
+}
+
+bool queryprofiler::exec(QSqlQuery &query, const QString &statement) {
+    if (!isEnabled()) {
+        return query.exec(statement);
+    }
+    QElapsedTimer timer;
+    timer.start();
+    const bool ok = query.exec(statement);
+    if (ok && query.isSelect()) {
+        selectClock(query) = timer;
+    } else {
+        record(query, statement, timer.nsecsElapsed(), false);
+    }
+    return ok;
+}
+
+bool queryprofiler::execBatch(QSqlQuery &query) {
+    if (!isEnabled()) {
+        return query.execBatch();
+    }
+    QElapsedTimer timer;
+    timer.start();
+    const bool ok = query.execBatch();
+    record(query, query.lastQuery(), timer.nsecsElapsed(), true);
+    return ok;
+}
+
+void queryprofiler::finish(QSqlQuery &query) {
+    if (isEnabled() && query.isSelect()) {
+        QElapsedTimer &timer = selectClock(query);
+        if (timer.isValid()) {
+            const qint64 ns = timer.nsecsElapsed();
+            timer.invalidate();
+            query.finish();
+            record(query, query.lastQuery(), ns, false);
+            return;
+        }
+    }
+    query.finish();
+}
+
+void queryprofiler::record(QSqlQuery &query, const QString &statement, qint64 ns, bool batch) {
+    const bool slow = ns >= qint64(slowThresholdMs.load()) * 1000000;
+    bool capturePlan = false;
+    {
+        QMutexLocker locker(&statsMutex);
+        statementStats &stats = statistics[statement];
+        ++stats.count;
+        stats.totalNs += ns;
+        stats.maxNs = qMax(stats.maxNs, ns);
+        if (slow) {
+            ++stats.slowCount;
+            capturePlan = !stats.planCaptured;
+            stats.planCaptured = true;
+        }
+    }
+    if (!slow) {
+        return;
+    }
+
+    const QVariantList values = boundValues(query);
+    qWarning().noquote() << QString("Slow query (%1 ms%2): %3 | params: %4")
+        .arg(ns / 1e6, 0, 'f', 1)
+        .arg(batch ? ", batch" : "")
+        .arg(statement.simplified())
+        .arg(describeValues(values));
+
+    if (capturePlan) {
+        const QString plan = queryPlan(query, statement, values);
+        qWarning().noquote() << "Query plan:" << plan;
+        QMutexLocker locker(&statsMutex);
+        statistics[statement].plan = plan;
+    }
+}
+
+QVariantList queryprofiler::report(int topN) {
+    QList<QPair<qint64, QVariantMap>> entries;
+    {
+        QMutexLocker locker(&statsMutex);
+        for (auto it = statistics.constBegin(); it != statistics.constEnd(); ++it) {
+            const statementStats &stats = it.value();
+            QVariantMap entry;
+            entry["statement"] = it.key().simplified();
+            entry["count"] = stats.count;
+            entry["slowCount"] = stats.slowCount;
+            entry["totalMs"] = stats.totalNs / 1e6;
+            entry["meanMs"] = stats.count > 0 ? stats.totalNs / 1e6 / stats.count : 0.0;
+            entry["maxMs"] = stats.maxNs / 1e6;
+            entry["plan"] = stats.plan;
+            entries.append(qMakePair(stats.totalNs, entry));
+        }
+    }
+    std::sort(entries.begin(), entries.end(), [](const QPair<qint64, QVariantMap> &a, const QPair<qint64, QVariantMap> &b) {
+        return a.first > b.first;
+    });
+
+    QVariantList result;
+    for (int i = 0; i < entries.size() && (topN <= 0 || i < topN); ++i) {
+        result.append(entries[i].second);
+    }
+    return result;
+}
+
+void queryprofiler::reset() {
+    QMutexLocker locker(&statsMutex);
+    statistics.clear();
+}
@@ -0,0 +1,47 @@
+/*
+    Skruuvi - Reader for Ruuvi sensors
+    Copyright (C) 2025  Miika Malin
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see [http://www.gnu.org/licenses/].
+*/
+#ifndef QUERYPROFILER_H
+#define QUERYPROFILER_H
+
+#include <QString>
+#include <QVariantList>
+#include <QSqlQuery>
+
+// Opt-in statement profiler for the database layer. When enabled every
+// statement is timed per SQL template, statements slower than the threshold
+// are logged with their parameters and the query plan of each slow template
+// is captured once. When disabled exec() is a plain QSqlQuery::exec().
+class queryprofiler
+{
+public:
+    static void setEnabled(bool enabled, int slowThresholdMs = 50);
+    static bool isEnabled();
+    static bool exec(QSqlQuery &query);
+    static bool exec(QSqlQuery &query, const QString &statement);
+    static bool execBatch(QSqlQuery &query);
+    // Releases a SELECT, the time from exec to here is recorded for it
+    static void finish(QSqlQuery &query);
+    // Templates ordered by total time spent in them
+    static QVariantList report(int topN);
+    static void reset();
+
+private:
+    static void record(QSqlQuery &query, const QString &statement, qint64 ns, bool batch);
+};
+
+#endif // QUERYPROFILER_H
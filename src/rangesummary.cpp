@@ -0,0 +1,214 @@
+/*
+    Skruuvi - Reader for Ruuvi sensors
+    Copyright (C) 2025  Miika Malin
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see [http://www.gnu.org/licenses/].
+*/
+#include "rangesummary.h"
+#include <QDataStream>
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+// Unmerged centroids collected before compressing
+static const int BUFFER_FACTOR = 5;
+
+rangesummary::rangesummary(double compression)
+    : compression(compression)
+    , n(0)
+    , minimum(std::numeric_limits<double>::quiet_NaN())
+    , maximum(std::numeric_limits<double>::quiet_NaN())
+    , runningMean(0.0)
+    , m2(0.0)
+{
+}
+
+void rangesummary::add(double value)
+{
+    if (std::isnan(value)) {
+        return;
+    }
+    // Welford
+    ++n;
+    const double delta = value - runningMean;
+    runningMean += delta / n;
+    m2 += delta * (value - runningMean);
+    minimum = n == 1 ? value : std::min(minimum, value);
+    maximum = n == 1 ? value : std::max(maximum, value);
+
+    addCentroid(value, 1.0);
+}
+
+void rangesummary::merge(const rangesummary &other)
+{
+    if (other.n == 0) {
+        return;
+    }
+    if (n == 0) {
+        minimum = other.minimum;
+        maximum = other.maximum;
+    } else {
+        minimum = std::min(minimum, other.minimum);
+        maximum = std::max(maximum, other.maximum);
+    }
+    // Chan et al. parallel variant of Welford
+    const qint64 total = n + other.n;
+    const double delta = other.runningMean - runningMean;
+    m2 += other.m2 + delta * delta * double(n) * double(other.n) / total;
+    runningMean += delta * double(other.n) / total;
+    n = total;
+
+    for (const centroid &c : other.centroids) {
+        addCentroid(c.mean, c.weight);
+    }
+    for (const centroid &c : other.buffer) {
+        addCentroid(c.mean, c.weight);
+    }
+}
+
+void rangesummary::addCentroid(double mean, double weight)
+{
+    buffer.append({mean, weight});
+    if (buffer.size() >= BUFFER_FACTOR * compression) {
+        compress();
+    }
+}
+
+void rangesummary::compress()
+{
+    if (buffer.isEmpty()) {
+        return;
+    }
+    QVector<centroid> all = centroids + buffer;
+    buffer.clear();
+    std::sort(all.begin(), all.end(), [](const centroid &a, const centroid &b) {
+        return a.mean < b.mean;
+    });
+
+    double total = 0.0;
+    for (const centroid &c : all) {
+        total += c.weight;
+    }
+
+    // Centroids near the tails stay small: weight <= 4 * N * q * (1 - q) / compression
+    centroids.clear();
+    centroid current = all.first();
+    double before = 0.0;
+    for (int i = 1; i < all.size(); ++i) {
+        const double proposed = current.weight + all[i].weight;
+        const double q = (before + proposed / 2.0) / total;
+        const double limit = std::max(1.0, 4.0 * total * q * (1.0 - q) / compression);
+        if (proposed <= limit) {
+            current.mean += (all[i].mean - current.mean) * all[i].weight / proposed;
+            current.weight = proposed;
+        } else {
+            centroids.append(current);
+            before += current.weight;
+            current = all[i];
+        }
+    }
+    centroids.append(current);
+}
+
+double rangesummary::quantile(double q)
+{
+    compress();
+    if (centroids.isEmpty()) {
+        return std::numeric_limits<double>::quiet_NaN();
+    }
+    if (centroids.size() == 1) {
+        return centroids.first().mean;
+    }
+
+    double total = 0.0;
+    for (const centroid &c : centroids) {
+        total += c.weight;
+    }
+    // Interpolate between the centroid centres, and towards min/max at the ends
+    const double target = q * total;
+    double cumulative = 0.0;
+    double previousCentre = 0.0;
+    double previousMean = minimum;
+    for (const centroid &c : centroids) {
+        const double centre = cumulative + c.weight / 2.0;
+        if (target < centre) {
+            if (centre <= previousCentre) {
+                return c.mean;
+            }
+            const double t = (target - previousCentre) / (centre - previousCentre);
+            return previousMean + t * (c.mean - previousMean);
+        }
+        previousCentre = centre;
+        previousMean = c.mean;
+        cumulative += c.weight;
+    }
+    if (total <= previousCentre) {
+        return maximum;
+    }
+    const double t = (target - previousCentre) / (total - previousCentre);
+    return previousMean + t * (maximum - previousMean);
+}
+
+QVariantMap rangesummary::toVariantMap()
+{
+    QVariantMap result;
+    result["count"] = n;
+    if (n == 0) {
+        return result;
+    }
+    result["min"] = minimum;
+    result["max"] = maximum;
+    result["mean"] = runningMean;
+    result["stddev"] = n > 1 ? std::sqrt(m2 / (n - 1)) : 0.0;
+    result["p5"] = quantile(0.05);
+    result["p25"] = quantile(0.25);
+    result["p50"] = quantile(0.50);
+    result["p75"] = quantile(0.75);
+    result["p95"] = quantile(0.95);
+    return result;
+}
+
+QByteArray rangesummary::digestBlob()
+{
+    compress();
+    QByteArray blob;
+    QDataStream stream(&blob, QIODevice::WriteOnly);
+    stream.setFloatingPointPrecision(QDataStream::SinglePrecision);
+    stream << qint32(centroids.size());
+    for (const centroid &c : centroids) {
+        stream << c.mean << c.weight;
+    }
+    return blob;
+}
+
+rangesummary rangesummary::fromStored(qint64 count, double min, double max, double mean, double m2, const QByteArray &digest)
+{
+    rangesummary summary;
+    summary.n = count;
+    summary.minimum = min;
+    summary.maximum = max;
+    summary.runningMean = mean;
+    summary.m2 = m2;
+
+    QDataStream stream(digest);
+    stream.setFloatingPointPrecision(QDataStream::SinglePrecision);
+    qint32 size = 0;
+    stream >> size;
+    for (qint32 i = 0; i < size && !stream.atEnd(); ++i) {
+        centroid c;
+        stream >> c.mean >> c.weight;
+        summary.centroids.append(c);
+    }
+    return summary;
+}
@@ -0,0 +1,68 @@
+/*
+    Skruuvi - Reader for Ruuvi sensors
+    Copyright (C) 2025  Miika Malin
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see [http://www.gnu.org/licenses/].
+*/
+#ifndef RANGESUMMARY_H
+#define RANGESUMMARY_H
+
+#include <QByteArray>
+#include <QVariantMap>
+#include <QVector>
+
+// Mergeable single pass summary of a series: count, min, max, mean and
+// variance with Welford's algorithm, and a merging t-digest for approximate
+// percentiles. Used for the range statistics and stored per hour and per
+// day in the rollups table.
+class rangesummary
+{
+public:
+    explicit rangesummary(double compression = 50.0);
+
+    void add(double value);
+    void merge(const rangesummary &other);
+    qint64 count() const { return n; }
+    double min() const { return minimum; }
+    double max() const { return maximum; }
+    double mean() const { return runningMean; }
+    // Sum of squared deviations from the mean
+    double m2Value() const { return m2; }
+    double quantile(double q);
+    QVariantMap toVariantMap();
+
+    // Rollup storage: the digest centroids as float pairs
+    QByteArray digestBlob();
+    static rangesummary fromStored(qint64 count, double min, double max, double mean, double m2, const QByteArray &digest);
+
+private:
+    struct centroid {
+        double mean;
+        double weight;
+    };
+
+    double compression;
+    qint64 n;
+    double minimum;
+    double maximum;
+    double runningMean;
+    double m2;
+    QVector<centroid> centroids;
+    QVector<centroid> buffer;
+
+    void addCentroid(double mean, double weight);
+    void compress();
+};
+
+#endif // RANGESUMMARY_H
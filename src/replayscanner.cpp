@@ -0,0 +1,301 @@
+/*
+    Skruuvi - Reader for Ruuvi sensors
+    Copyright (C) 2025  Miika Malin
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see [http://www.gnu.org/licenses/].
+*/
+#include "replayscanner.h"
+#include <QDebug>
+#include <QFile>
+#include <QTextStream>
+#include <algorithm>
+#include <cmath>
+
+// How often queued advertisements are generated and delivered
+static const int TICK_INTERVAL_MS = 5;
+// Latency samples kept for the percentiles
+static const int MAX_LATENCY_SAMPLES = 100000;
+
+replayscanner::replayscanner(QObject *parent, database* db)
+    : advertisementsource(parent, db)
+    , scanning(false)
+    , syntheticDevices(10)
+    , syntheticIntervalMs(1000)
+    , syntheticFormat(5)
+    , syntheticGenerated(0)
+    , recordingPosition(0)
+    , recordingSpeed(1.0)
+    , recordingLoop(false)
+    , recordingBaseNs(0)
+    , delivered(0)
+    , missed(0)
+    , maxQueueDepth(0)
+{
+    tickTimer.setInterval(TICK_INTERVAL_MS);
+    tickTimer.setTimerType(Qt::PreciseTimer);
+    connect(&tickTimer, &QTimer::timeout, this, &replayscanner::tick);
+}
+
+void replayscanner::setSyntheticLoad(int devices, int intervalMs, int dataFormat)
+{
+    recording.clear();
+    syntheticDevices = qMax(1, devices);
+    syntheticIntervalMs = qMax(1, intervalMs);
+    syntheticFormat = dataFormat;
+}
+
+bool replayscanner::loadRecording(const QString &path, double speed, bool loop)
+{
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly | QIODevice::Text)) {
+        qWarning() << "Could not open advertisement recording:" << file.errorString();
+        return false;
+    }
+
+    recording.clear();
+    QTextStream stream(&file);
+    while (!stream.atEnd()) {
+        const QStringList fields = stream.readLine().split(' ', QString::SkipEmptyParts);
+        if (fields.size() != 3) {
+            continue;
+        }
+        recordedAdvert advert;
+        advert.offsetMs = fields[0].toLongLong();
+        advert.mac = fields[1];
+        advert.data.fill(0);
+        const QByteArray payload = QByteArray::fromHex(fields[2].toLatin1());
+        for (int i = 0; i < payload.size() && i < 24; ++i) {
+            advert.data[i] = static_cast<uint8_t>(payload[i]);
+        }
+        recording.append(advert);
+    }
+    qDebug() << "Loaded" << recording.size() << "recorded advertisements from" << path;
+
+    recordingSpeed = speed > 0.0 ? speed : 1.0;
+    recordingLoop = loop;
+    return !recording.isEmpty();
+}
+
+void replayscanner::startScan()
+{
+    syntheticGenerated = 0;
+    recordingPosition = 0;
+    recordingBaseNs = 0;
+    delivered = 0;
+    missed = 0;
+    maxQueueDepth = 0;
+    queue.clear();
+    latenciesNs.clear();
+    latenciesNs.reserve(MAX_LATENCY_SAMPLES);
+
+    clock.start();
+    tickTimer.start();
+    scanning = true;
+    setDiscovering(true);
+}
+
+void replayscanner::stopScan()
+{
+    tickTimer.stop();
+    scanning = false;
+    setDiscovering(false);
+    emit discoveryStopped();
+}
+
+bool replayscanner::isScanning() const
+{
+    return scanning;
+}
+
+void replayscanner::setDiscoveryActive(bool active)
+{
+    if (!scanning) {
+        return;
+    }
+    if (active && !tickTimer.isActive()) {
+        // Drop everything that was due while the radio was off
+        generate(clock.nsecsElapsed());
+        missed += queue.size();
+        queue.clear();
+        tickTimer.start();
+    } else if (!active) {
+        tickTimer.stop();
+    }
+    setDiscovering(tickTimer.isActive());
+}
+
+QString replayscanner::virtualMac(int device)
+{
+    return QString("C0:FF:EE:%1:%2:%3")
+        .arg((device >> 16) & 0xFF, 2, 16, QChar('0'))
+        .arg((device >> 8) & 0xFF, 2, 16, QChar('0'))
+        .arg(device & 0xFF, 2, 16, QChar('0'))
+        .toUpper();
+}
+
+std::array<uint8_t, 24> replayscanner::syntheticPayload(int device, int sequence, int dataFormat)
+{
+    std::array<uint8_t, 24> data = {0};
+    // Slowly varying values so the plots of virtual devices look plausible
+    const double phase = sequence / 50.0 + device;
+    const int16_t temperature = static_cast<int16_t>((21.0 + 3.0 * std::sin(phase)) / 0.005);
+    const uint16_t humidity = static_cast<uint16_t>((45.0 + 10.0 * std::sin(phase / 3.0)) / 0.0025);
+    const uint16_t pressure = static_cast<uint16_t>((1013.0 + 5.0 * std::sin(phase / 7.0)) * 100.0 - 50000.0);
+
+    data[1] = (temperature >> 8) & 0xFF;
+    data[2] = temperature & 0xFF;
+    data[3] = humidity >> 8;
+    data[4] = humidity & 0xFF;
+    data[5] = pressure >> 8;
+    data[6] = pressure & 0xFF;
+
+    if (dataFormat == 6) {
+        // https://docs.ruuvi.com/communication/bluetooth-advertisements/data-format-6
+        const uint16_t pm25 = static_cast<uint16_t>((8.0 + 4.0 * std::sin(phase / 5.0)) * 10.0);
+        const uint16_t co2 = static_cast<uint16_t>(700.0 + 300.0 * std::sin(phase / 11.0));
+        data[0] = 6;
+        data[7] = pm25 >> 8;
+        data[8] = pm25 & 0xFF;
+        data[9] = co2 >> 8;
+        data[10] = co2 & 0xFF;
+        data[11] = 50;  // VOC index 100
+        data[12] = 1;   // NOx index 2
+        data[15] = sequence & 0xFF;
+        data[17] = (device >> 16) & 0xFF;
+        data[18] = (device >> 8) & 0xFF;
+        data[19] = device & 0xFF;
+    } else {
+        // https://docs.ruuvi.com/communication/bluetooth-advertisements/data-format-5-rawv2
+        const uint16_t batteryAndTx = ((3000 - 1600) << 5) | ((4 + 40) / 2);
+        data[0] = 5;
+        data[12] = 1000 & 0xFF;  // Z acceleration 1000 mG
+        data[11] = 1000 >> 8;
+        data[13] = batteryAndTx >> 8;
+        data[14] = batteryAndTx & 0xFF;
+        data[16] = (sequence >> 8) & 0xFF;
+        data[17] = sequence & 0xFF;
+        // DF5 carries the MAC address in the payload, it has to match virtualMac
+        data[18] = 0xC0;
+        data[19] = 0xFF;
+        data[20] = 0xEE;
+        data[21] = (device >> 16) & 0xFF;
+        data[22] = (device >> 8) & 0xFF;
+        data[23] = device & 0xFF;
+    }
+    return data;
+}
+
+void replayscanner::generateSynthetic(qint64 nowNs)
+{
+    // Spread the advertisements of all devices evenly over the interval
+    const double advertIntervalNs = syntheticIntervalMs * 1000000.0 / syntheticDevices;
+    while (qint64(syntheticGenerated * advertIntervalNs) <= nowNs) {
+        const int device = int(syntheticGenerated % syntheticDevices);
+        const int sequence = int(syntheticGenerated / syntheticDevices);
+        const int dataFormat = syntheticFormat == 0 ? (device % 2 ? 6 : 5) : syntheticFormat;
+
+        pendingAdvert advert;
+        advert.mac = virtualMac(device);
+        advert.data = syntheticPayload(device, sequence, dataFormat);
+        advert.dueNs = qint64(syntheticGenerated * advertIntervalNs);
+        queue.enqueue(advert);
+        ++syntheticGenerated;
+    }
+}
+
+void replayscanner::generateRecorded(qint64 nowNs)
+{
+    while (!recording.isEmpty()) {
+        if (recordingPosition >= recording.size()) {
+            if (!recordingLoop) {
+                return;
+            }
+            // Restart the recording right after its last advertisement
+            recordingBaseNs += qint64((recording.last().offsetMs + 1) * 1000000.0 / recordingSpeed);
+            recordingPosition = 0;
+        }
+        const recordedAdvert &recorded = recording[recordingPosition];
+        const qint64 dueNs = recordingBaseNs + qint64(recorded.offsetMs * 1000000.0 / recordingSpeed);
+        if (dueNs > nowNs) {
+            return;
+        }
+        pendingAdvert advert;
+        advert.mac = recorded.mac;
+        advert.data = recorded.data;
+        advert.dueNs = dueNs;
+        queue.enqueue(advert);
+        ++recordingPosition;
+    }
+}
+
+void replayscanner::generate(qint64 nowNs)
+{
+    if (recording.isEmpty()) {
+        generateSynthetic(nowNs);
+    } else {
+        generateRecorded(nowNs);
+    }
+}
+
+void replayscanner::tick()
+{
+    generate(clock.nsecsElapsed());
+    maxQueueDepth = qMax(maxQueueDepth, queue.size());
+
+    while (!queue.isEmpty()) {
+        const pendingAdvert advert = queue.dequeue();
+        if (!knownDevices.contains(advert.mac)) {
+            knownDevices.insert(advert.mac);
+            const QString name = (advert.data[0] == 6 ? "Ruuvi Air " : "Ruuvi ") + advert.mac.right(5).remove(':');
+            emit deviceFound(name, advert.mac);
+            db->addDevice(advert.mac, name);
+        }
+        deliverAdvertisement(advert.mac, advert.data);
+
+        // End-to-end latency from the moment the advertisement was due
+        const qint64 latencyNs = clock.nsecsElapsed() - advert.dueNs;
+        if (latenciesNs.size() < MAX_LATENCY_SAMPLES) {
+            latenciesNs.append(latencyNs);
+        } else {
+            latenciesNs[int(delivered % MAX_LATENCY_SAMPLES)] = latencyNs;
+        }
+        ++delivered;
+    }
+}
+
+QVariantMap replayscanner::getStats() const
+{
+    QVariantMap stats;
+    const double elapsedS = clock.isValid() ? clock.nsecsElapsed() / 1e9 : 0.0;
+    stats["elapsedSeconds"] = elapsedS;
+    stats["delivered"] = delivered;
+    stats["missed"] = missed;
+    stats["advertsPerSecond"] = elapsedS > 0.0 ? delivered / elapsedS : 0.0;
+    stats["queueDepth"] = queue.size();
+    stats["maxQueueDepth"] = maxQueueDepth;
+    stats["devices"] = knownDevices.size();
+
+    QVector<qint64> sorted = latenciesNs;
+    std::sort(sorted.begin(), sorted.end());
+    auto percentileMs = [&sorted](double p) {
+        if (sorted.isEmpty()) return 0.0;
+        const int index = qMin(sorted.size() - 1, int(p * sorted.size()));
+        return sorted[index] / 1e6;
+    };
+    stats["latencyP50Ms"] = percentileMs(0.50);
+    stats["latencyP90Ms"] = percentileMs(0.90);
+    stats["latencyP99Ms"] = percentileMs(0.99);
+    stats["latencyMaxMs"] = sorted.isEmpty() ? 0.0 : sorted.last() / 1e6;
+    return stats;
+}
@@ -0,0 +1,96 @@
+/*
+    Skruuvi - Reader for Ruuvi sensors
+    Copyright (C) 2025  Miika Malin
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see [http://www.gnu.org/licenses/].
+*/
+#ifndef REPLAYSCANNER_H
+#define REPLAYSCANNER_H
+
+#include <QObject>
+#include <QTimer>
+#include <QQueue>
+#include <QVector>
+#include <QSet>
+#include <QElapsedTimer>
+#include "advertisementsource.h"
+
+// Advertisement source that needs no Bluetooth adapter. It either plays back
+// a recording made with advertisementsource::setRecordingFile, or generates
+// synthetic DF5/DF6 payloads for a number of virtual devices, and feeds them
+// to the database through the same path as the BlueZ scanner.
+class replayscanner : public advertisementsource
+{
+    Q_OBJECT
+
+public:
+    explicit replayscanner(QObject *parent = nullptr, database* db = nullptr);
+    Q_INVOKABLE void startScan() override;
+    Q_INVOKABLE void stopScan() override;
+    Q_INVOKABLE bool isScanning() const override;
+    Q_INVOKABLE QVariantMap getStats() const override;
+    // While paused the advertisements keep coming due, they are just not heard
+    void setDiscoveryActive(bool active) override;
+
+    // Synthetic load: devices virtual tags each advertising every intervalMs,
+    // dataFormat 5 or 6 (0 alternates between them per device)
+    void setSyntheticLoad(int devices, int intervalMs, int dataFormat);
+    // Recorded load, speed scales the recorded timing and loop restarts it at the end
+    bool loadRecording(const QString &path, double speed = 1.0, bool loop = false);
+
+private slots:
+    void tick();
+
+private:
+    struct pendingAdvert {
+        QString mac;
+        std::array<uint8_t, 24> data;
+        qint64 dueNs;
+    };
+    struct recordedAdvert {
+        qint64 offsetMs;
+        QString mac;
+        std::array<uint8_t, 24> data;
+    };
+
+    QTimer tickTimer;
+    QElapsedTimer clock;
+    bool scanning;
+
+    int syntheticDevices;
+    int syntheticIntervalMs;
+    int syntheticFormat;
+    qint64 syntheticGenerated;
+
+    QVector<recordedAdvert> recording;
+    int recordingPosition;
+    double recordingSpeed;
+    bool recordingLoop;
+    qint64 recordingBaseNs;
+
+    QQueue<pendingAdvert> queue;
+    QSet<QString> knownDevices;
+    qint64 delivered;
+    qint64 missed;
+    int maxQueueDepth;
+    QVector<qint64> latenciesNs;
+
+    void generateSynthetic(qint64 nowNs);
+    void generateRecorded(qint64 nowNs);
+    void generate(qint64 nowNs);
+    static QString virtualMac(int device);
+    static std::array<uint8_t, 24> syntheticPayload(int device, int sequence, int dataFormat);
+};
+
+#endif // REPLAYSCANNER_H
@@ -0,0 +1,287 @@
+/*
+    Skruuvi - Reader for Ruuvi sensors
+    Copyright (C) 2025  Miika Malin
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see [http://www.gnu.org/licenses/].
+*/
+#include "scanscheduler.h"
+#include <QDateTime>
+#include <QDebug>
+
+static const int DEFAULT_FRESHNESS_S = 60;
+// Continuous scanning after start and after a new tag has been seen
+static const qint64 DISCOVERY_PHASE_MS = 30000;
+// Look for new tags this often even when all known ones are scheduled
+static const qint64 SWEEP_INTERVAL_MS = 600000;
+// Window around the expected advertisement, covers BlueZ start-up and jitter
+static const double MIN_MARGIN_MS = 500.0;
+static const double WINDOW_MARGIN = 0.25;
+// Tags not heard in this many windows wait for the next sweep
+static const int MAX_MISSED_WINDOWS = 3;
+// Accepted advertising intervals, anything else is a wrapped or stale sequence
+static const double MIN_INTERVAL_MS = 50.0;
+static const double MAX_INTERVAL_MS = 120000.0;
+static const double INTERVAL_SMOOTHING = 0.2;
+static const qint64 MIN_TIMER_MS = 20;
+
+scanscheduler::scanscheduler(advertisementsource* source, database* db, QObject *parent)
+    : QObject(parent)
+    , source(source)
+    , db(db)
+    , enabled(false)
+    , defaultFreshnessMs(DEFAULT_FRESHNESS_S * 1000)
+    , discoverUntilMs(0)
+    , lastSweepMs(0)
+    , radioActive(source->isDiscovering())
+    , radioOnSinceMs(0)
+    , radioOnMs(0)
+    , wakeups(0)
+    , cpuStart(0)
+{
+    timer.setSingleShot(true);
+    connect(&timer, &QTimer::timeout, this, &scanscheduler::reschedule);
+    connect(source, &advertisementsource::advertisementReceived, this, &scanscheduler::onAdvertisement);
+    connect(source, &advertisementsource::discoveryActiveChanged, this, &scanscheduler::onDiscoveryActiveChanged);
+
+    // Start from the last stored readings, so the first advertisement already
+    // gives an interval estimate. The database opens in the background.
+    if (db) {
+        connect(db, &database::readyChanged, this, &scanscheduler::loadDevices);
+        if (db->isReady()) {
+            loadDevices();
+        }
+    }
+}
+
+void scanscheduler::loadDevices()
+{
+    for (const QVariant &entry : db->getDevices()) {
+        const QVariantMap device = entry.toMap();
+        bool lastObsValid = false;
+        bool sequenceValid = false;
+        const qint64 lastObs = device.value("last_obs").toLongLong(&lastObsValid);
+        const int sequence = device.value("meas_seq").toInt(&sequenceValid);
+        const QString deviceAddress = device.value("deviceAddress").toString();
+        // Tags heard while the database was opening are newer than the table
+        if (!lastObsValid || devices.contains(deviceAddress)) {
+            continue;
+        }
+        deviceSchedule &schedule = devices[deviceAddress];
+        schedule.lastSeenMs = lastObs * 1000;
+        schedule.lastSequence = sequenceValid ? sequence : -1;
+    }
+}
+
+qint64 scanscheduler::now()
+{
+    return QDateTime::currentMSecsSinceEpoch();
+}
+
+void scanscheduler::setEnabled(bool enabled)
+{
+    if (enabled == this->enabled) {
+        return;
+    }
+    this->enabled = enabled;
+    if (enabled) {
+        qDebug() << "Adaptive scan scheduling enabled";
+        clock.start();
+        cpuStart = std::clock();
+        wakeups = 0;
+        radioOnMs = 0;
+        radioOnSinceMs = now();
+        radioActive = source->isDiscovering();
+        startDiscoveryPhase(now());
+        reschedule();
+    } else {
+        qDebug() << "Adaptive scan scheduling disabled";
+        timer.stop();
+        setRadio(true);
+    }
+}
+
+bool scanscheduler::isEnabled() const
+{
+    return enabled;
+}
+
+void scanscheduler::setDefaultFreshnessTarget(int seconds)
+{
+    defaultFreshnessMs = qMax(1, seconds) * qint64(1000);
+    const qint64 nowMs = now();
+    for (auto it = devices.begin(); it != devices.end(); ++it) {
+        planWindow(it.value(), nowMs);
+    }
+    reschedule();
+}
+
+void scanscheduler::setFreshnessTarget(const QString &deviceAddress, int seconds)
+{
+    deviceSchedule &device = devices[deviceAddress];
+    device.freshnessMs = qMax(1, seconds) * qint64(1000);
+    planWindow(device, now());
+    reschedule();
+}
+
+void scanscheduler::startDiscoveryPhase(qint64 nowMs)
+{
+    discoverUntilMs = nowMs + DISCOVERY_PHASE_MS;
+    lastSweepMs = nowMs;
+}
+
+void scanscheduler::onAdvertisement(const QString &deviceAddress, int sequence)
+{
+    const qint64 nowMs = now();
+    auto it = devices.find(deviceAddress);
+    if (it == devices.end()) {
+        // New tag, keep scanning while more of them show up
+        it = devices.insert(deviceAddress, deviceSchedule());
+        discoverUntilMs = qMax(discoverUntilMs, nowMs + DISCOVERY_PHASE_MS);
+    } else if (sequence >= 0 && it->lastSequence >= 0 && sequence > it->lastSequence) {
+        // The sequence counts every advertisement, also the ones we did not hear
+        const double sampleMs = double(nowMs - it->lastSeenMs) / (sequence - it->lastSequence);
+        if (sampleMs >= MIN_INTERVAL_MS && sampleMs <= MAX_INTERVAL_MS) {
+            it->intervalMs = it->intervalMs > 0.0
+                ? it->intervalMs + INTERVAL_SMOOTHING * (sampleMs - it->intervalMs)
+                : sampleMs;
+        }
+    }
+    it->lastSeenMs = nowMs;
+    it->lastSequence = sequence;
+    it->missedWindows = 0;
+    it->lost = false;
+    planWindow(it.value(), nowMs);
+
+    if (enabled) {
+        reschedule();
+    }
+}
+
+void scanscheduler::planWindow(deviceSchedule &device, qint64 nowMs) const
+{
+    if (device.intervalMs <= 0.0) {
+        device.windowStartMs = 0;
+        device.windowEndMs = 0;
+        return;
+    }
+    // Aim for the last advertisement that still keeps the reading within the target
+    const qint64 freshnessMs = device.freshnessMs > 0 ? device.freshnessMs : defaultFreshnessMs;
+    const int advertisements = qMax(1, int(freshnessMs / device.intervalMs));
+    const double marginMs = qMax(MIN_MARGIN_MS, device.intervalMs * WINDOW_MARGIN) * (1 + device.missedWindows);
+    double expectedMs = device.lastSeenMs + advertisements * device.intervalMs;
+    while (expectedMs + marginMs < nowMs) {
+        expectedMs += device.intervalMs;
+    }
+    device.windowStartMs = qint64(expectedMs - marginMs);
+    device.windowEndMs = qint64(expectedMs + marginMs);
+}
+
+void scanscheduler::reschedule()
+{
+    if (!enabled) {
+        return;
+    }
+    const qint64 nowMs = now();
+    if (nowMs - lastSweepMs >= SWEEP_INTERVAL_MS) {
+        startDiscoveryPhase(nowMs);
+    }
+
+    bool continuous = nowMs < discoverUntilMs;
+    bool windowOpen = false;
+    qint64 nextWakeMs = continuous ? discoverUntilMs : lastSweepMs + SWEEP_INTERVAL_MS;
+    for (auto it = devices.begin(); it != devices.end(); ++it) {
+        deviceSchedule &device = it.value();
+        if (device.lost) {
+            continue;
+        }
+        if (device.intervalMs <= 0.0) {
+            // Seen recently but the interval is not known yet
+            if (nowMs - device.lastSeenMs < DISCOVERY_PHASE_MS) {
+                continuous = true;
+                nextWakeMs = qMin(nextWakeMs, device.lastSeenMs + DISCOVERY_PHASE_MS);
+            }
+            continue;
+        }
+        if (device.windowEndMs < nowMs) {
+            // The window passed without hearing the tag, widen the next one
+            if (++device.missedWindows >= MAX_MISSED_WINDOWS) {
+                device.lost = true;
+                continue;
+            }
+            planWindow(device, nowMs);
+        }
+        if (device.windowStartMs <= nowMs) {
+            windowOpen = true;
+            nextWakeMs = qMin(nextWakeMs, device.windowEndMs);
+        } else {
+            nextWakeMs = qMin(nextWakeMs, device.windowStartMs);
+        }
+    }
+
+    setRadio(continuous || windowOpen);
+    timer.start(int(qBound(MIN_TIMER_MS, nextWakeMs - nowMs, SWEEP_INTERVAL_MS)));
+}
+
+void scanscheduler::setRadio(bool active)
+{
+    if (active == radioActive) {
+        return;
+    }
+    // The statistics follow once the source reports the change
+    source->setDiscoveryActive(active);
+}
+
+void scanscheduler::onDiscoveryActiveChanged(bool active)
+{
+    if (active == radioActive) {
+        return;
+    }
+    const qint64 nowMs = now();
+    if (active) {
+        if (enabled) {
+            ++wakeups;
+        }
+        radioOnSinceMs = nowMs;
+    } else {
+        radioOnMs += nowMs - radioOnSinceMs;
+    }
+    radioActive = active;
+}
+
+QVariantMap scanscheduler::getStats() const
+{
+    QVariantMap stats;
+    const qint64 elapsedMs = clock.isValid() ? clock.elapsed() : 0;
+    const double hours = elapsedMs / 3600000.0;
+    const qint64 onMs = radioOnMs + (enabled && radioActive ? now() - radioOnSinceMs : 0);
+    const double cpuMs = cpuStart > 0 ? (std::clock() - cpuStart) * 1000.0 / CLOCKS_PER_SEC : 0.0;
+
+    int learned = 0;
+    int lost = 0;
+    for (auto it = devices.constBegin(); it != devices.constEnd(); ++it) {
+        learned += it.value().intervalMs > 0.0 ? 1 : 0;
+        lost += it.value().lost ? 1 : 0;
+    }
+
+    stats["enabled"] = enabled;
+    stats["radioActive"] = radioActive;
+    stats["devices"] = devices.size();
+    stats["learnedIntervals"] = learned;
+    stats["lostDevices"] = lost;
+    stats["wakeups"] = wakeups;
+    stats["wakeupsPerHour"] = hours > 0.0 ? wakeups / hours : 0.0;
+    stats["dutyCycle"] = elapsedMs > 0 ? double(onMs) / elapsedMs : 0.0;
+    stats["cpuMsPerHour"] = hours > 0.0 ? cpuMs / hours : 0.0;
+    return stats;
+}
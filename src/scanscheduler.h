@@ -0,0 +1,86 @@
+/*
+    Skruuvi - Reader for Ruuvi sensors
+    Copyright (C) 2025  Miika Malin
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see [http://www.gnu.org/licenses/].
+*/
+#ifndef SCANSCHEDULER_H
+#define SCANSCHEDULER_H
+
+#include <QObject>
+#include <QHash>
+#include <QTimer>
+#include <QElapsedTimer>
+#include <ctime>
+#include "advertisementsource.h"
+
+// Duty cycles the radio of an advertisement source. The advertising interval
+// of every tag is learned from the sequence numbers, and discovery runs only
+// in short windows around the advertisement expected when the last reading
+// of a tag gets older than its freshness target. While new tags are showing
+// up, or an interval is not known yet, the source scans continuously.
+class scanscheduler : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit scanscheduler(advertisementsource* source, database* db, QObject *parent = nullptr);
+    Q_INVOKABLE void setEnabled(bool enabled);
+    Q_INVOKABLE bool isEnabled() const;
+    Q_INVOKABLE void setDefaultFreshnessTarget(int seconds);
+    Q_INVOKABLE void setFreshnessTarget(const QString &deviceAddress, int seconds);
+    Q_INVOKABLE QVariantMap getStats() const;
+
+private slots:
+    void onAdvertisement(const QString &deviceAddress, int sequence);
+    void reschedule();
+    void loadDevices();
+    void onDiscoveryActiveChanged(bool active);
+
+private:
+    struct deviceSchedule {
+        qint64 lastSeenMs = 0;
+        int lastSequence = -1;
+        double intervalMs = 0.0;   // 0 while unknown
+        qint64 freshnessMs = 0;    // 0 uses the default
+        qint64 windowStartMs = 0;
+        qint64 windowEndMs = 0;
+        int missedWindows = 0;
+        bool lost = false;
+    };
+
+    advertisementsource* source;
+    database* db;
+    QHash<QString, deviceSchedule> devices;
+    QTimer timer;
+    bool enabled;
+    qint64 defaultFreshnessMs;
+    qint64 discoverUntilMs;
+    qint64 lastSweepMs;
+
+    // Statistics
+    bool radioActive;
+    QElapsedTimer clock;
+    qint64 radioOnSinceMs;
+    qint64 radioOnMs;
+    qint64 wakeups;
+    std::clock_t cpuStart;
+
+    static qint64 now();
+    void planWindow(deviceSchedule &device, qint64 nowMs) const;
+    void setRadio(bool active);
+    void startDiscoveryPhase(qint64 nowMs);
+};
+
+#endif // SCANSCHEDULER_H
@@ -0,0 +1,157 @@
+/*
+    Skruuvi - Reader for Ruuvi sensors
+    Copyright (C) 2025  Miika Malin
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see [http://www.gnu.org/licenses/].
+*/
+#include "sqlitebackup.h"
+#include <QDebug>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QSqlDriver>
+#include <QThread>
+#include <sqlite3.h>
+
+// Retries of a step that found the database locked, before giving up
+static const int MAX_BUSY_RETRIES = 500;
+static const int BUSY_PAUSE_MS = 10;
+
+QVariantMap sqlitebackup::copy(const QString &sourcePath, const QString &destinationPath, int pagesPerStep,
+                               int pauseMs, const progress &onProgress)
+{
+    QVariantMap result;
+    const QString partPath = destinationPath + ".part";
+    QFile::remove(partPath);
+
+    sqlite3* source = nullptr;
+    sqlite3* destination = nullptr;
+    if (sqlite3_open_v2(QFile::encodeName(sourcePath).constData(), &source, SQLITE_OPEN_READONLY, nullptr) != SQLITE_OK
+            || sqlite3_open_v2(QFile::encodeName(partPath).constData(), &destination,
+                               SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE, nullptr) != SQLITE_OK) {
+        result["error"] = QString(sqlite3_errmsg(destination ? destination : source));
+        sqlite3_close(source);
+        sqlite3_close(destination);
+        return result;
+    }
+    sqlite3_busy_timeout(source, BUSY_PAUSE_MS);
+
+    // The steps read one WAL snapshot. Without the open read transaction every
+    // commit of the writer between two steps would restart the copy.
+    sqlite3_exec(source, "BEGIN; SELECT COUNT(*) FROM sqlite_master;", nullptr, nullptr, nullptr);
+
+    QElapsedTimer timer;
+    timer.start();
+    int steps = 0;
+    int busyRetries = 0;
+    sqlite3_backup* backup = sqlite3_backup_init(destination, "main", source, "main");
+    int rc = backup ? SQLITE_OK : sqlite3_errcode(destination);
+    while (backup && (rc == SQLITE_OK || rc == SQLITE_BUSY || rc == SQLITE_LOCKED)) {
+        rc = sqlite3_backup_step(backup, pagesPerStep);
+        if (rc == SQLITE_BUSY || rc == SQLITE_LOCKED) {
+            if (++busyRetries > MAX_BUSY_RETRIES) {
+                break;
+            }
+            QThread::msleep(BUSY_PAUSE_MS);
+            continue;
+        }
+        ++steps;
+        if (onProgress && !onProgress(sqlite3_backup_remaining(backup), sqlite3_backup_pagecount(backup))) {
+            rc = SQLITE_ABORT;
+            break;
+        }
+        if (rc == SQLITE_OK && pauseMs > 0) {
+            QThread::msleep(pauseMs);
+        }
+    }
+    const int pages = backup ? sqlite3_backup_pagecount(backup) : 0;
+    if (backup) {
+        sqlite3_backup_finish(backup);
+    }
+    sqlite3_exec(source, "COMMIT", nullptr, nullptr, nullptr);
+    if (rc != SQLITE_DONE) {
+        result["error"] = QString(sqlite3_errstr(rc));
+    }
+    sqlite3_close(source);
+    sqlite3_close(destination);
+
+    if (rc != SQLITE_DONE) {
+        qWarning() << "Backup to" << destinationPath << "failed:" << result.value("error").toString();
+        QFile::remove(partPath);
+        return result;
+    }
+    // An older backup is only replaced by a complete one
+    QFile::remove(destinationPath);
+    if (!QFile::rename(partPath, destinationPath)) {
+        result["error"] = QString("Could not rename ") + partPath;
+        return result;
+    }
+    result["path"] = destinationPath;
+    result["pages"] = pages;
+    result["steps"] = steps;
+    result["seconds"] = timer.nsecsElapsed() / 1e9;
+    return result;
+}
+
+bool sqlitebackup::restore(const QSqlDatabase &destination, const QString &sourcePath)
+{
+    const QVariant handle = destination.driver()->handle();
+    if (!handle.isValid() || qstrcmp(handle.typeName(), "sqlite3*") != 0) {
+        qWarning() << "Restore needs an SQLite connection";
+        return false;
+    }
+    sqlite3* target = *static_cast<sqlite3* const*>(handle.data());
+    if (!target) {
+        return false;
+    }
+
+    sqlite3* source = nullptr;
+    if (sqlite3_open_v2(QFile::encodeName(sourcePath).constData(), &source, SQLITE_OPEN_READONLY, nullptr) != SQLITE_OK) {
+        qWarning() << "Could not open the backup:" << sqlite3_errmsg(source);
+        sqlite3_close(source);
+        return false;
+    }
+    // A damaged or foreign file must not replace the data
+    sqlite3_stmt* check = nullptr;
+    bool intact = false;
+    if (sqlite3_prepare_v2(source, "PRAGMA quick_check", -1, &check, nullptr) == SQLITE_OK
+            && sqlite3_step(check) == SQLITE_ROW) {
+        intact = qstrcmp(reinterpret_cast<const char*>(sqlite3_column_text(check, 0)), "ok") == 0;
+    }
+    sqlite3_finalize(check);
+    if (!intact) {
+        qWarning() << "Backup" << sourcePath << "failed the integrity check";
+        sqlite3_close(source);
+        return false;
+    }
+
+    // One step, the readers see either the old or the restored data
+    sqlite3_backup* backup = sqlite3_backup_init(target, "main", source, "main");
+    int rc = backup ? SQLITE_OK : sqlite3_errcode(target);
+    for (int retry = 0; backup && retry < MAX_BUSY_RETRIES; ++retry) {
+        rc = sqlite3_backup_step(backup, -1);
+        if (rc != SQLITE_BUSY && rc != SQLITE_LOCKED) {
+            break;
+        }
+        QThread::msleep(BUSY_PAUSE_MS);
+    }
+    if (backup) {
+        sqlite3_backup_finish(backup);
+    }
+    sqlite3_close(source);
+    if (rc != SQLITE_DONE) {
+        qWarning() << "Restore from" << sourcePath << "failed:" << sqlite3_errstr(rc);
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,44 @@
+/*
+    Skruuvi - Reader for Ruuvi sensors
+    Copyright (C) 2025  Miika Malin
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see [http://www.gnu.org/licenses/].
+*/
+#ifndef SQLITEBACKUP_H
+#define SQLITEBACKUP_H
+
+#include <QSqlDatabase>
+#include <QString>
+#include <QVariantMap>
+#include <functional>
+
+// Copies of the database through the SQLite online backup API
+class sqlitebackup
+{
+public:
+    // Remaining and total pages after each step, false stops the copy
+    typedef std::function<bool(int, int)> progress;
+
+    // Copies sourcePath to destinationPath a few pages at a time, sleeping between
+    // the steps so the writer gets the disk. The copy is written next to the
+    // destination and renamed when complete. Returns "pages", "steps" and "seconds",
+    // or "error".
+    static QVariantMap copy(const QString &sourcePath, const QString &destinationPath, int pagesPerStep,
+                            int pauseMs, const progress &onProgress);
+    // Replaces the contents of the open connection with sourcePath in one step,
+    // after checking that sourcePath is an intact database
+    static bool restore(const QSqlDatabase &destination, const QString &sourcePath);
+};
+
+#endif // SQLITEBACKUP_H
@@ -0,0 +1,197 @@
+/*
+    Skruuvi - Reader for Ruuvi sensors
+    Copyright (C) 2025  Miika Malin
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see [http://www.gnu.org/licenses/].
+*/
+#include "tilepyramid.h"
+#include <QMutexLocker>
+#include <algorithm>
+
+tilepyramid::tilepyramid(int maxTiles)
+    : tiles(maxTiles)
+{
+}
+
+qint64 tilepyramid::tileIndex(qint64 timestamp, int level)
+{
+    const qint64 span = tileSpan(level);
+    return timestamp >= 0 ? timestamp / span : -((-timestamp + span - 1) / span);
+}
+
+int tilepyramid::levelFor(qint64 span, int maxPoints)
+{
+    const qint64 buckets = qMax(1, maxPoints / 2);
+    const qint64 width = (qMax(qint64(1), span) + buckets - 1) / buckets;
+    int shift = 0;
+    while ((qint64(1) << shift) < width && shift < FINEST_LEVEL) {
+        ++shift;
+    }
+    return FINEST_LEVEL - shift;
+}
+
+void tilepyramid::add(QVector<tilebucket> &buckets, int level, qint64 index, qint32 timestamp, double value)
+{
+    const qint64 offset = timestamp - index * tileSpan(level);
+    if (offset < 0 || offset >= tileSpan(level)) {
+        return;
+    }
+    tilebucket &b = buckets[int(offset / bucketWidth(level))];
+    if (b.count == 0) {
+        b.minTime = b.maxTime = timestamp;
+        b.minValue = b.maxValue = value;
+    } else if (value < b.minValue) {
+        b.minTime = timestamp;
+        b.minValue = value;
+    } else if (value > b.maxValue) {
+        b.maxTime = timestamp;
+        b.maxValue = value;
+    }
+    ++b.count;
+}
+
+QVector<tilebucket> tilepyramid::build(const qint32* timestamps, const double* values, int count, int level, qint64 index)
+{
+    QVector<tilebucket> buckets(TILE_BUCKETS);
+    const qint64 start = index * tileSpan(level);
+    const qint64 end = start + tileSpan(level);
+    int row = int(std::lower_bound(timestamps, timestamps + count, start) - timestamps);
+    for (; row < count && timestamps[row] < end; ++row) {
+        add(buckets, level, index, timestamps[row], values[row]);
+    }
+    return buckets;
+}
+
+void tilepyramid::appendPoints(QVector<QPointF> &points, const QVector<tilebucket> &buckets, qint64 start, qint64 end,
+                               bool* aggregatedOut)
+{
+    for (const tilebucket &b : buckets) {
+        if (b.count == 0) {
+            continue;
+        }
+        if (b.count > 2 && aggregatedOut) {
+            *aggregatedOut = true;
+        }
+        const bool maxFirst = b.maxTime < b.minTime;
+        const qint32 firstTime = maxFirst ? b.maxTime : b.minTime;
+        const qint32 secondTime = maxFirst ? b.minTime : b.maxTime;
+        if (firstTime >= start && firstTime <= end) {
+            points.append(QPointF(firstTime, maxFirst ? b.maxValue : b.minValue));
+        }
+        if (secondTime != firstTime && secondTime >= start && secondTime <= end) {
+            points.append(QPointF(secondTime, maxFirst ? b.minValue : b.maxValue));
+        }
+    }
+}
+
+bool tilepyramid::find(const tilekey &key, QVector<tilebucket> &buckets)
+{
+    QMutexLocker locker(&mutex);
+    const QVector<tilebucket>* tile = tiles.object(key);
+    if (!tile) {
+        return false;
+    }
+    buckets = *tile;
+    return true;
+}
+
+bool tilepyramid::contains(const tilekey &key)
+{
+    QMutexLocker locker(&mutex);
+    return tiles.contains(key);
+}
+
+int tilepyramid::generation(const QString &mac, const QString &sensor)
+{
+    QMutexLocker locker(&mutex);
+    return generations.value(mac + "/" + sensor) + generations.value(mac);
+}
+
+void tilepyramid::insert(const tilekey &key, const QVector<tilebucket> &buckets, int generation)
+{
+    QMutexLocker locker(&mutex);
+    if (generations.value(key.mac + "/" + key.sensor) + generations.value(key.mac) != generation) {
+        // Rows were stored or removed while the tile was built
+        return;
+    }
+    tiles.insert(key, new QVector<tilebucket>(buckets));
+}
+
+void tilepyramid::extend(const QString &mac, const QString &sensor, const QList<QPair<int, double>> &rows)
+{
+    QMutexLocker locker(&mutex);
+    // Tiles being built from the rows before these are not stored
+    ++generations[mac + "/" + sensor];
+    for (int level = 0; level <= FINEST_LEVEL; ++level) {
+        for (const auto &row : rows) {
+            const qint64 index = tileIndex(row.first, level);
+            QVector<tilebucket>* tile = tiles.object(tilekey{mac, sensor, level, index});
+            if (tile) {
+                add(*tile, level, index, row.first, row.second);
+            }
+        }
+    }
+}
+
+void tilepyramid::invalidate(const QString &mac, const QString &sensor, qint64 from, qint64 to)
+{
+    QMutexLocker locker(&mutex);
+    ++generations[mac + "/" + sensor];
+    // Narrow ranges drop the tiles one by one, wide imports scan the cache once
+    bool scan = false;
+    for (int level = 0; level <= FINEST_LEVEL && !scan; ++level) {
+        scan = tileIndex(to, level) - tileIndex(from, level) >= tiles.maxCost();
+    }
+    if (scan) {
+        for (const tilekey &key : tiles.keys()) {
+            if (key.mac == mac && key.sensor == sensor
+                    && key.index <= tileIndex(to, key.level) && key.index >= tileIndex(from, key.level)) {
+                tiles.remove(key);
+            }
+        }
+        return;
+    }
+    for (int level = 0; level <= FINEST_LEVEL; ++level) {
+        for (qint64 index = tileIndex(from, level); index <= tileIndex(to, level); ++index) {
+            tiles.remove(tilekey{mac, sensor, level, index});
+        }
+    }
+}
+
+void tilepyramid::removeDevice(const QString &mac)
+{
+    QMutexLocker locker(&mutex);
+    ++generations[mac];
+    for (const tilekey &key : tiles.keys()) {
+        if (key.mac == mac) {
+            tiles.remove(key);
+        }
+    }
+}
+
+bool tilepyramid::claimPrefetch(const tilekey &key)
+{
+    QMutexLocker locker(&mutex);
+    if (tiles.contains(key) || prefetching.contains(key)) {
+        return false;
+    }
+    prefetching.insert(key);
+    return true;
+}
+
+void tilepyramid::releasePrefetch(const tilekey &key)
+{
+    QMutexLocker locker(&mutex);
+    prefetching.remove(key);
+}
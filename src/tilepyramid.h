@@ -0,0 +1,105 @@
+/*
+    Skruuvi - Reader for Ruuvi sensors
+    Copyright (C) 2025  Miika Malin
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see [http://www.gnu.org/licenses/].
+*/
+#ifndef TILEPYRAMID_H
+#define TILEPYRAMID_H
+
+#include <QCache>
+#include <QHash>
+#include <QList>
+#include <QMutex>
+#include <QPair>
+#include <QPointF>
+#include <QSet>
+#include <QString>
+#include <QVector>
+
+// Smallest and largest reading of one time bucket
+struct tilebucket {
+    qint32 count = 0;
+    qint32 minTime = 0;
+    qint32 maxTime = 0;
+    double minValue = 0.0;
+    double maxValue = 0.0;
+};
+
+struct tilekey {
+    QString mac;
+    QString sensor;
+    int level;
+    qint64 index;
+};
+
+inline bool operator==(const tilekey &a, const tilekey &b)
+{
+    return a.level == b.level && a.index == b.index && a.sensor == b.sensor && a.mac == b.mac;
+}
+
+inline uint qHash(const tilekey &key, uint seed = 0)
+{
+    return qHash(key.mac, seed) ^ qHash(key.sensor, seed) ^ qHash(key.index, seed) ^ uint(key.level);
+}
+
+// Min/max tiles of the plotted series, built lazily per device and sensor.
+// Level 0 has the widest buckets and every level halves the bucket width,
+// down to one second at FINEST_LEVEL. A tile holds TILE_BUCKETS buckets and
+// starts at a multiple of its span, so the same time range always maps to
+// the same tiles whatever the plotted window is.
+class tilepyramid
+{
+public:
+    static const int FINEST_LEVEL = 22;
+    static const int TILE_BUCKETS = 256;
+
+    explicit tilepyramid(int maxTiles = 512);
+
+    static qint64 bucketWidth(int level) { return qint64(1) << (FINEST_LEVEL - level); }
+    static qint64 tileSpan(int level) { return bucketWidth(level) * TILE_BUCKETS; }
+    static qint64 tileIndex(qint64 timestamp, int level);
+    // Coarsest level that still has at least maxPoints / 2 buckets in the span
+    static int levelFor(qint64 span, int maxPoints);
+    // Builds a tile from rows sorted by time, only the rows inside the tile are used
+    static QVector<tilebucket> build(const qint32* timestamps, const double* values, int count, int level, qint64 index);
+    static void add(QVector<tilebucket> &buckets, int level, qint64 index, qint32 timestamp, double value);
+    // Appends the min and max of the buckets in time order, limited to [start, end]
+    static void appendPoints(QVector<QPointF> &points, const QVector<tilebucket> &buckets, qint64 start, qint64 end,
+                             bool* aggregatedOut);
+
+    bool find(const tilekey &key, QVector<tilebucket> &buckets);
+    bool contains(const tilekey &key);
+    // Changes whenever rows of the sensor are added or removed
+    int generation(const QString &mac, const QString &sensor);
+    // Stores a tile unless the rows changed after generation was read
+    void insert(const tilekey &key, const QVector<tilebucket> &buckets, int generation);
+    // Adds rows to the cached tiles of all levels in place, the tiles that are
+    // not cached are built with them later
+    void extend(const QString &mac, const QString &sensor, const QList<QPair<int, double>> &rows);
+    // Drops the tiles of all levels that overlap [from, to]
+    void invalidate(const QString &mac, const QString &sensor, qint64 from, qint64 to);
+    void removeDevice(const QString &mac);
+    // False if the tile is cached or already queued for prefetching
+    bool claimPrefetch(const tilekey &key);
+    void releasePrefetch(const tilekey &key);
+
+private:
+    QMutex mutex;
+    QCache<tilekey, QVector<tilebucket>> tiles;
+    QHash<QString, int> generations;
+    QSet<tilekey> prefetching;
+};
+
+#endif // TILEPYRAMID_H
@@ -16,14 +16,25 @@
     along with this program.  If not, see [http://www.gnu.org/licenses/].
 */
 #include "worker.h"
+#include "latencystats.h"
 #include <QDebug>
 
 worker::worker(database* db, QString deviceAddress, QString deviceName, const QVariantList& data)
     : db(db), deviceAddress(deviceAddress), deviceName(deviceName), data(data) {}
 
-worker::worker(database* db, const QString& deviceAddress, bool isAir, int startTime, int endTime, int maxPoints)
+worker::worker(database* db, const QString& deviceAddress, bool isAir, int startTime, int endTime, int maxPoints,
+               qint64 requestedNs)
     : QObject(nullptr), db(db), deviceAddress(deviceAddress), plotIsAir(isAir),
-      plotStartTime(startTime), plotEndTime(endTime), plotMaxPoints(maxPoints) {}
+      plotStartTime(startTime), plotEndTime(endTime), plotMaxPoints(maxPoints),
+      plotRequestedNs(requestedNs) {}
+
+worker::worker(database* db, const QStringList& deviceAddresses, const QString& sensor, int startTime, int endTime, int buckets)
+    : QObject(nullptr), db(db), plotStartTime(startTime), plotEndTime(endTime),
+      compareDevices(deviceAddresses), querySensor(sensor), compareBuckets(buckets) {}
+
+worker::worker(database* db, const QString& deviceAddress, const QString& sensor, int startTime, int endTime)
+    : QObject(nullptr), db(db), deviceAddress(deviceAddress), plotStartTime(startTime), plotEndTime(endTime),
+      querySensor(sensor) {}
 
 void worker::inputRawData() {
     // Define sensor values
@@ -42,6 +53,7 @@ void worker::inputRawData() {
     QList<QPair<int, double>> co2List;
     QList<QPair<int, double>> vocList;
     QList<QPair<int, double>> noxList;
+    QList<QPair<int, double>> iaqsList;
 
     // Loop over the data
     foreach (const QVariant& item, data) {
@@ -124,6 +136,12 @@ void worker::inputRawData() {
             if (!std::isnan(co2)) {
                 co2List.append(qMakePair(ts, co2));
             }
+            if (!std::isnan(pm25) && !std::isnan(co2)) {
+                const double iaqs = database::calculateIAQS(pm25, co2);
+                if (!std::isnan(iaqs)) {
+                    iaqsList.append(qMakePair(ts, iaqs));
+                }
+            }
             if (!std::isnan(voc)) {
                 vocList.append(qMakePair(ts, voc));
             }
@@ -136,31 +154,32 @@ void worker::inputRawData() {
     // Insert the sensor data if the corresponding lists are not empty
     if (!temperatureList.isEmpty()) {
         emit inputProgress(1);
-        db->insertSensorData(deviceAddress, "temperature", temperatureList);
+        db->importSensorData(deviceAddress, "temperature", temperatureList);
     }
     if (!humidityList.isEmpty()) {
         emit inputProgress(2);
-        db->insertSensorData(deviceAddress, "humidity", humidityList);
+        db->importSensorData(deviceAddress, "humidity", humidityList);
     }
     if (!airPressureList.isEmpty()) {
         emit inputProgress(3);
-        db->insertSensorData(deviceAddress, "air_pressure", airPressureList);
+        db->importSensorData(deviceAddress, "air_pressure", airPressureList);
     }
     if (!pm25List.isEmpty()) {
         emit inputProgress(4);
-        db->insertSensorData(deviceAddress, "pm25", pm25List);
+        db->importSensorData(deviceAddress, "pm25", pm25List);
     }
     if (!co2List.isEmpty()) {
         emit inputProgress(5);
-        db->insertSensorData(deviceAddress, "co2", co2List);
+        db->importSensorData(deviceAddress, "co2", co2List);
+        db->importSensorData(deviceAddress, "iaqs", iaqsList);
     }
     if (!vocList.isEmpty()) {
         emit inputProgress(6);
-        db->insertSensorData(deviceAddress, "voc", vocList);
+        db->importSensorData(deviceAddress, "voc", vocList);
     }
     if (!noxList.isEmpty()) {
         emit inputProgress(7);
-        db->insertSensorData(deviceAddress, "nox", noxList);
+        db->importSensorData(deviceAddress, "nox", noxList);
     }
     qDebug() << "Inserted sensor data";
 
@@ -168,153 +187,54 @@ void worker::inputRawData() {
     emit inputFinished();
 }
 
-bool worker::tryParsePointMap(const QVariant& v, worker::DsPoint& out) {
-    if (v.type() != QVariant::Map) return false;
-    const QVariantMap m = v.toMap();
-    if (!m.contains("x") || !m.contains("y")) return false;
-    out.x = m.value("x").toDouble();
-    out.y = m.value("y").toDouble();
-    return true;
-}
-
-QVariant worker::makePointVariant(const worker::DsPoint& p) {
-    QVariantMap m;
-    m["x"] = p.x;
-    m["y"] = p.y;
-    return m;
-}
-
-void worker::flushBucketToOutput(const QVector<worker::DsPoint>& bucket, QVariantList& out) {
-    if (bucket.isEmpty()) return;
-
-    worker::DsPoint minP = bucket[0];
-    worker::DsPoint maxP = bucket[0];
-
-    for (int i = 1; i < bucket.size(); ++i) {
-        if (bucket[i].y < minP.y) minP = bucket[i];
-        if (bucket[i].y > maxP.y) maxP = bucket[i];
+void worker::plotSensor(QVariantMap& result, const QString& sensor, int maxPoints,
+                        bool* aggregatedOut, double* bucketDurationOut) {
+    // Assembled from the cached min/max tiles, only missing tiles read the data
+    const QVariantMap series = db->getPlotSeries(deviceAddress, sensor, plotStartTime, plotEndTime, maxPoints);
+    if (aggregatedOut) {
+        *aggregatedOut = series.value("aggregated").toBool();
     }
-
-    if (minP.x == maxP.x && minP.y == maxP.y) {
-        out.append(makePointVariant(minP));
-    } else if (minP.x < maxP.x) {
-        out.append(makePointVariant(minP));
-        out.append(makePointVariant(maxP));
-    } else {
-        out.append(makePointVariant(maxP));
-        out.append(makePointVariant(minP));
+    if (bucketDurationOut) {
+        *bucketDurationOut = series.value("bucketDuration").toDouble();
     }
-}
-
-QVariantList worker::downsampleMinMax(const QVariantList& pointsIn, int maxPoints, bool* aggregatedOut, double* bucketDurationOut) {
-    if (aggregatedOut) *aggregatedOut = false;
-    if (bucketDurationOut) *bucketDurationOut = 0.0;
-
-    if (pointsIn.isEmpty() || maxPoints <= 0) {
-        return QVariantList();
-    }
-
-    // Parse into numeric list (skip malformed)
-    QVector<DsPoint> points;
-    points.reserve(pointsIn.size());
-    for (const QVariant& v : pointsIn) {
-        DsPoint p;
-        if (tryParsePointMap(v, p)) points.push_back(p);
-    }
-    if (points.isEmpty()) return QVariantList();
-
-    // Same rule as QML: if <= 2*maxPoints, no downsampling
-    if (points.size() <= 2 * maxPoints) {
-        return pointsIn;
-    }
-
-    // Compute total time range
-    const double startX = points.front().x;
-    const double endX   = points.back().x;
-    const double range  = endX - startX;
-    if (range <= 0.0) {
-        return pointsIn;
-    }
-
-    const double bucketDuration = range / double(maxPoints);
-    if (bucketDurationOut) *bucketDurationOut = bucketDuration;
-
-    QVariantList out;
-    out.reserve(2 * maxPoints);
-
-    // Current bucket [bucketStart, bucketEnd]
-    double bucketStart = startX;
-    double bucketEnd   = bucketStart + bucketDuration;
-    QVector<DsPoint> bucket;
-    bucket.reserve(64);
-
-    for (int i = 0; i < points.size(); ++i) {
-        const DsPoint& p = points[i];
-
-        if (p.x <= bucketEnd) {
-            bucket.push_back(p);
-        } else {
-            // Finish current bucket
-            flushBucketToOutput(bucket, out);
-
-            // Start next bucket
-            bucket.clear();
-            bucket.push_back(p);
-
-            bucketStart = bucketEnd;
-            bucketEnd   = bucketStart + bucketDuration;
-        }
-    }
-
-    // Flush last bucket
-    flushBucketToOutput(bucket, out);
-    if (aggregatedOut) *aggregatedOut = true;
-    return out;
+    // Typed, the plot item copies it straight into its vertex buffer
+    result[sensor + "_ds"] = series.value("series");
 }
 
 void worker::plotData() {
+    latencystats::record(latencystats::PlotQueue, latencystats::now() - plotRequestedNs);
+    const qint64 workerStart = latencystats::now();
     QVariantMap result;
     const int maxPts = (plotMaxPoints > 0) ? plotMaxPoints : 500;
 
-    // Fetch data
-    QVariantList tempRaw = db->getSensorData(deviceAddress, "temperature",  plotStartTime, plotEndTime);
-    QVariantList humRaw  = db->getSensorData(deviceAddress, "humidity",     plotStartTime, plotEndTime);
-    QVariantList presRaw = db->getSensorData(deviceAddress, "air_pressure", plotStartTime, plotEndTime);
-
-    // Downsample
+    // Fetch and downsample the data
     bool aggregated = false;
     double bucketDuration = 0.0;
-
-    QVariantList tempDs = downsampleMinMax(tempRaw, maxPts, &aggregated, &bucketDuration);
-    QVariantList humDs  = downsampleMinMax(humRaw,  maxPts, nullptr, nullptr);
-    QVariantList presDs = downsampleMinMax(presRaw, maxPts, nullptr, nullptr);
-
-    //Return BOTH
-    result["temperature_raw"] = tempRaw;
-    result["humidity_raw"] = humRaw;
-    result["air_pressure_raw"] = presRaw;
-    result["temperature_ds"] = tempDs;
-    result["humidity_ds"] = humDs;
-    result["air_pressure_ds"] = presDs;
+    plotSensor(result, "temperature", maxPts, &aggregated, &bucketDuration);
+    plotSensor(result, "humidity", maxPts);
+    plotSensor(result, "air_pressure", maxPts);
+    // Computed from temperature and humidity
+    plotSensor(result, "dew_point", maxPts);
+    plotSensor(result, "absolute_humidity", maxPts);
+    plotSensor(result, "vpd", maxPts);
     result["aggregated"] = aggregated;
     result["bucketDuration"] = bucketDuration;
 
     if (plotIsAir) {
-        QVariantList pm25Raw = db->getSensorData(deviceAddress, "pm25", plotStartTime, plotEndTime);
-        QVariantList co2Raw  = db->getSensorData(deviceAddress, "co2",  plotStartTime, plotEndTime);
-        QVariantList vocRaw  = db->getSensorData(deviceAddress, "voc",  plotStartTime, plotEndTime);
-        QVariantList noxRaw  = db->getSensorData(deviceAddress, "nox",  plotStartTime, plotEndTime);
-        QVariantList iaqsRaw = db->calculateIAQSList(pm25Raw, co2Raw);
-        result["pm25_raw"] = pm25Raw;
-        result["co2_raw"]  = co2Raw;
-        result["voc_raw"]  = vocRaw;
-        result["nox_raw"]  = noxRaw;
-        result["iaqs_raw"] = iaqsRaw;
-        result["pm25_ds"] = downsampleMinMax(pm25Raw, maxPts);
-        result["co2_ds"]  = downsampleMinMax(co2Raw,  maxPts);
-        result["voc_ds"]  = downsampleMinMax(vocRaw,  maxPts);
-        result["nox_ds"]  = downsampleMinMax(noxRaw,  maxPts);
-        result["iaqs_ds"] = downsampleMinMax(iaqsRaw, maxPts);
-    }
-    emit plotReady(result);
+        plotSensor(result, "pm25", maxPts);
+        plotSensor(result, "co2", maxPts);
+        plotSensor(result, "voc", maxPts);
+        plotSensor(result, "nox", maxPts);
+        plotSensor(result, "iaqs", maxPts);
+    }
+    latencystats::record(latencystats::PlotWorker, latencystats::now() - workerStart);
+    emit plotReady(result, latencystats::now());
+}
+
+void worker::compareData() {
+    emit comparisonReady(db->getComparisonData(compareDevices, querySensor, plotStartTime, plotEndTime, compareBuckets));
+}
+
+void worker::rangeStats() {
+    emit rangeStatsReady(db->getRangeStats(deviceAddress, querySensor, plotStartTime, plotEndTime));
 }
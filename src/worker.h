@@ -29,16 +29,23 @@ class worker : public QObject {
 
 public:
     worker(database* db, QString deviceAddress, QString deviceName, const QVariantList& data);
-    worker(database* db, const QString& deviceAddress, bool isAir, int startTime, int endTime, int maxPoints);
+    worker(database* db, const QString& deviceAddress, bool isAir, int startTime, int endTime, int maxPoints,
+           qint64 requestedNs);
+    worker(database* db, const QStringList& deviceAddresses, const QString& sensor, int startTime, int endTime, int buckets);
+    worker(database* db, const QString& deviceAddress, const QString& sensor, int startTime, int endTime);
 
 public slots:
     void inputRawData();
     void plotData();
+    void compareData();
+    void rangeStats();
 
 signals:
     void inputFinished();
     void inputProgress(int step);
-    void plotReady(QVariantMap result);
+    void plotReady(QVariantMap result, qint64 readyNs);
+    void comparisonReady(QVariantMap result);
+    void rangeStatsReady(QVariantMap result);
 
 private:
     database* db; // Pointer to the database object
@@ -49,12 +56,12 @@ private:
     int plotStartTime = 0;
     int plotEndTime = 0;
     int plotMaxPoints = 0;
-    struct DsPoint { double x; double y; };
-    static QVariantList downsampleMinMax(const QVariantList& pointsIn, int maxPoints,
+    qint64 plotRequestedNs = 0;
+    QStringList compareDevices;
+    QString querySensor;
+    int compareBuckets = 0;
+    void plotSensor(QVariantMap& result, const QString& sensor, int maxPoints,
         bool* aggregatedOut = nullptr, double* bucketDurationOut = nullptr);
-    static void flushBucketToOutput(const QVector<DsPoint>& bucket, QVariantList& out);
-    static bool tryParsePointMap(const QVariant& v, DsPoint& out);
-    static QVariant makePointVariant(const DsPoint& p);
 };
 
 #endif // WORKER_H